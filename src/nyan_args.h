@@ -0,0 +1,60 @@
+#ifndef SRC_NYAN_ARGS_H
+#define SRC_NYAN_ARGS_H
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// Number parsing for the command line of the tools. Returns false and
+// leaves 'out' alone unless all of 'arg' is a number that fits into 'out'
+// and is at least 'min', so bad input can go to the usage message.
+template<typename T>
+bool nyan_parse_arg(const char *arg, T &out, std::common_type_t<T> min = std::numeric_limits<T>::lowest())
+{
+    char *end = nullptr;
+    errno = 0;
+    T value;
+
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        const double v = std::strtod(arg, &end);
+
+        if (!std::isfinite(v) || std::fabs(v) > std::numeric_limits<T>::max())
+            return false;
+
+        value = static_cast<T>(v);
+    }
+    else if constexpr (std::is_signed_v<T>)
+    {
+        const long long v = std::strtoll(arg, &end, 10);
+
+        if (v < std::numeric_limits<T>::lowest() || v > std::numeric_limits<T>::max())
+            return false;
+
+        value = static_cast<T>(v);
+    }
+    else
+    {
+        // strtoull() accepts and negates "-1".
+        if (std::strchr(arg, '-'))
+            return false;
+
+        const unsigned long long v = std::strtoull(arg, &end, 10);
+
+        if (v > std::numeric_limits<T>::max())
+            return false;
+
+        value = static_cast<T>(v);
+    }
+
+    if (end == arg || *end || errno == ERANGE || value < min)
+        return false;
+
+    out = value;
+    return true;
+}
+
+#endif // SRC_NYAN_ARGS_H
@@ -0,0 +1,666 @@
+#include "nyan_audio.h"
+
+#include <SDL.h>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include "log.h"
+#include "nyan_simd.h"
+
+#ifdef NYAN_HAVE_VORBISFILE
+#include <vorbis/vorbisfile.h>
+#endif
+
+static const float NYAN_PI = 3.14159265358979323846f;
+
+struct NyanMusic
+{
+#ifdef NYAN_HAVE_VORBISFILE
+    OggVorbis_File vorbis;
+#endif
+    int sampleRate = 0;
+    int channels = 0;
+    NyanAudioRing ring;
+    std::thread decoder;
+    std::atomic<bool> quit{false};
+    std::atomic<u64> underruns{0};
+    SDL_AudioDeviceID device = 0;
+};
+
+int nyan_music_sample_rate(const NyanMusic *music)
+{
+    return music->sampleRate;
+}
+
+int nyan_music_channels(const NyanMusic *music)
+{
+    return music->channels;
+}
+
+void nyan_music_read(NyanMusic *music, float *out, size_t frames)
+{
+    const size_t samples = frames * music->channels;
+    const size_t got = music->ring.pop(out, samples);
+
+    if (got < samples)
+    {
+        std::fill(out + got, out + samples, 0.0f);
+        music->underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+u64 nyan_music_underruns(const NyanMusic *music)
+{
+    return music->underruns.load(std::memory_order_relaxed);
+}
+
+static void music_callback(void *userdata, Uint8 *stream, int len)
+{
+    auto music = static_cast<NyanMusic *>(userdata);
+    nyan_music_read(music, reinterpret_cast<float *>(stream), len / (sizeof(float) * music->channels));
+}
+
+SDL_AudioDeviceID nyan_music_play(NyanMusic *music)
+{
+    SDL_AudioSpec want = {};
+    want.freq = music->sampleRate;
+    want.format = AUDIO_F32SYS;
+    want.channels = static_cast<Uint8>(music->channels);
+    want.samples = 1024;
+    want.callback = music_callback;
+    want.userdata = music;
+
+    // No allowed changes, SDL converts to whatever the device wants.
+    SDL_AudioSpec have = {};
+    music->device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+
+    if (!music->device)
+        return 0;
+
+    // Give the decoder a head start so playback does not begin with underruns.
+    const auto deadline = SDL_GetTicks() + 1000;
+
+    while (music->ring.writable() > music->ring.capacity() / 4 && SDL_GetTicks() < deadline)
+        SDL_Delay(1);
+
+    SDL_PauseAudioDevice(music->device, 0);
+    return music->device;
+}
+
+#ifdef NYAN_HAVE_VORBISFILE
+// Frames decoded at once. The ring holds at least two chunks, the decoder
+// waits until a whole one fits.
+static const int ChunkFrames = 1024;
+
+static void decoder_main(NyanMusic *music)
+{
+    const int channels = music->channels;
+    std::vector<float> interleaved(ChunkFrames * channels);
+    int section = 0;
+
+    while (!music->quit.load(std::memory_order_relaxed))
+    {
+        if (music->ring.writable() < interleaved.size())
+        {
+            // The audio thread never waits on us, polling keeps it lock free.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+
+        float **pcm = nullptr;
+        const long frames = ov_read_float(&music->vorbis, &pcm, ChunkFrames, &section);
+
+        if (frames == 0)
+        {
+            // End of file, continue at the start for a gapless loop.
+            if (ov_pcm_seek(&music->vorbis, 0))
+            {
+                log_error("nyan_music: seeking back to the start failed");
+                return;
+            }
+            continue;
+        }
+
+        if (frames == OV_HOLE)
+            continue;
+
+        if (frames < 0)
+        {
+            log_error("nyan_music: decoding failed (%ld)", frames);
+            return;
+        }
+
+        for (long i=0; i<frames; ++i)
+            for (int c=0; c<channels; ++c)
+                interleaved[i * channels + c] = pcm[c][i];
+
+        music->ring.push(interleaved.data(), frames * channels);
+    }
+}
+
+NyanMusic *nyan_music_open(const char *filename, unsigned bufferMs)
+{
+    auto music = new NyanMusic;
+
+    if (ov_fopen(filename, &music->vorbis))
+    {
+        log_error("nyan_music_open: could not open '%s' as Ogg Vorbis", filename);
+        delete music;
+        return nullptr;
+    }
+
+    const vorbis_info *info = ov_info(&music->vorbis, -1);
+    music->sampleRate = static_cast<int>(info->rate);
+    music->channels = info->channels;
+    const size_t frames = std::max<size_t>(static_cast<size_t>(music->sampleRate) * bufferMs / 1000, 2 * ChunkFrames);
+    music->ring.reset(frames * music->channels);
+    music->decoder = std::thread(decoder_main, music);
+
+    log_debug("nyan_music_open: %s, %d Hz, %d channels, %.1f s", filename, music->sampleRate, music->channels,
+              ov_time_total(&music->vorbis, -1));
+
+    return music;
+}
+
+void nyan_music_close(NyanMusic *music)
+{
+    if (!music)
+        return;
+
+    if (music->device)
+        SDL_CloseAudioDevice(music->device);
+
+    music->quit = true;
+    music->decoder.join();
+    ov_clear(&music->vorbis);
+    delete music;
+}
+#else
+NyanMusic *nyan_music_open(const char *filename, unsigned)
+{
+    log_error("nyan_music_open: cannot play '%s', built without libvorbisfile", filename);
+    return nullptr;
+}
+
+void nyan_music_close(NyanMusic *music)
+{
+    delete music;
+}
+#endif
+
+bool nyan_sound_load_wav(const char *filename, int sampleRate, NyanSound &sound)
+{
+    SDL_AudioSpec spec = {};
+    Uint8 *buffer = nullptr;
+    Uint32 length = 0;
+
+    if (!SDL_LoadWAV(filename, &spec, &buffer, &length))
+        return false;
+
+    SDL_AudioCVT cvt = {};
+
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_S16SYS, 1, sampleRate) < 0)
+    {
+        SDL_FreeWAV(buffer);
+        return false;
+    }
+
+    std::vector<u8> data(static_cast<size_t>(length) * cvt.len_mult);
+    std::copy(buffer, buffer + length, data.begin());
+    SDL_FreeWAV(buffer);
+
+    cvt.buf = data.data();
+    cvt.len = static_cast<int>(length);
+
+    if (SDL_ConvertAudio(&cvt))
+        return false;
+
+    auto samples = reinterpret_cast<const s16 *>(data.data());
+    sound.samples.assign(samples, samples + cvt.len_cvt / sizeof(s16));
+    sound.sampleRate = sampleRate;
+    return true;
+}
+
+NyanSound nyan_sound_meow(int sampleRate)
+{
+    NyanSound sound;
+    sound.sampleRate = sampleRate;
+    sound.samples.resize(static_cast<size_t>(sampleRate) * 45 / 100);
+
+    const size_t count = sound.samples.size();
+    double phase = 0.0;
+
+    for (size_t i=0; i<count; ++i)
+    {
+        // The pitch rises and falls while the mouth opens, which brings in
+        // the upper harmonics: mi-aaow.
+        const float t = static_cast<float>(i) / count;
+        const float open = std::sin(t * NYAN_PI);
+        phase += (500.0 + 300.0 * open) / sampleRate;
+
+        float v = 0.0f;
+
+        for (int h=1; h<=6; ++h)
+            v += std::sin(2.0f * NYAN_PI * static_cast<float>(std::fmod(phase * h, 1.0))) * (h == 1 ? 1.0f : open / h);
+
+        const float envelope = std::min(1.0f, t * 20.0f) * (1.0f - t);
+        sound.samples[i] = static_cast<s16>(v * envelope * 0.3f * 32767.0f);
+    }
+
+    return sound;
+}
+
+// Frames mixed per pass, sizes the scratch buffers allocated up front.
+static const size_t MixBlockFrames = 512;
+
+struct NyanVoice
+{
+    const NyanSound *sound = nullptr;
+    size_t pos = 0;
+    float gain = 0.0f;   // before panning, decides which voice is stolen
+    float gainL = 0.0f;  // includes the s16 to float scale
+    float gainR = 0.0f;
+    bool loop = false;
+};
+
+struct NyanVoiceCmd
+{
+    const NyanSound *sound = nullptr;  // nullptr stops all voices
+    float gain = 0.0f;
+    float gainL = 0.0f;
+    float gainR = 0.0f;
+    bool loop = false;
+};
+
+using MixVoiceFn = void (*)(const s16 *src, size_t count, float gainL, float gainR, float *accL, float *accR);
+
+struct NyanMixer
+{
+    int sampleRate = 0;
+    std::vector<NyanVoice> voices;  // the first activeCount are playing
+    size_t activeCount = 0;
+    NyanSpscRing<NyanVoiceCmd> commands;
+    std::vector<float> accL;
+    std::vector<float> accR;
+    std::vector<float> musicScratch;
+    std::atomic<NyanMusic *> music{nullptr};
+    std::atomic<float> gain{0.5f};
+    std::atomic<MixVoiceFn> mixVoice{nullptr};
+    std::atomic<u64> played{0};
+    std::atomic<u64> stolen{0};
+    std::atomic<u64> dropped{0};
+    std::atomic<u32> active{0};
+    SDL_AudioDeviceID device = 0;
+};
+
+static void mix_voice_scalar(const s16 *src, size_t count, float gainL, float gainR, float *accL, float *accR)
+{
+    for (size_t i=0; i<count; ++i)
+    {
+        const float s = src[i];
+        accL[i] += s * gainL;
+        accR[i] += s * gainR;
+    }
+}
+
+static void write_f32_scalar(const float *accL, const float *accR, size_t count, float gain, float *out)
+{
+    for (size_t i=0; i<count; ++i)
+    {
+        out[i * 2 + 0] = std::clamp(accL[i] * gain, -1.0f, 1.0f);
+        out[i * 2 + 1] = std::clamp(accR[i] * gain, -1.0f, 1.0f);
+    }
+}
+
+static void write_s16_scalar(const float *accL, const float *accR, size_t count, float gain, s16 *out)
+{
+    const float scale = gain * 32767.0f;
+
+    for (size_t i=0; i<count; ++i)
+    {
+        out[i * 2 + 0] = static_cast<s16>(std::lrint(std::clamp(accL[i] * scale, -32768.0f, 32767.0f)));
+        out[i * 2 + 1] = static_cast<s16>(std::lrint(std::clamp(accR[i] * scale, -32768.0f, 32767.0f)));
+    }
+}
+
+#ifdef NYAN_X86_SIMD
+// Eight samples per iteration: sign extend to 32 bits by unpacking into the
+// upper halves and shifting back down, then convert and accumulate.
+NYAN_TARGET("sse2")
+static void mix_voice_sse2(const s16 *src, size_t count, float gainL, float gainR, float *accL, float *accR)
+{
+    const __m128 gl = _mm_set1_ps(gainL);
+    const __m128 gr = _mm_set1_ps(gainR);
+    size_t i = 0;
+
+    for (; i+8<=count; i+=8)
+    {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        _mm_storeu_ps(accL + i + 0, _mm_add_ps(_mm_loadu_ps(accL + i + 0), _mm_mul_ps(lo, gl)));
+        _mm_storeu_ps(accL + i + 4, _mm_add_ps(_mm_loadu_ps(accL + i + 4), _mm_mul_ps(hi, gl)));
+        _mm_storeu_ps(accR + i + 0, _mm_add_ps(_mm_loadu_ps(accR + i + 0), _mm_mul_ps(lo, gr)));
+        _mm_storeu_ps(accR + i + 4, _mm_add_ps(_mm_loadu_ps(accR + i + 4), _mm_mul_ps(hi, gr)));
+    }
+
+    mix_voice_scalar(src + i, count - i, gainL, gainR, accL + i, accR + i);
+}
+
+NYAN_TARGET("sse2")
+static void write_f32_sse2(const float *accL, const float *accR, size_t count, float gain, float *out)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i+4<=count; i+=4)
+    {
+        const __m128 l = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(accL + i), g), lo), hi);
+        const __m128 r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(accR + i), g), lo), hi);
+        _mm_storeu_ps(out + i * 2 + 0, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+
+    write_f32_scalar(accL + i, accR + i, count - i, gain, out + i * 2);
+}
+
+// Clamped before the conversion, out of range floats would turn into INT_MIN.
+NYAN_TARGET("sse2")
+static void write_s16_sse2(const float *accL, const float *accR, size_t count, float gain, s16 *out)
+{
+    const __m128 g = _mm_set1_ps(gain * 32767.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    auto convert = [&] (const float *acc)
+    {
+        return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(acc), g), lo), hi));
+    };
+    size_t i = 0;
+
+    for (; i+8<=count; i+=8)
+    {
+        const __m128i l = _mm_packs_epi32(convert(accL + i), convert(accL + i + 4));
+        const __m128i r = _mm_packs_epi32(convert(accR + i), convert(accR + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 0), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+    }
+
+    write_s16_scalar(accL + i, accR + i, count - i, gain, out + i * 2);
+}
+#endif
+
+NyanMixer *nyan_mixer_create(int sampleRate, size_t voiceCount)
+{
+    auto mixer = new NyanMixer;
+    mixer->sampleRate = sampleRate;
+    mixer->voices.resize(std::max<size_t>(voiceCount, 1));
+    mixer->commands.reset(std::max<size_t>(voiceCount * 2, 256));
+    mixer->accL.resize(MixBlockFrames);
+    mixer->accR.resize(MixBlockFrames);
+    mixer->musicScratch.resize(MixBlockFrames * 2);
+    nyan_mixer_set_simd(mixer, true);
+    return mixer;
+}
+
+void nyan_mixer_destroy(NyanMixer *mixer)
+{
+    if (mixer && mixer->device)
+        SDL_CloseAudioDevice(mixer->device);
+
+    delete mixer;
+}
+
+int nyan_mixer_sample_rate(const NyanMixer *mixer)
+{
+    return mixer->sampleRate;
+}
+
+void nyan_mixer_set_gain(NyanMixer *mixer, float gain)
+{
+    mixer->gain.store(gain, std::memory_order_relaxed);
+}
+
+void nyan_mixer_set_music(NyanMixer *mixer, NyanMusic *music)
+{
+    if (music && (nyan_music_sample_rate(music) != mixer->sampleRate || nyan_music_channels(music) > 2))
+    {
+        log_error("nyan_mixer_set_music: need mono or stereo music at %d Hz", mixer->sampleRate);
+        music = nullptr;
+    }
+
+    mixer->music.store(music, std::memory_order_release);
+}
+
+bool nyan_mixer_set_simd(NyanMixer *mixer, bool enable)
+{
+    MixVoiceFn fn = mix_voice_scalar;
+
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSE2 = SDL_HasSSE2();
+
+    if (enable && hasSSE2)
+        fn = mix_voice_sse2;
+#else
+    (void) enable;
+#endif
+
+    mixer->mixVoice.store(fn, std::memory_order_relaxed);
+    return fn != mix_voice_scalar;
+}
+
+bool nyan_mixer_play(NyanMixer *mixer, const NyanSound *sound, float gain, float pan, bool loop)
+{
+    if (!sound || sound->samples.empty())
+        return false;
+
+    // Constant power panning.
+    const float angle = (std::clamp(pan, -1.0f, 1.0f) + 1.0f) * NYAN_PI * 0.25f;
+    const float scale = gain / 32768.0f;
+    const NyanVoiceCmd cmd = { sound, gain, scale * std::cos(angle), scale * std::sin(angle), loop };
+    return mixer->commands.push(&cmd, 1) == 1;
+}
+
+bool nyan_mixer_play_at(NyanMixer *mixer, const NyanSound *sound, const NyanCamera &cam, const SDL_FPoint &pos,
+                        float gain)
+{
+    const auto screen = nyan_camera_to_screen(cam, pos);
+    const float dx = screen.x - cam.viewWidth * 0.5f;
+    const float dy = screen.y - cam.viewHeight * 0.5f;
+    const float dist = std::sqrt(dx * dx + dy * dy);
+
+    // Full volume within half the view, inverse distance falloff beyond.
+    const float ref = 0.5f * std::max(1, std::min(cam.viewWidth, cam.viewHeight));
+
+    if (dist > 4.0f * ref)
+        return false;
+
+    const float pan = dx / std::max(1.0f, cam.viewWidth * 0.5f);
+    return nyan_mixer_play(mixer, sound, gain * ref / std::max(dist, ref), pan);
+}
+
+void nyan_mixer_stop_all(NyanMixer *mixer)
+{
+    const NyanVoiceCmd cmd;
+    mixer->commands.push(&cmd, 1);
+}
+
+static void mixer_process_commands(NyanMixer *mixer)
+{
+    NyanVoiceCmd cmds[32];
+    size_t count;
+
+    while ((count = mixer->commands.pop(cmds, 32)))
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            const auto &cmd = cmds[i];
+
+            if (!cmd.sound)
+            {
+                mixer->activeCount = 0;
+                continue;
+            }
+
+            NyanVoice *voice = nullptr;
+
+            if (mixer->activeCount < mixer->voices.size())
+                voice = &mixer->voices[mixer->activeCount++];
+            else
+            {
+                // Pool exhausted: steal the quietest voice if the new one is
+                // louder. Panning does not count, a hard-panned voice is as
+                // loud as a centered one.
+                auto quietest = std::min_element(mixer->voices.begin(), mixer->voices.end(),
+                    [] (const NyanVoice &a, const NyanVoice &b) { return a.gain < b.gain; });
+
+                if (quietest->gain >= cmd.gain)
+                {
+                    mixer->dropped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                voice = &*quietest;
+                mixer->stolen.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            *voice = { cmd.sound, 0, cmd.gain, cmd.gainL, cmd.gainR, cmd.loop };
+            mixer->played.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Adds 'count' frames of 'voice' to the accumulators. Returns false once a
+// voice that does not loop has finished.
+static bool mixer_mix_voice(NyanMixer *mixer, MixVoiceFn mixVoice, NyanVoice &voice, size_t count)
+{
+    const auto &samples = voice.sound->samples;
+    size_t done = 0;
+
+    while (done < count)
+    {
+        const size_t n = std::min(count - done, samples.size() - voice.pos);
+        mixVoice(samples.data() + voice.pos, n, voice.gainL, voice.gainR,
+                 mixer->accL.data() + done, mixer->accR.data() + done);
+        voice.pos += n;
+        done += n;
+
+        if (voice.pos == samples.size())
+        {
+            if (!voice.loop)
+                return false;
+            voice.pos = 0;
+        }
+    }
+
+    return true;
+}
+
+static void mixer_mix_music(NyanMixer *mixer, NyanMusic *music, size_t count)
+{
+    float *src = mixer->musicScratch.data();
+    nyan_music_read(music, src, count);
+
+    if (nyan_music_channels(music) == 2)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            mixer->accL[i] += src[i * 2 + 0];
+            mixer->accR[i] += src[i * 2 + 1];
+        }
+    }
+    else
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            mixer->accL[i] += src[i];
+            mixer->accR[i] += src[i];
+        }
+    }
+}
+
+template<typename Out, typename WriteFn>
+static void mixer_render(NyanMixer *mixer, Out *out, size_t frames, WriteFn writeScalar, WriteFn writeSimd)
+{
+    mixer_process_commands(mixer);
+
+    const auto mixVoice = mixer->mixVoice.load(std::memory_order_relaxed);
+    const auto write = mixVoice == mix_voice_scalar ? writeScalar : writeSimd;
+    const float gain = mixer->gain.load(std::memory_order_relaxed);
+    NyanMusic *music = mixer->music.load(std::memory_order_acquire);
+
+    while (frames)
+    {
+        const size_t count = std::min(frames, MixBlockFrames);
+        std::fill(mixer->accL.begin(), mixer->accL.begin() + count, 0.0f);
+        std::fill(mixer->accR.begin(), mixer->accR.begin() + count, 0.0f);
+
+        if (music)
+            mixer_mix_music(mixer, music, count);
+
+        for (size_t v=0; v<mixer->activeCount;)
+        {
+            if (mixer_mix_voice(mixer, mixVoice, mixer->voices[v], count))
+                ++v;
+            else
+                mixer->voices[v] = mixer->voices[--mixer->activeCount];
+        }
+
+        write(mixer->accL.data(), mixer->accR.data(), count, gain, out);
+        out += count * 2;
+        frames -= count;
+    }
+
+    mixer->active.store(static_cast<u32>(mixer->activeCount), std::memory_order_relaxed);
+}
+
+void nyan_mixer_mix(NyanMixer *mixer, float *out, size_t frames)
+{
+#ifdef NYAN_X86_SIMD
+    mixer_render(mixer, out, frames, write_f32_scalar, write_f32_sse2);
+#else
+    mixer_render(mixer, out, frames, write_f32_scalar, write_f32_scalar);
+#endif
+}
+
+void nyan_mixer_mix_s16(NyanMixer *mixer, s16 *out, size_t frames)
+{
+#ifdef NYAN_X86_SIMD
+    mixer_render(mixer, out, frames, write_s16_scalar, write_s16_sse2);
+#else
+    mixer_render(mixer, out, frames, write_s16_scalar, write_s16_scalar);
+#endif
+}
+
+NyanMixerStats nyan_mixer_stats(const NyanMixer *mixer)
+{
+    NyanMixerStats stats;
+    stats.played = mixer->played.load(std::memory_order_relaxed);
+    stats.stolen = mixer->stolen.load(std::memory_order_relaxed);
+    stats.dropped = mixer->dropped.load(std::memory_order_relaxed);
+    stats.active = mixer->active.load(std::memory_order_relaxed);
+    return stats;
+}
+
+static void mixer_callback(void *userdata, Uint8 *stream, int len)
+{
+    nyan_mixer_mix(static_cast<NyanMixer *>(userdata), reinterpret_cast<float *>(stream), len / (sizeof(float) * 2));
+}
+
+SDL_AudioDeviceID nyan_mixer_open_device(NyanMixer *mixer)
+{
+    SDL_AudioSpec want = {};
+    want.freq = mixer->sampleRate;
+    want.format = AUDIO_F32SYS;
+    want.channels = 2;
+    want.samples = 512;
+    want.callback = mixer_callback;
+    want.userdata = mixer;
+
+    SDL_AudioSpec have = {};
+    mixer->device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+
+    if (mixer->device)
+        SDL_PauseAudioDevice(mixer->device, 0);
+
+    return mixer->device;
+}
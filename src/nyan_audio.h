@@ -0,0 +1,180 @@
+#ifndef SRC_NYAN_AUDIO_H
+#define SRC_NYAN_AUDIO_H
+
+#include <SDL_audio.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "nyan_swarm.h"
+#include "nyan_types.h"
+
+// Single producer, single consumer ring of trivially copyable items. One
+// thread may push() while another one pops(), neither blocks nor allocates.
+// The capacity is rounded up to a power of two.
+template<typename T>
+class NyanSpscRing
+{
+    public:
+        explicit NyanSpscRing(size_t capacity = 0)
+        {
+            reset(capacity);
+        }
+
+        // Not thread safe, call before producer and consumer start.
+        void reset(size_t capacity)
+        {
+            size_t size = 1;
+            while (size < capacity)
+                size *= 2;
+
+            buffer.assign(capacity ? size : 0, T());
+            mask = capacity ? size - 1 : 0;
+            readPos.store(0, std::memory_order_relaxed);
+            writePos.store(0, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const { return buffer.size(); }
+
+        size_t readable() const
+        {
+            return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+        }
+
+        size_t writable() const
+        {
+            return capacity() - (writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire));
+        }
+
+        // Producer side. Returns the number of items written.
+        size_t push(const T *src, size_t count)
+        {
+            const size_t w = writePos.load(std::memory_order_relaxed);
+            count = std::min(count, writable());
+            const size_t first = std::min(count, capacity() - (w & mask));
+            std::copy(src, src + first, buffer.data() + (w & mask));
+            std::copy(src + first, src + count, buffer.data());
+            writePos.store(w + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side. Returns the number of items read.
+        size_t pop(T *dst, size_t count)
+        {
+            const size_t r = readPos.load(std::memory_order_relaxed);
+            count = std::min(count, readable());
+            const size_t first = std::min(count, capacity() - (r & mask));
+            std::copy(buffer.data() + (r & mask), buffer.data() + (r & mask) + first, dst);
+            std::copy(buffer.data(), buffer.data() + (count - first), dst + first);
+            readPos.store(r + count, std::memory_order_release);
+            return count;
+        }
+
+    private:
+        std::vector<T> buffer;
+        size_t mask = 0;
+        // Monotonic positions, the index into the buffer is pos & mask.
+        alignas(64) std::atomic<size_t> readPos{0};
+        alignas(64) std::atomic<size_t> writePos{0};
+};
+
+using NyanAudioRing = NyanSpscRing<float>;
+
+// Streaming playback of Ogg Vorbis music, e.g. nyanlooped.ogg. A background
+// thread decodes small chunks into a NyanAudioRing, the audio callback only
+// copies out of it. At the end of the file decoding continues at the start,
+// so looped files play without a gap. Needs libvorbisfile at build time.
+struct NyanMusic;
+
+// Opens 'filename' and starts decoding into a ring holding 'bufferMs'
+// milliseconds of audio, but at least 2048 frames. Returns nullptr on error.
+NyanMusic *nyan_music_open(const char *filename, unsigned bufferMs = 250);
+
+// Stops playback if nyan_music_play() was used, then the decoder thread.
+void nyan_music_close(NyanMusic *music);
+
+int nyan_music_sample_rate(const NyanMusic *music);
+int nyan_music_channels(const NyanMusic *music);
+
+// Fills 'out' with 'frames' interleaved float frames. Frames the decoder has
+// not delivered yet are silence and count as one underrun. Never blocks or
+// allocates, meant to be called from the audio callback.
+void nyan_music_read(NyanMusic *music, float *out, size_t frames);
+
+// Number of nyan_music_read() calls that could not be served completely.
+u64 nyan_music_underruns(const NyanMusic *music);
+
+// Opens the default audio device in the format of the stream, waits for the
+// ring to fill up and starts playback. Returns 0 on error, see SDL_GetError().
+SDL_AudioDeviceID nyan_music_play(NyanMusic *music);
+
+// Short mono sound effect, 16-bit samples at the rate of the mixer.
+struct NyanSound
+{
+    std::vector<s16> samples;
+    int sampleRate = 0;
+};
+
+// Loads a WAV file and converts it to mono at 'sampleRate'. Returns false on
+// error, see SDL_GetError().
+bool nyan_sound_load_wav(const char *filename, int sampleRate, NyanSound &sound);
+
+// A synthesized meow, so there is something to play without extra files.
+NyanSound nyan_sound_meow(int sampleRate);
+
+// Mixes many short sounds, e.g. one meow per cat, into a stereo float stream.
+// The voices live in a pool allocated up front. Play requests go through a
+// lock-free queue to the audio thread, which mixes with SSE2 if available.
+// When the pool is full a new sound replaces the quietest playing voice if it
+// is louder, otherwise it is dropped. Nothing allocates or locks in
+// nyan_mixer_mix(), so it can run in the audio callback.
+struct NyanMixer;
+
+struct NyanMixerStats
+{
+    u64 played = 0;   // voices started
+    u64 stolen = 0;   // voices cut off for a louder one
+    u64 dropped = 0;  // requests ignored, every voice was louder
+    u32 active = 0;   // voices playing after the last mix
+};
+
+NyanMixer *nyan_mixer_create(int sampleRate, size_t voiceCount);
+void nyan_mixer_destroy(NyanMixer *mixer);
+
+int nyan_mixer_sample_rate(const NyanMixer *mixer);
+
+// Gain applied to the final mix, 0.5 by default.
+void nyan_mixer_set_gain(NyanMixer *mixer, float gain);
+
+// Music to mix under the voices, nullptr to stop. Mono or stereo streams at
+// the rate of the mixer. Reading happens on the audio thread.
+void nyan_mixer_set_music(NyanMixer *mixer, NyanMusic *music);
+
+// Use the SIMD kernels if the CPU has them (the default) or the scalar ones.
+// Returns whether SIMD is used. Meant for benchmarks.
+bool nyan_mixer_set_simd(NyanMixer *mixer, bool enable);
+
+// Queues a sound with the given gain and stereo position from -1 (left) to
+// 1 (right). 'sound' has to outlive its voices. Call from one thread only.
+// Returns false if the queue is full.
+bool nyan_mixer_play(NyanMixer *mixer, const NyanSound *sound, float gain, float pan = 0.0f, bool loop = false);
+
+// Plays 'sound' as if emitted at world position 'pos'. Gain falls off with
+// the distance to the center of the camera view, the stereo position follows
+// the horizontal offset. Sounds far outside of the view are not played.
+bool nyan_mixer_play_at(NyanMixer *mixer, const NyanSound *sound, const NyanCamera &cam, const SDL_FPoint &pos,
+                        float gain = 1.0f);
+
+// Stops all voices.
+void nyan_mixer_stop_all(NyanMixer *mixer);
+
+// Renders 'frames' interleaved stereo frames. Audio thread only.
+void nyan_mixer_mix(NyanMixer *mixer, float *out, size_t frames);
+void nyan_mixer_mix_s16(NyanMixer *mixer, s16 *out, size_t frames);
+
+NyanMixerStats nyan_mixer_stats(const NyanMixer *mixer);
+
+// Opens the default audio device as stereo float at the rate of the mixer and
+// starts playback. Returns 0 on error, see SDL_GetError().
+SDL_AudioDeviceID nyan_mixer_open_device(NyanMixer *mixer);
+
+#endif // SRC_NYAN_AUDIO_H
@@ -0,0 +1,474 @@
+#include "nyan_export.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "log.h"
+#include "nyan_jobs.h"
+#include "nyan_png.h"
+#include "nyan_simd.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// BT.601 limited range, 8-bit fixed point.
+static u8 rgb_to_y(int r, int g, int b) { return static_cast<u8>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+static u8 rgb_to_u(int r, int g, int b) { return static_cast<u8>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+static u8 rgb_to_v(int r, int g, int b) { return static_cast<u8>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+
+// Converts pixels [x, width) of a pair of rows. 'row1' and 'y1' equal 'row0'
+// and 'y0' for the last row of an odd height image.
+static void yuv420_rows_scalar(const u32 *row0, const u32 *row1, int x, int width, u8 *y0, u8 *y1, u8 *u, u8 *v)
+{
+    for (; x<width; x+=2)
+    {
+        const int x1 = std::min(x + 1, width - 1);
+        const u32 quad[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+        int r = 0, g = 0, b = 0;
+
+        for (u32 p: quad)
+        {
+            r += (p >> 16) & 0xff;
+            g += (p >> 8) & 0xff;
+            b += p & 0xff;
+        }
+
+        y0[x] = rgb_to_y((row0[x] >> 16) & 0xff, (row0[x] >> 8) & 0xff, row0[x] & 0xff);
+        y1[x] = rgb_to_y((row1[x] >> 16) & 0xff, (row1[x] >> 8) & 0xff, row1[x] & 0xff);
+
+        if (x1 != x)
+        {
+            y0[x1] = rgb_to_y((row0[x1] >> 16) & 0xff, (row0[x1] >> 8) & 0xff, row0[x1] & 0xff);
+            y1[x1] = rgb_to_y((row1[x1] >> 16) & 0xff, (row1[x1] >> 8) & 0xff, row1[x1] & 0xff);
+        }
+
+        u[x / 2] = rgb_to_u((r + 2) >> 2, (g + 2) >> 2, (b + 2) >> 2);
+        v[x / 2] = rgb_to_v((r + 2) >> 2, (g + 2) >> 2, (b + 2) >> 2);
+    }
+}
+
+#ifdef NYAN_X86_SIMD
+// Splits 8 ARGB pixels into 16-bit R, G and B lanes.
+NYAN_TARGET("sse2")
+static inline void split_rgb(__m128i p0, __m128i p1, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+    b = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+}
+
+// The weighted sum stays below 2^16, so it wraps correctly in 16-bit lanes
+// and a logical shift gives the unsigned result.
+NYAN_TARGET("sse2")
+static inline __m128i luma(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+// Chroma weights fit into signed 16 bits, same rounding as the scalar code.
+NYAN_TARGET("sse2")
+static inline __m128i chroma(__m128i r, __m128i g, __m128i b, short cr, short cg, short cb)
+{
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    c = _mm_add_epi16(c, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+
+// Sums of horizontally adjacent lanes of a and b, divided by four with
+// rounding: the 2x2 averages when a and b hold the sums of two rows.
+NYAN_TARGET("sse2")
+static inline __m128i quad_average(__m128i a, __m128i b)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i sums = _mm_packs_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+    return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+// 16 pixels of two rows per iteration. Returns the number of pixels done.
+NYAN_TARGET("sse2")
+static int yuv420_rows_sse2(const u32 *row0, const u32 *row1, int width, u8 *y0, u8 *y1, u8 *u, u8 *v)
+{
+    auto load = [] (const u32 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); };
+    int x = 0;
+
+    for (; x+16<=width; x+=16)
+    {
+        __m128i r[4], g[4], b[4];
+        split_rgb(load(row0 + x + 0), load(row0 + x + 4), r[0], g[0], b[0]);
+        split_rgb(load(row0 + x + 8), load(row0 + x + 12), r[1], g[1], b[1]);
+        split_rgb(load(row1 + x + 0), load(row1 + x + 4), r[2], g[2], b[2]);
+        split_rgb(load(row1 + x + 8), load(row1 + x + 12), r[3], g[3], b[3]);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x),
+                         _mm_packus_epi16(luma(r[0], g[0], b[0]), luma(r[1], g[1], b[1])));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x),
+                         _mm_packus_epi16(luma(r[2], g[2], b[2]), luma(r[3], g[3], b[3])));
+
+        const __m128i ra = quad_average(_mm_add_epi16(r[0], r[2]), _mm_add_epi16(r[1], r[3]));
+        const __m128i ga = quad_average(_mm_add_epi16(g[0], g[2]), _mm_add_epi16(g[1], g[3]));
+        const __m128i ba = quad_average(_mm_add_epi16(b[0], b[2]), _mm_add_epi16(b[1], b[3]));
+        const __m128i zero = _mm_setzero_si128();
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm_packus_epi16(chroma(ra, ga, ba, -38, -74, 112), zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_packus_epi16(chroma(ra, ga, ba, 112, -94, -18), zero));
+    }
+
+    return x;
+}
+#endif
+
+void nyan_argb_to_yuv420(const NyanImage &src, u8 *y, u8 *u, u8 *v)
+{
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSE2 = SDL_HasSSE2();
+#endif
+    const int w = src.width;
+    const int chromaWidth = (w + 1) / 2;
+
+    for (int row=0; row<src.height; row+=2)
+    {
+        const u32 *row0 = src.pixels.data() + row * w;
+        const bool pair = row + 1 < src.height;
+        const u32 *row1 = pair ? row0 + w : row0;
+        u8 *y0 = y + row * w;
+        u8 *y1 = pair ? y0 + w : y0;
+        u8 *uRow = u + row / 2 * chromaWidth;
+        u8 *vRow = v + row / 2 * chromaWidth;
+        int x = 0;
+
+#ifdef NYAN_X86_SIMD
+        if (hasSSE2)
+            x = yuv420_rows_sse2(row0, row1, w, y0, y1, uRow, vRow);
+#endif
+
+        yuv420_rows_scalar(row0, row1, x, w, y0, y1, uRow, vRow);
+    }
+}
+
+void nyan_argb_to_rgba(const u32 *src, size_t count, u8 *dst)
+{
+    for (size_t i=0; i<count; ++i)
+    {
+        const u32 p = src[i];
+        dst[i * 4 + 0] = static_cast<u8>(p >> 16);
+        dst[i * 4 + 1] = static_cast<u8>(p >> 8);
+        dst[i * 4 + 2] = static_cast<u8>(p);
+        dst[i * 4 + 3] = static_cast<u8>(p >> 24);
+    }
+}
+
+struct NyanPngSlot
+{
+    std::vector<u8> data;
+    double encodeSeconds = 0.0;
+    double writeSeconds = 0.0;
+    bool ok = true;
+};
+
+struct NyanVideoWriter
+{
+    FILE *file = nullptr;
+    bool ownsFile = false;
+    NyanVideoFormat format = NyanVideoFormat::Y4M;
+    int width = 0;
+    int height = 0;
+    size_t batchSize = 1;     // frames taken from the queue at once
+    std::string pngPrefix;
+    std::vector<NyanPngSlot> pngSlots;
+
+    std::vector<NyanImage> buffers;
+    std::vector<NyanImage *> freeBuffers;
+    std::deque<NyanImage *> queue;
+    std::mutex mutex;
+    std::condition_variable freeCv;
+    std::condition_variable queueCv;
+    bool closing = false;
+    std::atomic<bool> failed{false};
+
+    std::vector<u8> scratch;  // converted frame, writer thread only
+    NyanVideoWriterStats stats;
+    std::thread thread;
+};
+
+static double seconds_since(u64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+static bool writer_write(NyanVideoWriter *writer, const void *data, size_t size)
+{
+    if (std::fwrite(data, 1, size, writer->file) != size)
+    {
+        log_error("nyan_video_writer: write failed: %s", std::strerror(errno));
+        writer->failed = true;
+        return false;
+    }
+
+    writer->stats.bytes += size;
+    return true;
+}
+
+static void writer_write_frame(NyanVideoWriter *writer, const NyanImage &frame)
+{
+    const size_t pixelCount = static_cast<size_t>(writer->width) * writer->height;
+    auto start = SDL_GetPerformanceCounter();
+
+    if (writer->format == NyanVideoFormat::Y4M)
+    {
+        const size_t chromaSize = static_cast<size_t>((writer->width + 1) / 2) * ((writer->height + 1) / 2);
+        u8 *y = writer->scratch.data();
+        nyan_argb_to_yuv420(frame, y, y + pixelCount, y + pixelCount + chromaSize);
+        writer->stats.convertSeconds += seconds_since(start);
+
+        start = SDL_GetPerformanceCounter();
+        static const char FrameHeader[] = "FRAME\n";
+        if (writer_write(writer, FrameHeader, sizeof(FrameHeader) - 1))
+            writer_write(writer, y, pixelCount + 2 * chromaSize);
+    }
+    else
+    {
+        nyan_argb_to_rgba(frame.pixels.data(), pixelCount, writer->scratch.data());
+        writer->stats.convertSeconds += seconds_since(start);
+
+        start = SDL_GetPerformanceCounter();
+        writer_write(writer, writer->scratch.data(), pixelCount * 4);
+    }
+
+    writer->stats.writeSeconds += seconds_since(start);
+    ++writer->stats.frames;
+}
+
+static bool write_file(const char *filename, const std::vector<u8> &data)
+{
+    FILE *file = std::fopen(filename, "wb");
+
+    if (!file)
+    {
+        log_error("nyan_video_writer: could not open '%s': %s", filename, std::strerror(errno));
+        return false;
+    }
+
+    const bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+
+    if (std::fclose(file) || !ok)
+    {
+        log_error("nyan_video_writer: writing '%s' failed", filename);
+        return false;
+    }
+
+    return true;
+}
+
+// Encodes and writes a batch of frames in parallel, one PNG per task. File
+// names follow the submission order.
+static void writer_write_pngs(NyanVideoWriter *writer, NyanJobSystem *jobs, const std::vector<NyanImage *> &frames)
+{
+    const u64 first = writer->stats.frames;
+
+    nyan_parallel_for(jobs, frames.size(), 1, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            auto &slot = writer->pngSlots[i];
+            auto start = SDL_GetPerformanceCounter();
+            nyan_png_encode(*frames[i], slot.data);
+            slot.encodeSeconds = seconds_since(start);
+
+            char number[32];
+            std::snprintf(number, sizeof(number), "%05llu.png", static_cast<unsigned long long>(first + i));
+            start = SDL_GetPerformanceCounter();
+            slot.ok = !slot.data.empty() && write_file((writer->pngPrefix + number).c_str(), slot.data);
+            slot.writeSeconds = seconds_since(start);
+        }
+    });
+
+    for (size_t i=0; i<frames.size(); ++i)
+    {
+        const auto &slot = writer->pngSlots[i];
+        writer->stats.convertSeconds += slot.encodeSeconds;
+        writer->stats.writeSeconds += slot.writeSeconds;
+        writer->stats.bytes += slot.data.size();
+        writer->failed = writer->failed || !slot.ok;
+    }
+
+    writer->stats.frames += frames.size();
+}
+
+static void writer_main(NyanVideoWriter *writer)
+{
+    // PNG compression runs on a job system owned by this thread.
+    NyanJobSystem *jobs = writer->format == NyanVideoFormat::PNG
+        ? nyan_jobs_create(static_cast<unsigned>(writer->batchSize)) : nullptr;
+    std::vector<NyanImage *> batch;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(writer->mutex);
+            writer->queueCv.wait(lock, [writer]
+            {
+                return writer->queue.size() >= writer->batchSize || writer->closing;
+            });
+
+            if (writer->queue.empty())
+                break;
+
+            const size_t count = std::min(writer->batchSize, writer->queue.size());
+            batch.assign(writer->queue.begin(), writer->queue.begin() + count);
+            writer->queue.erase(writer->queue.begin(), writer->queue.begin() + count);
+        }
+
+        if (!writer->failed)
+        {
+            if (jobs)
+                writer_write_pngs(writer, jobs, batch);
+            else
+                writer_write_frame(writer, *batch[0]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(writer->mutex);
+            writer->freeBuffers.insert(writer->freeBuffers.end(), batch.begin(), batch.end());
+        }
+
+        writer->freeCv.notify_one();
+    }
+
+    nyan_jobs_destroy(jobs);
+}
+
+NyanVideoWriter *nyan_video_writer_open(const char *filename, NyanVideoFormat format, int width, int height,
+                                        int fps, size_t queueDepth)
+{
+    const bool png = format == NyanVideoFormat::PNG;
+    const bool toStdout = std::strcmp(filename, "-") == 0;
+
+    if (png && toStdout)
+    {
+        log_error("nyan_video_writer_open: PNG sequences cannot be written to stdout");
+        return nullptr;
+    }
+
+    FILE *file = png ? nullptr : toStdout ? stdout : std::fopen(filename, "wb");
+
+    if (!png && !file)
+    {
+        log_error("nyan_video_writer_open: could not open '%s': %s", filename, std::strerror(errno));
+        return nullptr;
+    }
+
+#ifdef _WIN32
+    if (toStdout)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    auto writer = new NyanVideoWriter;
+    writer->file = file;
+    writer->ownsFile = file && !toStdout;
+    writer->format = format;
+    writer->width = width;
+    writer->height = height;
+
+    if (png)
+    {
+        // A batch per CPU, plus as many buffers again so rendering continues
+        // while a batch is compressed.
+        writer->batchSize = std::max(SDL_GetCPUCount(), 1);
+        writer->pngPrefix = filename;
+        writer->pngSlots.resize(writer->batchSize);
+    }
+
+    writer->buffers.resize(std::max<size_t>(queueDepth, writer->batchSize * 2));
+
+    for (auto &buffer: writer->buffers)
+    {
+        buffer.width = width;
+        buffer.height = height;
+        buffer.pixels.resize(static_cast<size_t>(width) * height);
+        writer->freeBuffers.push_back(&buffer);
+    }
+
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    const size_t chromaSize = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    writer->scratch.resize(format == NyanVideoFormat::Y4M ? pixelCount + 2 * chromaSize
+                           : format == NyanVideoFormat::RGBA ? pixelCount * 4 : 0);
+
+    if (format == NyanVideoFormat::Y4M)
+    {
+        char header[128];
+        const int size = std::snprintf(header, sizeof(header),
+                                       "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                                       width, height, fps);
+        writer_write(writer, header, size);
+    }
+
+    writer->thread = std::thread(writer_main, writer);
+    return writer;
+}
+
+NyanImage *nyan_video_writer_acquire(NyanVideoWriter *writer)
+{
+    const auto start = SDL_GetPerformanceCounter();
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    writer->freeCv.wait(lock, [writer] { return !writer->freeBuffers.empty(); });
+    writer->stats.stallSeconds += seconds_since(start);
+
+    auto frame = writer->freeBuffers.back();
+    writer->freeBuffers.pop_back();
+    return frame;
+}
+
+bool nyan_video_writer_submit(NyanVideoWriter *writer, NyanImage *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->queue.push_back(frame);
+    }
+
+    writer->queueCv.notify_one();
+    return !writer->failed;
+}
+
+bool nyan_video_writer_close(NyanVideoWriter *writer, NyanVideoWriterStats *stats)
+{
+    if (!writer)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->closing = true;
+    }
+
+    writer->queueCv.notify_one();
+    writer->thread.join();
+
+    if (writer->file && std::fflush(writer->file))
+    {
+        log_error("nyan_video_writer_close: flush failed: %s", std::strerror(errno));
+        writer->failed = true;
+    }
+
+    if (writer->ownsFile && std::fclose(writer->file))
+        writer->failed = true;
+
+    const bool ok = !writer->failed;
+
+    if (stats)
+        *stats = writer->stats;
+
+    delete writer;
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef SRC_NYAN_EXPORT_H
+#define SRC_NYAN_EXPORT_H
+
+#include "nyan_soft.h"
+#include "nyan_types.h"
+
+// Offline video export of software rendered frames. Frames are handed to a
+// writer thread through a bounded queue, so pixel conversion and file I/O
+// overlap with rendering the next frame. The producer only waits when all
+// queued buffers are still in flight.
+
+enum class NyanVideoFormat
+{
+    Y4M,   // YUV4MPEG2, 4:2:0 BT.601 limited range, readable by ffmpeg and mpv
+    RGBA,  // headerless RGBA bytes, e.g. for ffmpeg -f rawvideo -pix_fmt rgba
+    PNG,   // one PNG per frame, <filename>00000.png, <filename>00001.png, ...
+};
+
+struct NyanVideoWriter;
+
+struct NyanVideoWriterStats
+{
+    u64 frames = 0;
+    u64 bytes = 0;
+    // Writer side, for PNG summed over all encoding threads.
+    double convertSeconds = 0.0;  // pixel format conversion or PNG encoding
+    double writeSeconds = 0.0;    // file I/O
+    double stallSeconds = 0.0;    // producer waiting for a free buffer
+};
+
+// Opens 'filename' for writing, "-" writes to stdout. 'queueDepth' frames of
+// width x height are allocated up front. PNG frames are compressed in
+// batches of one frame per CPU on a job system owned by the writer thread,
+// with at least two batches worth of buffers. Returns nullptr on error.
+NyanVideoWriter *nyan_video_writer_open(const char *filename, NyanVideoFormat format, int width, int height,
+                                        int fps, size_t queueDepth = 4);
+
+// Returns a buffer to render the next frame into, blocking while all buffers
+// are queued. Pass it to nyan_video_writer_submit() when done.
+NyanImage *nyan_video_writer_acquire(NyanVideoWriter *writer);
+
+// Queues a frame from nyan_video_writer_acquire(). Returns false if writing
+// has failed, later frames are dropped then.
+bool nyan_video_writer_submit(NyanVideoWriter *writer, NyanImage *frame);
+
+// Writes the remaining frames and closes the file. Returns false if any
+// write failed.
+bool nyan_video_writer_close(NyanVideoWriter *writer, NyanVideoWriterStats *stats = nullptr);
+
+// Converts to 4:2:0 planes: y is width x height, u and v are rounded up
+// halves. Chroma is the average of each 2x2 block. Uses SSE2 if available.
+void nyan_argb_to_yuv420(const NyanImage &src, u8 *y, u8 *u, u8 *v);
+
+// Converts ARGB8888 pixels to RGBA byte order.
+void nyan_argb_to_rgba(const u32 *src, size_t count, u8 *dst);
+
+#endif // SRC_NYAN_EXPORT_H
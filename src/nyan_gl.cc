@@ -0,0 +1,351 @@
+#include "nyan_gl.h"
+
+#include <SDL.h>
+#include <SDL_opengl.h>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "log.h"
+
+// Everything used past OpenGL 1.1 has to be loaded at runtime anyway, so all
+// of it is.
+#define NYAN_GL_FUNCTIONS(X) \
+    X(GLenum, GetError, (void)) \
+    X(void, Viewport, (GLint, GLint, GLsizei, GLsizei)) \
+    X(void, ClearColor, (GLfloat, GLfloat, GLfloat, GLfloat)) \
+    X(void, Clear, (GLbitfield)) \
+    X(void, Finish, (void)) \
+    X(void, ReadPixels, (GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, void *)) \
+    X(void, PixelStorei, (GLenum, GLint)) \
+    X(void, Enable, (GLenum)) \
+    X(void, BlendFuncSeparate, (GLenum, GLenum, GLenum, GLenum)) \
+    X(void, GenTextures, (GLsizei, GLuint *)) \
+    X(void, DeleteTextures, (GLsizei, const GLuint *)) \
+    X(void, BindTexture, (GLenum, GLuint)) \
+    X(void, ActiveTexture, (GLenum)) \
+    X(void, TexParameteri, (GLenum, GLenum, GLint)) \
+    X(void, TexImage2D, (GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *)) \
+    X(GLuint, CreateShader, (GLenum)) \
+    X(void, ShaderSource, (GLuint, GLsizei, const GLchar *const *, const GLint *)) \
+    X(void, CompileShader, (GLuint)) \
+    X(void, GetShaderiv, (GLuint, GLenum, GLint *)) \
+    X(void, GetShaderInfoLog, (GLuint, GLsizei, GLsizei *, GLchar *)) \
+    X(void, DeleteShader, (GLuint)) \
+    X(GLuint, CreateProgram, (void)) \
+    X(void, AttachShader, (GLuint, GLuint)) \
+    X(void, LinkProgram, (GLuint)) \
+    X(void, GetProgramiv, (GLuint, GLenum, GLint *)) \
+    X(void, GetProgramInfoLog, (GLuint, GLsizei, GLsizei *, GLchar *)) \
+    X(void, DeleteProgram, (GLuint)) \
+    X(void, UseProgram, (GLuint)) \
+    X(GLint, GetUniformLocation, (GLuint, const GLchar *)) \
+    X(void, Uniform1i, (GLint, GLint)) \
+    X(void, Uniform2f, (GLint, GLfloat, GLfloat)) \
+    X(void, GenVertexArrays, (GLsizei, GLuint *)) \
+    X(void, DeleteVertexArrays, (GLsizei, const GLuint *)) \
+    X(void, BindVertexArray, (GLuint)) \
+    X(void, GenBuffers, (GLsizei, GLuint *)) \
+    X(void, DeleteBuffers, (GLsizei, const GLuint *)) \
+    X(void, BindBuffer, (GLenum, GLuint)) \
+    X(void, BufferData, (GLenum, GLsizeiptr, const void *, GLenum)) \
+    X(void, BufferSubData, (GLenum, GLintptr, GLsizeiptr, const void *)) \
+    X(void, EnableVertexAttribArray, (GLuint)) \
+    X(void, VertexAttribPointer, (GLuint, GLint, GLenum, GLboolean, GLsizei, const void *)) \
+    X(void, VertexAttribDivisor, (GLuint, GLuint)) \
+    X(void, DrawArraysInstanced, (GLenum, GLint, GLsizei, GLsizei))
+
+struct NyanGLFunctions
+{
+#define X(ret, name, args) ret (APIENTRY *name) args = nullptr;
+    NYAN_GL_FUNCTIONS(X)
+#undef X
+};
+
+struct NyanGLRenderer
+{
+    NyanGLFunctions gl;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint quadBuffer = 0;
+    GLuint instanceBuffer = 0;
+    size_t instanceCapacity = 0;  // bytes
+    GLuint texture = 0;
+    int texWidth = 0;
+    int texHeight = 0;
+    GLint viewSizeLoc = -1;
+    GLint texSizeLoc = -1;
+    int width = 0;
+    int height = 0;
+};
+
+// The draw commands are uploaded as they are, the attributes point into
+// NyanDrawCmd: src as ints converted to floats, center and angle as one vec3
+// and the color as normalized bytes.
+static const char *const VertexShader = R"(#version 330 core
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 src;
+layout(location = 2) in vec4 dst;
+layout(location = 3) in vec3 centerAngle;
+layout(location = 4) in vec4 color;
+uniform vec2 viewSize;
+uniform vec2 texSize;
+out vec2 uv;
+out vec4 tint;
+
+void main()
+{
+    float a = radians(centerAngle.z);
+    float c = cos(a), s = sin(a);
+    vec2 local = corner * dst.zw - centerAngle.xy;
+    vec2 p = dst.xy + centerAngle.xy + vec2(local.x * c - local.y * s, local.x * s + local.y * c);
+    gl_Position = vec4(p.x / viewSize.x * 2.0 - 1.0, 1.0 - p.y / viewSize.y * 2.0, 0.0, 1.0);
+    uv = (src.xy + corner * src.zw) / texSize;
+    tint = color;
+}
+)";
+
+static const char *const FragmentShader = R"(#version 330 core
+in vec2 uv;
+in vec4 tint;
+uniform sampler2D sheet;
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = texture(sheet, uv) * tint;
+}
+)";
+
+static bool load_functions(NyanGLFunctions &gl)
+{
+#define X(ret, name, args) \
+    if (!(gl.name = reinterpret_cast<ret (APIENTRY *) args>(SDL_GL_GetProcAddress("gl" #name)))) \
+    { \
+        SDL_SetError("OpenGL function gl" #name " not found, OpenGL 3.3 is needed"); \
+        return false; \
+    }
+    NYAN_GL_FUNCTIONS(X)
+#undef X
+    return true;
+}
+
+static GLuint compile_shader(const NyanGLFunctions &gl, GLenum type, const char *source)
+{
+    GLuint shader = gl.CreateShader(type);
+    GLint ok = GL_FALSE;
+    gl.ShaderSource(shader, 1, &source, nullptr);
+    gl.CompileShader(shader);
+    gl.GetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+
+    if (!ok)
+    {
+        char info[512] = {};
+        gl.GetShaderInfoLog(shader, sizeof(info), nullptr, info);
+        SDL_SetError("shader compilation failed: %s", info);
+        gl.DeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+static GLuint link_program(const NyanGLFunctions &gl)
+{
+    GLuint vs = compile_shader(gl, GL_VERTEX_SHADER, VertexShader);
+    GLuint fs = vs ? compile_shader(gl, GL_FRAGMENT_SHADER, FragmentShader) : 0;
+
+    if (!fs)
+    {
+        gl.DeleteShader(vs);
+        return 0;
+    }
+
+    GLuint program = gl.CreateProgram();
+    GLint ok = GL_FALSE;
+    gl.AttachShader(program, vs);
+    gl.AttachShader(program, fs);
+    gl.LinkProgram(program);
+    gl.DeleteShader(vs);
+    gl.DeleteShader(fs);
+    gl.GetProgramiv(program, GL_LINK_STATUS, &ok);
+
+    if (!ok)
+    {
+        char info[512] = {};
+        gl.GetProgramInfoLog(program, sizeof(info), nullptr, info);
+        SDL_SetError("shader linking failed: %s", info);
+        gl.DeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static void setup_vertex_array(NyanGLRenderer *r)
+{
+    const auto &gl = r->gl;
+    // Triangle strip, the shader maps the corners to the rotated quad.
+    static const float corners[] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+
+    gl.GenVertexArrays(1, &r->vao);
+    gl.BindVertexArray(r->vao);
+
+    gl.GenBuffers(1, &r->quadBuffer);
+    gl.BindBuffer(GL_ARRAY_BUFFER, r->quadBuffer);
+    gl.BufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    gl.EnableVertexAttribArray(0);
+    gl.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    gl.GenBuffers(1, &r->instanceBuffer);
+    gl.BindBuffer(GL_ARRAY_BUFFER, r->instanceBuffer);
+
+    auto attrib = [&gl] (GLuint index, GLint size, GLenum type, GLboolean normalized, size_t offset)
+    {
+        gl.EnableVertexAttribArray(index);
+        gl.VertexAttribPointer(index, size, type, normalized, sizeof(NyanDrawCmd), reinterpret_cast<void *>(offset));
+        gl.VertexAttribDivisor(index, 1);
+    };
+
+    static_assert(offsetof(NyanDrawCmd, angle) == offsetof(NyanDrawCmd, center) + sizeof(SDL_FPoint),
+                  "center and angle are read as one vec3");
+
+    attrib(1, 4, GL_INT, GL_FALSE, offsetof(NyanDrawCmd, src));
+    attrib(2, 4, GL_FLOAT, GL_FALSE, offsetof(NyanDrawCmd, dst));
+    attrib(3, 3, GL_FLOAT, GL_FALSE, offsetof(NyanDrawCmd, center));
+    attrib(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(NyanDrawCmd, color));
+
+    gl.BindVertexArray(0);
+}
+
+NyanGLRenderer *nyan_gl_renderer_create(const NyanImage &sheet)
+{
+    auto r = new NyanGLRenderer;
+    auto &gl = r->gl;
+
+    if (!load_functions(gl) || !(r->program = link_program(gl)))
+    {
+        log_error("nyan_gl_renderer_create: %s", SDL_GetError());
+        delete r;
+        return nullptr;
+    }
+
+    setup_vertex_array(r);
+
+    // ARGB8888 in host order is BGRA as packed by GL_UNSIGNED_INT_8_8_8_8_REV.
+    r->texWidth = sheet.width;
+    r->texHeight = sheet.height;
+    gl.GenTextures(1, &r->texture);
+    gl.BindTexture(GL_TEXTURE_2D, r->texture);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sheet.width, sheet.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                  sheet.pixels.data());
+
+    r->viewSizeLoc = gl.GetUniformLocation(r->program, "viewSize");
+    r->texSizeLoc = gl.GetUniformLocation(r->program, "texSize");
+    gl.UseProgram(r->program);
+    gl.Uniform1i(gl.GetUniformLocation(r->program, "sheet"), 0);
+    gl.UseProgram(0);
+
+    if (const GLenum error = gl.GetError())
+    {
+        log_error("nyan_gl_renderer_create: OpenGL error 0x%x", error);
+        nyan_gl_renderer_destroy(r);
+        return nullptr;
+    }
+
+    return r;
+}
+
+void nyan_gl_renderer_destroy(NyanGLRenderer *r)
+{
+    if (!r)
+        return;
+
+    const auto &gl = r->gl;
+    gl.DeleteTextures(1, &r->texture);
+    gl.DeleteBuffers(1, &r->instanceBuffer);
+    gl.DeleteBuffers(1, &r->quadBuffer);
+    gl.DeleteVertexArrays(1, &r->vao);
+    gl.DeleteProgram(r->program);
+    delete r;
+}
+
+void nyan_gl_begin_frame(NyanGLRenderer *r, int width, int height, SDL_Color color)
+{
+    const auto &gl = r->gl;
+    r->width = width;
+    r->height = height;
+    gl.Viewport(0, 0, width, height);
+    gl.ClearColor(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f);
+    gl.Clear(GL_COLOR_BUFFER_BIT);
+}
+
+int nyan_gl_render(NyanGLRenderer *r, const NyanDrawCmd *cmds, size_t count)
+{
+    if (!count)
+        return 0;
+
+    const auto &gl = r->gl;
+    const size_t bytes = count * sizeof(NyanDrawCmd);
+
+    gl.BindVertexArray(r->vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER, r->instanceBuffer);
+
+    // Orphans last frame's buffer instead of waiting for the GPU to be done
+    // with it. Grows with headroom, the number of visible cats changes from
+    // frame to frame.
+    if (bytes > r->instanceCapacity)
+        r->instanceCapacity = bytes + bytes / 4;
+
+    gl.BufferData(GL_ARRAY_BUFFER, r->instanceCapacity, nullptr, GL_STREAM_DRAW);
+    gl.BufferSubData(GL_ARRAY_BUFFER, 0, bytes, cmds);
+
+    gl.UseProgram(r->program);
+    gl.Uniform2f(r->viewSizeLoc, static_cast<float>(r->width), static_cast<float>(r->height));
+    gl.Uniform2f(r->texSizeLoc, static_cast<float>(r->texWidth), static_cast<float>(r->texHeight));
+    gl.ActiveTexture(GL_TEXTURE0);
+    gl.BindTexture(GL_TEXTURE_2D, r->texture);
+
+    // Straight alpha, the same as SDL_BLENDMODE_BLEND.
+    gl.Enable(GL_BLEND);
+    gl.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    gl.DrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count));
+    gl.BindVertexArray(0);
+
+    if (const GLenum error = gl.GetError())
+    {
+        SDL_SetError("nyan_gl_render: OpenGL error 0x%x", error);
+        return -1;
+    }
+
+    return 0;
+}
+
+void nyan_gl_finish(NyanGLRenderer *r)
+{
+    r->gl.Finish();
+}
+
+NyanImage nyan_gl_read_pixels(NyanGLRenderer *r)
+{
+    const auto &gl = r->gl;
+    NyanImage result;
+    result.width = r->width;
+    result.height = r->height;
+    result.pixels.resize(static_cast<size_t>(result.width) * result.height);
+
+    gl.PixelStorei(GL_PACK_ALIGNMENT, 4);
+    gl.ReadPixels(0, 0, result.width, result.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, result.pixels.data());
+
+    // GL rows go bottom up.
+    for (int y=0; y<result.height / 2; ++y)
+        std::swap_ranges(result.pixels.begin() + y * result.width, result.pixels.begin() + (y + 1) * result.width,
+                         result.pixels.begin() + (result.height - 1 - y) * result.width);
+
+    return result;
+}
@@ -0,0 +1,42 @@
+#ifndef SRC_NYAN_GL_H
+#define SRC_NYAN_GL_H
+
+#include <SDL_pixels.h>
+#include "nyan_soft.h"
+#include "sdl_nyan.h"
+
+// OpenGL 3.3 core backend for draw commands, bypassing SDL_Renderer. The
+// sheet is one texture, a unit quad is the only vertex data and every
+// NyanDrawCmd becomes one instance: destination, source rect, rotation and
+// color go into a per-instance vertex buffer, the vertex shader places and
+// rotates the corners. All commands are drawn with one glDrawArraysInstanced()
+// call, the CPU only copies 48 bytes per cat.
+//
+// GL functions are loaded through SDL_GL_GetProcAddress(), nothing links
+// against libGL. Runs on Mesa's llvmpipe without a GPU, e.g. with
+// SDL_VIDEODRIVER=offscreen and LIBGL_ALWAYS_SOFTWARE=1.
+
+struct NyanGLRenderer;
+
+// Needs a current OpenGL 3.3 core context, see SDL_GL_CreateContext(), and
+// must be used and destroyed with that context current. Uploads 'sheet'.
+// Returns nullptr on error, see SDL_GetError().
+NyanGLRenderer *nyan_gl_renderer_create(const NyanImage &sheet);
+void nyan_gl_renderer_destroy(NyanGLRenderer *r);
+
+// Sets the viewport to 'width' x 'height' pixels of the bound framebuffer,
+// the coordinate space of the draw commands, and clears it to 'color'.
+void nyan_gl_begin_frame(NyanGLRenderer *r, int width, int height, SDL_Color color);
+
+// Draws 'cmds' in order, alpha blended like SDL_BLENDMODE_BLEND. Returns 0 on
+// success or -1 on error, see SDL_GetError().
+int nyan_gl_render(NyanGLRenderer *r, const NyanDrawCmd *cmds, size_t count);
+
+// Blocks until all submitted commands are done, for timing.
+void nyan_gl_finish(NyanGLRenderer *r);
+
+// Reads back the last frame as ARGB8888, top row first, e.g. to compare it
+// with the other backends.
+NyanImage nyan_gl_read_pixels(NyanGLRenderer *r);
+
+#endif // SRC_NYAN_GL_H
@@ -0,0 +1,123 @@
+#include "nyan_governor.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Levels before the cat count is reduced, see the table in the header.
+static const int FixedLevels = 4;
+static const float CatFractionStep = 0.25f;
+
+static int cat_fraction_levels(const NyanGovernorConfig &config)
+{
+    const float minFraction = std::clamp(config.minCatFraction, 0.0f, 1.0f);
+    return static_cast<int>(std::ceil((1.0f - minFraction) / CatFractionStep - 0.001f));
+}
+
+int nyan_governor_level_count(const NyanGovernorConfig &config)
+{
+    return FixedLevels + cat_fraction_levels(config);
+}
+
+static NyanQuality level_quality(const NyanGovernorConfig &config, int level)
+{
+    NyanQuality q;
+
+    if (level >= 1)
+        q.farUpdateInterval = std::max(config.farUpdateInterval, 1);
+    if (level >= 2)
+        q.trails = false;
+    if (level >= 3)
+        q.rotation = false;
+    if (level >= FixedLevels)
+        q.catFraction = std::max(1.0f - CatFractionStep * (level - FixedLevels + 1), config.minCatFraction);
+
+    return q;
+}
+
+NyanQuality nyan_governor_quality(const NyanGovernor &gov)
+{
+    return level_quality(gov.config, gov.stats.level);
+}
+
+const char *nyan_governor_level_name(const NyanGovernor &gov, int level)
+{
+    switch (level)
+    {
+        case 0: return "full quality";
+        case 1: return "slower far updates";
+        case 2: return "no trails";
+        case 3: return "unrotated";
+    }
+
+    const float fraction = level_quality(gov.config, level).catFraction;
+    return fraction > 0.5f ? "75% cats" : fraction > 0.25f ? "50% cats" : "25% cats";
+}
+
+bool nyan_governor_frame(NyanGovernor &gov, float frameMs)
+{
+    auto &stats = gov.stats;
+    const auto &config = gov.config;
+
+    stats.averageMs = stats.frames ? stats.averageMs + config.smoothing * (frameMs - stats.averageMs) : frameMs;
+    ++stats.frames;
+
+    if (frameMs > config.budgetMs)
+        ++stats.framesOverBudget;
+
+    ++gov.framesSinceChange;
+
+    // Degrade quickly, restore slowly: a level that was just given up is
+    // likely needed again soon.
+    const bool degrade = stats.averageMs > config.budgetMs && gov.framesSinceChange >= config.settleFrames
+        && stats.level < nyan_governor_level_count(config) - 1;
+    const bool restore = stats.averageMs < config.budgetMs * config.restoreRatio
+        && gov.framesSinceChange >= config.settleFrames * 4 && stats.level > 0;
+
+    if (degrade)
+    {
+        ++stats.level;
+        ++stats.downgrades;
+    }
+    else if (restore)
+    {
+        --stats.level;
+        ++stats.upgrades;
+    }
+    else
+        return false;
+
+    stats.maxLevel = std::max(stats.maxLevel, stats.level);
+    gov.framesSinceChange = 0;
+    return true;
+}
+
+bool nyan_governor_set_level(NyanGovernor &gov, int level)
+{
+    auto &stats = gov.stats;
+    level = std::clamp(level, 0, nyan_governor_level_count(gov.config) - 1);
+
+    if (level == stats.level)
+        return false;
+
+    if (level > stats.level)
+        ++stats.downgrades;
+    else
+        ++stats.upgrades;
+
+    stats.level = level;
+    stats.maxLevel = std::max(stats.maxLevel, stats.level);
+    gov.framesSinceChange = 0;
+    return true;
+}
+
+void nyan_governor_thin(const NyanQuality &quality, std::vector<u32> &visible)
+{
+    if (quality.catFraction >= 1.0f)
+        return;
+
+    const u32 threshold = static_cast<u32>(quality.catFraction * 65536.0f);
+
+    // Multiplicative hash of the index, spreads the kept cats evenly.
+    auto dropped = [threshold] (u32 i) { return ((i * 2654435761u) >> 16) >= threshold; };
+    visible.erase(std::remove_if(visible.begin(), visible.end(), dropped), visible.end());
+}
@@ -0,0 +1,76 @@
+#ifndef SRC_NYAN_GOVERNOR_H
+#define SRC_NYAN_GOVERNOR_H
+
+#include <vector>
+#include "nyan_types.h"
+
+// Keeps the frame time within a budget by trading quality for speed. Feed it
+// the measured time of every frame; when the average stays over budget it
+// steps down one quality level, when it stays well below it steps back up.
+// Each level keeps the cuts of the previous ones, cheapest to notice first:
+//
+//   0  full quality
+//   1  cats outside of the view are simulated at a lower rate
+//   2  no trails
+//   3  cats drawn upright, unrotated blits are much cheaper
+//   4+ fewer visible cats, down to 'minCatFraction'
+
+// What the scene should render at the current level.
+struct NyanQuality
+{
+    int farUpdateInterval = 1;  // simulate cats outside of the view every n-th frame
+    bool trails = true;
+    bool rotation = true;
+    float catFraction = 1.0f;   // share of the visible cats that is drawn
+};
+
+struct NyanGovernorConfig
+{
+    float budgetMs = 1000.0f / 60.0f;
+    float restoreRatio = 0.7f;   // step up again below budgetMs * restoreRatio
+    float smoothing = 0.1f;      // weight of a new frame in the moving average
+    int settleFrames = 30;       // frames to wait after a change before the next one
+    int farUpdateInterval = 4;
+    float minCatFraction = 0.25f;
+};
+
+// Metrics of the decisions taken so far.
+struct NyanGovernorStats
+{
+    int level = 0;
+    int maxLevel = 0;
+    float averageMs = 0.0f;    // moving average of the frame time
+    u64 frames = 0;
+    u64 framesOverBudget = 0;
+    u64 downgrades = 0;
+    u64 upgrades = 0;
+};
+
+struct NyanGovernor
+{
+    NyanGovernorConfig config;
+    NyanGovernorStats stats;
+    int framesSinceChange = 0;
+};
+
+// Number of levels including level 0.
+int nyan_governor_level_count(const NyanGovernorConfig &config);
+
+NyanQuality nyan_governor_quality(const NyanGovernor &gov);
+
+// Short description of a level, e.g. for logging.
+const char *nyan_governor_level_name(const NyanGovernor &gov, int level);
+
+// Records the time of the last frame. Returns true if the level changed.
+bool nyan_governor_frame(NyanGovernor &gov, float frameMs);
+
+// Switches to 'level' without looking at frame times, e.g. to follow the
+// decisions stored in a recording. Returns true if the level changed.
+bool nyan_governor_set_level(NyanGovernor &gov, int level);
+
+// Drops cats from 'visible' until about quality.catFraction of them are
+// left. The choice depends only on the cat index, so cats do not flicker
+// from frame to frame.
+void nyan_governor_thin(const NyanQuality &quality, std::vector<u32> &visible);
+
+#endif // SRC_NYAN_GOVERNOR_H
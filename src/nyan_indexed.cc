@@ -0,0 +1,101 @@
+#include "nyan_soft.h"
+
+#include <SDL_cpuinfo.h>
+#include <algorithm>
+#include <unordered_map>
+#include "nyan_simd.h"
+
+bool nyan_make_indexed_image(const NyanImage &image, NyanIndexedImage &out)
+{
+    std::vector<u8> indices(image.pixels.size());
+    std::vector<u32> palette = { 0 };
+    std::unordered_map<u32, u8> lookup = { { 0, 0 } };
+
+    for (size_t i=0; i<image.pixels.size(); ++i)
+    {
+        // Color channels of transparent pixels do not matter when blending.
+        const u32 color = image.pixels[i] >> 24 ? image.pixels[i] : 0;
+        auto it = lookup.find(color);
+
+        if (it == lookup.end())
+        {
+            if (palette.size() == 256)
+                return false;
+
+            it = lookup.emplace(color, static_cast<u8>(palette.size())).first;
+            palette.push_back(color);
+        }
+
+        indices[i] = it->second;
+    }
+
+    out.indices = std::move(indices);
+    out.palette = std::move(palette);
+    out.width = image.width;
+    out.height = image.height;
+    return true;
+}
+
+static void expand_indices_scalar(const u8 *indices, size_t count, const u32 *palette, size_t, u32 *dst)
+{
+    for (size_t i=0; i<count; ++i)
+        dst[i] = palette[indices[i]];
+}
+
+#ifdef NYAN_X86_SIMD
+// Palettes of up to 16 colors fit into four byte planes of one register each,
+// pshufb then looks up 16 pixels per plane at once.
+NYAN_TARGET("ssse3")
+static void expand_indices_ssse3(const u8 *indices, size_t count, const u32 *palette, size_t paletteSize, u32 *dst)
+{
+    alignas(16) u32 table[16] = {};
+    std::copy(palette, palette + paletteSize, table);
+
+    // Transpose the 16 palette entries into byte planes: plane[k] holds byte k
+    // of every entry.
+    const __m128i gather = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m128i t0 = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(table + 0)), gather);
+    const __m128i t1 = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(table + 4)), gather);
+    const __m128i t2 = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(table + 8)), gather);
+    const __m128i t3 = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(table + 12)), gather);
+    const __m128i lo01 = _mm_unpacklo_epi32(t0, t1), hi01 = _mm_unpackhi_epi32(t0, t1);
+    const __m128i lo23 = _mm_unpacklo_epi32(t2, t3), hi23 = _mm_unpackhi_epi32(t2, t3);
+    const __m128i plane0 = _mm_unpacklo_epi64(lo01, lo23);
+    const __m128i plane1 = _mm_unpackhi_epi64(lo01, lo23);
+    const __m128i plane2 = _mm_unpacklo_epi64(hi01, hi23);
+    const __m128i plane3 = _mm_unpackhi_epi64(hi01, hi23);
+
+    size_t i = 0;
+
+    for (; i+16<=count; i+=16)
+    {
+        const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + i));
+        const __m128i b0 = _mm_shuffle_epi8(plane0, idx);
+        const __m128i b1 = _mm_shuffle_epi8(plane1, idx);
+        const __m128i b2 = _mm_shuffle_epi8(plane2, idx);
+        const __m128i b3 = _mm_shuffle_epi8(plane3, idx);
+        const __m128i lo = _mm_unpacklo_epi8(b0, b1), hi = _mm_unpackhi_epi8(b0, b1);
+        const __m128i lo2 = _mm_unpacklo_epi8(b2, b3), hi2 = _mm_unpackhi_epi8(b2, b3);
+        auto out = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(lo, lo2));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, lo2));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, hi2));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, hi2));
+    }
+
+    expand_indices_scalar(indices + i, count - i, palette, paletteSize, dst + i);
+}
+#endif
+
+void nyan_expand_indices(const u8 *indices, size_t count, const u32 *palette, size_t paletteSize, u32 *dst)
+{
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSSE3 = SDL_HasSSSE3();
+
+    if (hasSSSE3 && paletteSize <= 16)
+        return expand_indices_ssse3(indices, count, palette, paletteSize, dst);
+#endif
+
+    // AVX2 gathers were tried for larger palettes, they are slower than this.
+    expand_indices_scalar(indices, count, palette, paletteSize, dst);
+}
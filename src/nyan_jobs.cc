@@ -0,0 +1,299 @@
+#include "nyan_jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "nyan_types.h"
+
+struct NyanRangeJob
+{
+    NyanRangeFn fn;
+    void *ctx;
+    size_t grain;
+    std::atomic<size_t> remaining; // elements not yet processed
+};
+
+struct NyanTask
+{
+    NyanRangeJob *job;
+    size_t begin;
+    size_t end;
+};
+
+// Chase-Lev deque with a fixed capacity. The owner pushes and pops at the
+// bottom, thieves steal from the top. Slots are stored as relaxed atomics so
+// a thief racing with the owner reusing a slot is well defined; the CAS on
+// 'top' decides which read was valid.
+class NyanWorkDeque
+{
+    public:
+        static const s64 Capacity = 1024;
+
+        bool push(const NyanTask &task)
+        {
+            const s64 b = bottom.load(std::memory_order_relaxed);
+            const s64 t = top.load(std::memory_order_acquire);
+
+            if (b - t >= Capacity)
+                return false;
+
+            auto &slot = slots[b & (Capacity - 1)];
+            slot.job.store(task.job, std::memory_order_relaxed);
+            slot.begin.store(task.begin, std::memory_order_relaxed);
+            slot.end.store(task.end, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(NyanTask &task)
+        {
+            const s64 b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 t = top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            read_slot(b, task);
+
+            if (t == b)
+            {
+                // Last element, race against thieves for it.
+                const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                             std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+
+            return true;
+        }
+
+        bool steal(NyanTask &task)
+        {
+            s64 t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const s64 b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b)
+                return false;
+
+            read_slot(t, task);
+
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<NyanRangeJob *> job;
+            std::atomic<size_t> begin;
+            std::atomic<size_t> end;
+        };
+
+        void read_slot(s64 i, NyanTask &task) const
+        {
+            const auto &slot = slots[i & (Capacity - 1)];
+            task.job = slot.job.load(std::memory_order_relaxed);
+            task.begin = slot.begin.load(std::memory_order_relaxed);
+            task.end = slot.end.load(std::memory_order_relaxed);
+        }
+
+        // Separate cache lines for the owner and the thieves.
+        alignas(64) std::atomic<s64> top{0};
+        alignas(64) std::atomic<s64> bottom{0};
+        alignas(64) Slot slots[Capacity] = {};
+};
+
+struct NyanJobSystem
+{
+    // Index 0 belongs to the creating thread, 1..n to the workers.
+    std::vector<std::unique_ptr<NyanWorkDeque>> deques;
+    std::vector<std::thread> workers;
+
+    std::atomic<int> activeJobs{0};
+    std::mutex mutex;
+    std::condition_variable wakeCv;
+    bool quit = false;
+};
+
+struct NyanWorkerContext
+{
+    const NyanJobSystem *jobs;
+    unsigned index;
+    u32 rng;
+};
+
+static thread_local NyanWorkerContext tl_worker = { nullptr, 0, 0x9e3779b9u };
+
+static unsigned current_worker_index(const NyanJobSystem *jobs)
+{
+    return tl_worker.jobs == jobs ? tl_worker.index : 0;
+}
+
+static void run_task(NyanJobSystem *jobs, unsigned index, NyanTask task)
+{
+    auto job = task.job;
+    auto &deque = *jobs->deques[index];
+
+    // Lazy binary splitting: hand out the upper half, keep the lower half.
+    while (task.end - task.begin > job->grain)
+    {
+        const size_t mid = task.begin + (task.end - task.begin) / 2;
+
+        if (!deque.push({ job, mid, task.end }))
+            break;
+
+        task.end = mid;
+    }
+
+    job->fn(job->ctx, task.begin, task.end);
+    job->remaining.fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+}
+
+static bool find_task(NyanJobSystem *jobs, unsigned index, NyanTask &task)
+{
+    if (jobs->deques[index]->pop(task))
+        return true;
+
+    const unsigned n = jobs->deques.size();
+
+    // xorshift32 to pick the first victim
+    u32 &x = tl_worker.rng;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+
+    for (unsigned i=0, victim=x % n; i<n; ++i, victim = (victim + 1) % n)
+    {
+        if (victim != index && jobs->deques[victim]->steal(task))
+            return true;
+    }
+
+    return false;
+}
+
+static void worker_main(NyanJobSystem *jobs, unsigned index)
+{
+    tl_worker = { jobs, index, 0x9e3779b9u * (index + 1) };
+
+    for (;;)
+    {
+        NyanTask task;
+
+        if (find_task(jobs, index, task))
+        {
+            run_task(jobs, index, task);
+            continue;
+        }
+
+        if (jobs->activeJobs.load(std::memory_order_acquire) > 0)
+        {
+            // Work is in flight but nothing to steal right now.
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->wakeCv.wait(lock, [jobs] { return jobs->quit || jobs->activeJobs.load() > 0; });
+
+        if (jobs->quit)
+            return;
+    }
+}
+
+NyanJobSystem *nyan_jobs_create(unsigned threadCount)
+{
+    if (!threadCount)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    auto jobs = new NyanJobSystem;
+
+    for (unsigned i=0; i<threadCount; ++i)
+        jobs->deques.emplace_back(std::make_unique<NyanWorkDeque>());
+
+    tl_worker = { jobs, 0, 0x9e3779b9u };
+
+    for (unsigned i=1; i<threadCount; ++i)
+        jobs->workers.emplace_back(worker_main, jobs, i);
+
+    return jobs;
+}
+
+void nyan_jobs_destroy(NyanJobSystem *jobs)
+{
+    if (!jobs)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->quit = true;
+    }
+
+    jobs->wakeCv.notify_all();
+
+    for (auto &t: jobs->workers)
+        t.join();
+
+    if (tl_worker.jobs == jobs)
+        tl_worker.jobs = nullptr;
+
+    delete jobs;
+}
+
+unsigned nyan_jobs_thread_count(const NyanJobSystem *jobs)
+{
+    return jobs ? jobs->deques.size() : 1;
+}
+
+void nyan_parallel_for(NyanJobSystem *jobs, size_t count, size_t grain, NyanRangeFn fn, void *ctx)
+{
+    grain = std::max<size_t>(grain, 1);
+
+    if (!count)
+        return;
+
+    if (!jobs || jobs->workers.empty() || count <= grain)
+    {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    NyanRangeJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.grain = grain;
+    job.remaining = count;
+
+    const unsigned index = current_worker_index(jobs);
+
+    if (jobs->activeJobs.fetch_add(1, std::memory_order_acq_rel) == 0)
+    {
+        // Workers may be sleeping. Taking the lock avoids a lost wakeup
+        // between their predicate check and the wait.
+        { std::lock_guard<std::mutex> lock(jobs->mutex); }
+        jobs->wakeCv.notify_all();
+    }
+
+    run_task(jobs, index, { &job, 0, count });
+
+    // Help out until every part of this job has been processed. This may
+    // also run tasks of other jobs, e.g. when called from inside a task.
+    while (job.remaining.load(std::memory_order_acquire) != 0)
+    {
+        NyanTask task;
+
+        if (find_task(jobs, index, task))
+            run_task(jobs, index, task);
+        else
+            std::this_thread::yield();
+    }
+
+    jobs->activeJobs.fetch_sub(1, std::memory_order_acq_rel);
+}
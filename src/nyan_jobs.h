@@ -0,0 +1,45 @@
+#ifndef SRC_NYAN_JOBS_H
+#define SRC_NYAN_JOBS_H
+
+#include <cstddef>
+#include <type_traits>
+
+// Small work-stealing job system. Every thread owns a bounded deque of range
+// tasks. A task larger than the grain size splits itself in half, pushes the
+// upper half onto its own deque and continues with the lower half. Idle
+// threads steal from the opposite end of other threads' deques.
+//
+// Functions taking a 'NyanJobSystem *jobs' argument accept nullptr and then
+// run everything on the calling thread.
+
+struct NyanJobSystem;
+
+// threadCount == 0 uses one thread per CPU. The thread calling
+// nyan_jobs_create() counts as one of the threads and takes part in the
+// work while waiting in nyan_parallel_for().
+NyanJobSystem *nyan_jobs_create(unsigned threadCount = 0);
+void nyan_jobs_destroy(NyanJobSystem *jobs);
+unsigned nyan_jobs_thread_count(const NyanJobSystem *jobs);
+
+typedef void (*NyanRangeFn)(void *ctx, size_t begin, size_t end);
+
+// Calls fn(ctx, begin, end) for disjoint subranges covering [0, count), each
+// at most 'grain' elements long, and returns when all of them are done. May
+// be called from the thread that created the job system and from inside
+// running tasks (nested parallelism).
+void nyan_parallel_for(NyanJobSystem *jobs, size_t count, size_t grain, NyanRangeFn fn, void *ctx);
+
+// Convenience overload for lambdas: f(size_t begin, size_t end). No
+// allocations, the callable is passed by pointer.
+template<typename F>
+void nyan_parallel_for(NyanJobSystem *jobs, size_t count, size_t grain, F &&f)
+{
+    using Fn = std::remove_reference_t<F>;
+
+    nyan_parallel_for(jobs, count, grain, [] (void *ctx, size_t begin, size_t end)
+    {
+        (*static_cast<Fn *>(ctx))(begin, end);
+    }, const_cast<void *>(static_cast<const void *>(&f)));
+}
+
+#endif // SRC_NYAN_JOBS_H
@@ -0,0 +1,229 @@
+#include "nyan_mip.h"
+
+#include <SDL_cpuinfo.h>
+#include <algorithm>
+#include <cmath>
+#include "nyan_simd.h"
+
+static const int MipPadding = 1;
+
+// Alpha weighted average of four ARGB pixels. Both kernels compute it in
+// single precision floats, so they produce the same result.
+static u32 box_average(u32 p0, u32 p1, u32 p2, u32 p3)
+{
+    const u32 p[4] = { p0, p1, p2, p3 };
+    u32 sumA = 0, sum[3] = {};
+
+    for (u32 v: p)
+    {
+        const u32 a = v >> 24;
+        sumA += a;
+        for (int c=0; c<3; ++c)
+            sum[c] += ((v >> (c * 8)) & 0xff) * a;
+    }
+
+    const float invA = 1.0f / std::max(sumA, 1u);
+    u32 result = static_cast<u32>(std::nearbyint(sumA * 0.25f)) << 24;
+
+    for (int c=0; c<3; ++c)
+        result |= static_cast<u32>(std::nearbyint(sum[c] * invA)) << (c * 8);
+
+    return result;
+}
+
+// Downscales one row pair of a frame. 'r1' may equal 'r0' for the last row
+// of an odd height, the last column of an odd width is repeated.
+static void box_row_scalar(const u32 *r0, const u32 *r1, int srcWidth, int x, int dstWidth, u32 *dst)
+{
+    for (; x<dstWidth; ++x)
+    {
+        const int x0 = x * 2;
+        const int x1 = std::min(x0 + 1, srcWidth - 1);
+        dst[x] = box_average(r0[x0], r0[x1], r1[x0], r1[x1]);
+    }
+}
+
+#ifdef NYAN_X86_SIMD
+// One destination pixel per iteration: the 2x2 source block is widened to
+// 32-bit lanes, premultiplied, summed and divided by the alpha sum.
+// Returns the number of pixels done, the odd last column is left to the
+// scalar code.
+NYAN_TARGET("sse2")
+static int box_row_sse2(const u32 *r0, const u32 *r1, int srcWidth, int dstWidth, u32 *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set_epi32(-1, 0, 0, 0);
+    int x = 0;
+
+    for (; x<dstWidth && x * 2 + 1 < srcWidth; ++x)
+    {
+        const __m128i top = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(r0 + x * 2));
+        const __m128i bottom = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(r1 + x * 2));
+        const __m128i lo = _mm_unpacklo_epi8(top, zero);     // 2 pixels, 16-bit channels
+        const __m128i hi = _mm_unpacklo_epi8(bottom, zero);
+
+        // Alpha of each pixel in all four of its channels.
+        const __m128i loA = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128i hiA = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+        // c * a fits into 16 bits, the sum of four does not.
+        const __m128i loP = _mm_mullo_epi16(lo, loA);
+        const __m128i hiP = _mm_mullo_epi16(hi, hiA);
+        const __m128i sumP = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(loP, zero), _mm_unpackhi_epi16(loP, zero)),
+                                           _mm_add_epi32(_mm_unpacklo_epi16(hiP, zero), _mm_unpackhi_epi16(hiP, zero)));
+        const __m128i sumA = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(loA, zero), _mm_unpackhi_epi16(loA, zero)),
+                                           _mm_add_epi32(_mm_unpacklo_epi16(hiA, zero), _mm_unpackhi_epi16(hiA, zero)));
+
+        const __m128 sumAf = _mm_cvtepi32_ps(sumA);
+        const __m128 invA = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(sumAf, _mm_set1_ps(1.0f)));
+        const __m128i color = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sumP), invA));
+        const __m128i alpha = _mm_cvtps_epi32(_mm_mul_ps(sumAf, _mm_set1_ps(0.25f)));
+
+        const __m128i result = _mm_or_si128(_mm_andnot_si128(alphaMask, color), _mm_and_si128(alphaMask, alpha));
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(result, zero), zero);
+        dst[x] = static_cast<u32>(_mm_cvtsi128_si32(packed));
+    }
+
+    return x;
+}
+#endif
+
+static void box_row(const u32 *r0, const u32 *r1, int srcWidth, int dstWidth, u32 *dst)
+{
+    int x = 0;
+
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSE2 = SDL_HasSSE2();
+
+    if (hasSSE2)
+        x = box_row_sse2(r0, r1, srcWidth, dstWidth, dst);
+#endif
+
+    box_row_scalar(r0, r1, srcWidth, x, dstWidth, dst);
+}
+
+static SDL_Rect level_frame(const NyanMipLevel &level, const NyanSpriteSet &set, int index)
+{
+    return { level.frame0.x + (index % set.columns) * level.stepX, level.frame0.y + (index / set.columns) * level.stepY,
+             level.frame0.w, level.frame0.h };
+}
+
+NyanMipChain nyan_build_mip_chain(const NyanImage &sheet, const NyanSpriteSet &set, int maxLevels,
+                                  NyanJobSystem *jobs)
+{
+    NyanMipChain chain;
+    chain.set = set;
+
+    if (set.frameCount <= 0 || set.columns <= 0)
+        return chain;
+
+    const int rows = nyan_sprite_set_rows(set);
+
+    // Layout first: one block of padded frames per level, level 0 on top.
+    NyanMipLevel level0;
+    level0.frame0 = { MipPadding, MipPadding, set.frameWidth, set.frameHeight };
+    level0.stepX = set.frameWidth + MipPadding * 2;
+    level0.stepY = set.frameHeight + MipPadding * 2;
+    chain.levels.push_back(level0);
+
+    int atlasWidth = set.columns * level0.stepX;
+    int atlasHeight = rows * level0.stepY;
+
+    while (maxLevels <= 0 || static_cast<int>(chain.levels.size()) < maxLevels)
+    {
+        const auto &prev = chain.levels.back().frame0;
+        const int w = (prev.w + 1) / 2;
+        const int h = (prev.h + 1) / 2;
+
+        if (w < 2 || h < 2)
+            break;
+
+        NyanMipLevel level;
+        level.frame0 = { MipPadding, atlasHeight + MipPadding, w, h };
+        level.stepX = w + MipPadding * 2;
+        level.stepY = h + MipPadding * 2;
+        chain.levels.push_back(level);
+
+        atlasWidth = std::max(atlasWidth, set.columns * level.stepX);
+        atlasHeight += rows * level.stepY;
+    }
+
+    auto &atlas = chain.atlas;
+    atlas.width = atlasWidth;
+    atlas.height = atlasHeight;
+    atlas.pixels.assign(static_cast<size_t>(atlasWidth) * atlasHeight, 0);
+
+    for (int i=0; i<set.frameCount; ++i)
+    {
+        const SDL_Rect s = nyan_sprite_set_rect(set, i);
+        const SDL_Rect d = level_frame(level0, set, i);
+
+        for (int y=0; y<s.h; ++y)
+        {
+            const u32 *row = sheet.pixels.data() + (s.y + y) * sheet.width + s.x;
+            std::copy(row, row + s.w, atlas.pixels.data() + (d.y + y) * atlasWidth + d.x);
+        }
+    }
+
+    // Each level is filtered from the one before it, frame by frame.
+    for (size_t l=1; l<chain.levels.size(); ++l)
+    {
+        const auto &src = chain.levels[l - 1];
+        const auto &dst = chain.levels[l];
+
+        nyan_parallel_for(jobs, set.frameCount, 1, [&] (size_t begin, size_t end)
+        {
+            for (size_t i=begin; i<end; ++i)
+            {
+                const auto s = level_frame(src, set, static_cast<int>(i));
+                const auto d = level_frame(dst, set, static_cast<int>(i));
+
+                for (int y=0; y<d.h; ++y)
+                {
+                    const int y0 = y * 2;
+                    const int y1 = std::min(y0 + 1, s.h - 1);
+                    const u32 *r0 = atlas.pixels.data() + (s.y + y0) * atlasWidth + s.x;
+                    const u32 *r1 = atlas.pixels.data() + (s.y + y1) * atlasWidth + s.x;
+                    box_row(r0, r1, s.w, d.w, atlas.pixels.data() + (d.y + y) * atlasWidth + d.x);
+                }
+            }
+        });
+    }
+
+    return chain;
+}
+
+int nyan_mip_select_level(const NyanMipChain &chain, const NyanDrawCmd &cmd)
+{
+    if (cmd.src.w <= 0 || cmd.src.h <= 0)
+        return 0;
+
+    // Screen pixels per level 0 texel, the larger axis decides.
+    const float scale = std::max(cmd.dst.w / cmd.src.w, cmd.dst.h / cmd.src.h);
+
+    if (scale >= 1.0f || scale <= 0.0f)
+        return 0;
+
+    // floor(log2(1 / scale))
+    const int level = std::ilogb(1.0f / scale);
+    return std::min(level, static_cast<int>(chain.levels.size()) - 1);
+}
+
+SDL_FRect nyan_mip_src_rect(const NyanMipChain &chain, const SDL_Rect &src, int level)
+{
+    const auto &set = chain.set;
+    const auto &mip = chain.levels[level];
+
+    // Frame containing the rect, and the rect relative to the frame.
+    const int col = src.x / set.frameWidth;
+    const int row = src.y / set.frameHeight;
+    const float sx = static_cast<float>(mip.frame0.w) / set.frameWidth;
+    const float sy = static_cast<float>(mip.frame0.h) / set.frameHeight;
+
+    return {
+        mip.frame0.x + col * mip.stepX + (src.x - col * set.frameWidth) * sx,
+        mip.frame0.y + row * mip.stepY + (src.y - row * set.frameHeight) * sy,
+        src.w * sx,
+        src.h * sy
+    };
+}
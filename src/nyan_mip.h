@@ -0,0 +1,54 @@
+#ifndef SRC_NYAN_MIP_H
+#define SRC_NYAN_MIP_H
+
+#include <SDL_render.h>
+#include <vector>
+#include "nyan_jobs.h"
+#include "nyan_soft.h"
+#include "nyan_sprite_set.h"
+#include "sdl_nyan.h"
+
+// Pre-downscaled copies of a sprite sheet for cats drawn smaller than their
+// sprites. Each level halves the frame size, rounding up, and is box
+// filtered from the previous one with alpha weighting, so transparent
+// pixels do not darken the edges. All levels are packed into one atlas,
+// level 0 at the top, with a pixel of transparent padding around every
+// frame against bleeding when sampled with linear filtering. Source rects
+// of draw commands made for the sheet go through nyan_mip_src_rect(), also
+// for level 0.
+
+struct NyanMipLevel
+{
+    SDL_Rect frame0;   // first frame of the level in the atlas
+    int stepX = 0;     // distance between neighboring frames
+    int stepY = 0;
+};
+
+struct NyanMipChain
+{
+    NyanSpriteSet set;  // layout of level 0
+    NyanImage atlas;
+    std::vector<NyanMipLevel> levels;
+};
+
+// Builds levels until the frames would get smaller than 2 pixels, or until
+// 'maxLevels' levels including level 0 exist if it is not 0. Frames of a
+// level are filtered in parallel if 'jobs' is given. Uses SSE2 if available.
+NyanMipChain nyan_build_mip_chain(const NyanImage &sheet, const NyanSpriteSet &set, int maxLevels = 0,
+                                  NyanJobSystem *jobs = nullptr);
+
+// Level to sample 'cmd' from: the smallest level with at least one texel
+// per screen pixel. 'cmd.src' refers to level 0.
+int nyan_mip_select_level(const NyanMipChain &chain, const NyanDrawCmd &cmd);
+
+// 'src', a rect in level 0, mapped to the same part of the frame in 'level'.
+SDL_FRect nyan_mip_src_rect(const NyanMipChain &chain, const SDL_Rect &src, int level);
+
+// Like nyan_render_geometry() with the atlas of 'chain' uploaded to
+// 'atlasTexture', see nyan_make_sheet_texture(). Each command samples the
+// mip level matching its size on screen. All commands still go out in a
+// single SDL_RenderGeometry() call. Returns 0 on success or -1 on error.
+int nyan_render_geometry_mipmapped(SDL_Renderer *renderer, SDL_Texture *atlasTexture, const NyanMipChain &chain,
+                                   NyanGeometryBatch *batch, const NyanDrawCmd *cmds, size_t count);
+
+#endif // SRC_NYAN_MIP_H
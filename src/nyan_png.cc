@@ -0,0 +1,46 @@
+#include "nyan_png.h"
+
+#include "log.h"
+#include "nyan_export.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+static std::vector<u8> to_rgba(const NyanImage &image)
+{
+    std::vector<u8> rgba(static_cast<size_t>(image.width) * image.height * 4);
+    nyan_argb_to_rgba(image.pixels.data(), static_cast<size_t>(image.width) * image.height, rgba.data());
+    return rgba;
+}
+
+static void append_to_vector(void *context, void *data, int size)
+{
+    auto out = static_cast<std::vector<u8> *>(context);
+    auto bytes = static_cast<const u8 *>(data);
+    out->insert(out->end(), bytes, bytes + size);
+}
+
+void nyan_png_encode(const NyanImage &image, std::vector<u8> &out)
+{
+    const auto rgba = to_rgba(image);
+    out.clear();
+
+    if (!stbi_write_png_to_func(append_to_vector, &out, image.width, image.height, 4, rgba.data(), image.width * 4))
+    {
+        log_error("nyan_png_encode: encoding a %dx%d image failed", image.width, image.height);
+        out.clear();
+    }
+}
+
+bool nyan_png_write(const char *filename, const NyanImage &image)
+{
+    const auto rgba = to_rgba(image);
+
+    if (!stbi_write_png(filename, image.width, image.height, 4, rgba.data(), image.width * 4))
+    {
+        log_error("nyan_png_write: writing '%s' failed", filename);
+        return false;
+    }
+
+    return true;
+}
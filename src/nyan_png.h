@@ -0,0 +1,19 @@
+#ifndef SRC_NYAN_PNG_H
+#define SRC_NYAN_PNG_H
+
+#include <vector>
+#include "nyan_soft.h"
+#include "nyan_types.h"
+
+// PNG output for 8-bit RGBA images, the counterpart of stb_image.h for
+// exporting frames, on top of stb_image_write.h. Encoding one image is single
+// threaded; encode several at once to use more cores.
+
+// Encodes 'image' (ARGB8888) into 'out', replacing its contents. 'out' is
+// empty on error.
+void nyan_png_encode(const NyanImage &image, std::vector<u8> &out);
+
+// Encodes 'image' and writes it to 'filename'. Returns false on error.
+bool nyan_png_write(const char *filename, const NyanImage &image);
+
+#endif // SRC_NYAN_PNG_H
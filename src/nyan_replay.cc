@@ -0,0 +1,350 @@
+#include "nyan_replay.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "log.h"
+
+static const char Magic[8] = { 'N', 'Y', 'A', 'N', 'R', 'E', 'C', 2 };
+
+// Record tags. Each frame starts with FrameTag, the events of the frame
+// follow, then a LevelTag if the governor level changed in the frame.
+enum : u8
+{
+    FrameTag,
+    QuitTag,
+    KeyDownTag,
+    KeyUpTag,
+    MotionTag,
+    ButtonDownTag,
+    ButtonUpTag,
+    WheelTag,
+    WindowTag,
+    LevelTag,
+};
+
+struct NyanRecorder
+{
+    FILE *file = nullptr;
+    std::vector<u8> buffer;
+    u32 lastTicks = 0;
+    bool ok = true;
+};
+
+struct NyanReplay
+{
+    std::vector<u8> data;
+    size_t pos = 0;
+    u32 ticks = 0;
+    int governorLevel = 0;
+    bool truncated = false;
+};
+
+// LEB128, signed values are zigzag encoded first.
+static void put_uint(std::vector<u8> &out, u32 v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<u8>(v | 0x80));
+        v >>= 7;
+    }
+
+    out.push_back(static_cast<u8>(v));
+}
+
+static void put_int(std::vector<u8> &out, s32 v)
+{
+    put_uint(out, (static_cast<u32>(v) << 1) ^ static_cast<u32>(v >> 31));
+}
+
+static u32 get_uint(NyanReplay *replay)
+{
+    u32 v = 0;
+
+    for (int shift=0; shift<35; shift+=7)
+    {
+        if (replay->pos >= replay->data.size())
+        {
+            replay->truncated = true;
+            return 0;
+        }
+
+        const u8 byte = replay->data[replay->pos++];
+        v |= static_cast<u32>(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            break;
+    }
+
+    return v;
+}
+
+static s32 get_int(NyanReplay *replay)
+{
+    const u32 v = get_uint(replay);
+    return static_cast<s32>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static void flush(NyanRecorder *recorder)
+{
+    if (recorder->ok && std::fwrite(recorder->buffer.data(), 1, recorder->buffer.size(), recorder->file)
+        != recorder->buffer.size())
+    {
+        log_error("nyan_recorder: write failed: %s", std::strerror(errno));
+        recorder->ok = false;
+    }
+
+    recorder->buffer.clear();
+}
+
+NyanRecorder *nyan_recorder_open(const char *filename, const NyanReplayHeader &header)
+{
+    FILE *file = std::fopen(filename, "wb");
+
+    if (!file)
+    {
+        log_error("nyan_recorder_open: could not open '%s': %s", filename, std::strerror(errno));
+        return nullptr;
+    }
+
+    auto recorder = new NyanRecorder;
+    recorder->file = file;
+
+    auto &out = recorder->buffer;
+    out.reserve(4096);
+    out.assign(Magic, Magic + sizeof(Magic));
+    put_int(out, header.windowWidth);
+    put_int(out, header.windowHeight);
+    put_uint(out, header.swarmCount);
+    put_uint(out, header.trailLength);
+    put_uint(out, (header.software ? 1u : 0u) | (header.varied ? 2u : 0u));
+    u32 budgetBits = 0;
+    std::memcpy(&budgetBits, &header.budgetMs, sizeof(budgetBits));
+    put_uint(out, budgetBits);
+
+    return recorder;
+}
+
+void nyan_recorder_frame(NyanRecorder *recorder, u32 ticks)
+{
+    if (recorder->buffer.size() >= 4000)
+        flush(recorder);
+
+    recorder->buffer.push_back(FrameTag);
+    put_uint(recorder->buffer, ticks - recorder->lastTicks);
+    recorder->lastTicks = ticks;
+}
+
+void nyan_recorder_event(NyanRecorder *recorder, const SDL_Event &event)
+{
+    auto &out = recorder->buffer;
+
+    switch (event.type)
+    {
+        case SDL_QUIT:
+            out.push_back(QuitTag);
+            break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            out.push_back(event.type == SDL_KEYDOWN ? KeyDownTag : KeyUpTag);
+            put_int(out, event.key.keysym.sym);
+            put_uint(out, static_cast<u32>(event.key.keysym.scancode));
+            put_uint(out, event.key.keysym.mod);
+            put_uint(out, event.key.repeat);
+            break;
+        case SDL_MOUSEMOTION:
+            out.push_back(MotionTag);
+            put_uint(out, event.motion.state);
+            put_int(out, event.motion.x);
+            put_int(out, event.motion.y);
+            put_int(out, event.motion.xrel);
+            put_int(out, event.motion.yrel);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            out.push_back(event.type == SDL_MOUSEBUTTONDOWN ? ButtonDownTag : ButtonUpTag);
+            put_uint(out, event.button.button);
+            put_uint(out, event.button.clicks);
+            put_int(out, event.button.x);
+            put_int(out, event.button.y);
+            break;
+        case SDL_MOUSEWHEEL:
+            out.push_back(WheelTag);
+            put_int(out, event.wheel.x);
+            put_int(out, event.wheel.y);
+            put_uint(out, event.wheel.direction);
+            break;
+        case SDL_WINDOWEVENT:
+            out.push_back(WindowTag);
+            put_uint(out, event.window.event);
+            put_int(out, event.window.data1);
+            put_int(out, event.window.data2);
+            break;
+    }
+}
+
+void nyan_recorder_governor_level(NyanRecorder *recorder, int level)
+{
+    recorder->buffer.push_back(LevelTag);
+    put_uint(recorder->buffer, static_cast<u32>(level));
+}
+
+bool nyan_recorder_close(NyanRecorder *recorder)
+{
+    if (!recorder)
+        return true;
+
+    flush(recorder);
+    bool ok = recorder->ok;
+
+    if (std::fclose(recorder->file))
+    {
+        log_error("nyan_recorder_close: %s", std::strerror(errno));
+        ok = false;
+    }
+
+    delete recorder;
+    return ok;
+}
+
+NyanReplay *nyan_replay_open(const char *filename, NyanReplayHeader &header)
+{
+    FILE *file = std::fopen(filename, "rb");
+
+    if (!file)
+    {
+        log_error("nyan_replay_open: could not open '%s': %s", filename, std::strerror(errno));
+        return nullptr;
+    }
+
+    auto replay = new NyanReplay;
+    u8 chunk[4096];
+    size_t count = 0;
+
+    while ((count = std::fread(chunk, 1, sizeof(chunk), file)))
+        replay->data.insert(replay->data.end(), chunk, chunk + count);
+
+    std::fclose(file);
+
+    if (replay->data.size() < sizeof(Magic) || std::memcmp(replay->data.data(), Magic, sizeof(Magic)))
+    {
+        log_error("nyan_replay_open: '%s' is not a recording of this version", filename);
+        delete replay;
+        return nullptr;
+    }
+
+    replay->pos = sizeof(Magic);
+    header.windowWidth = get_int(replay);
+    header.windowHeight = get_int(replay);
+    header.swarmCount = get_uint(replay);
+    header.trailLength = get_uint(replay);
+    const u32 flags = get_uint(replay);
+    header.software = flags & 1;
+    header.varied = flags & 2;
+    const u32 budgetBits = get_uint(replay);
+    std::memcpy(&header.budgetMs, &budgetBits, sizeof(budgetBits));
+
+    if (replay->truncated)
+    {
+        log_error("nyan_replay_open: '%s' is truncated", filename);
+        delete replay;
+        return nullptr;
+    }
+
+    return replay;
+}
+
+void nyan_replay_close(NyanReplay *replay)
+{
+    delete replay;
+}
+
+bool nyan_replay_next_frame(NyanReplay *replay, u32 &ticks)
+{
+    // Skips events of the current frame that were not polled.
+    SDL_Event event;
+    while (nyan_replay_poll_event(replay, event)) {}
+
+    if (replay->truncated || replay->pos >= replay->data.size())
+        return false;
+
+    ++replay->pos;
+    replay->ticks += get_uint(replay);
+    ticks = replay->ticks;
+
+    return !replay->truncated;
+}
+
+bool nyan_replay_poll_event(NyanReplay *replay, SDL_Event &event)
+{
+    while (!replay->truncated && replay->pos < replay->data.size() && replay->data[replay->pos] == LevelTag)
+    {
+        ++replay->pos;
+        replay->governorLevel = static_cast<int>(get_uint(replay));
+    }
+
+    if (replay->truncated || replay->pos >= replay->data.size() || replay->data[replay->pos] == FrameTag)
+        return false;
+
+    const u8 tag = replay->data[replay->pos++];
+    std::memset(&event, 0, sizeof(event));
+
+    switch (tag)
+    {
+        case QuitTag:
+            event.type = SDL_QUIT;
+            break;
+        case KeyDownTag:
+        case KeyUpTag:
+            event.type = tag == KeyDownTag ? SDL_KEYDOWN : SDL_KEYUP;
+            event.key.state = tag == KeyDownTag ? SDL_PRESSED : SDL_RELEASED;
+            event.key.keysym.sym = get_int(replay);
+            event.key.keysym.scancode = static_cast<SDL_Scancode>(get_uint(replay));
+            event.key.keysym.mod = static_cast<u16>(get_uint(replay));
+            event.key.repeat = static_cast<u8>(get_uint(replay));
+            break;
+        case MotionTag:
+            event.type = SDL_MOUSEMOTION;
+            event.motion.state = get_uint(replay);
+            event.motion.x = get_int(replay);
+            event.motion.y = get_int(replay);
+            event.motion.xrel = get_int(replay);
+            event.motion.yrel = get_int(replay);
+            break;
+        case ButtonDownTag:
+        case ButtonUpTag:
+            event.type = tag == ButtonDownTag ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+            event.button.state = tag == ButtonDownTag ? SDL_PRESSED : SDL_RELEASED;
+            event.button.button = static_cast<u8>(get_uint(replay));
+            event.button.clicks = static_cast<u8>(get_uint(replay));
+            event.button.x = get_int(replay);
+            event.button.y = get_int(replay);
+            break;
+        case WheelTag:
+            event.type = SDL_MOUSEWHEEL;
+            event.wheel.x = get_int(replay);
+            event.wheel.y = get_int(replay);
+            event.wheel.direction = get_uint(replay);
+            break;
+        case WindowTag:
+            event.type = SDL_WINDOWEVENT;
+            event.window.event = static_cast<u8>(get_uint(replay));
+            event.window.data1 = get_int(replay);
+            event.window.data2 = get_int(replay);
+            break;
+        default:
+            log_error("nyan_replay: unknown record %u", tag);
+            replay->truncated = true;
+            return false;
+    }
+
+    event.common.timestamp = replay->ticks;
+
+    return !replay->truncated;
+}
+
+int nyan_replay_governor_level(const NyanReplay *replay)
+{
+    return replay->governorLevel;
+}
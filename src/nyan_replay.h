@@ -0,0 +1,60 @@
+#ifndef SRC_NYAN_REPLAY_H
+#define SRC_NYAN_REPLAY_H
+
+#include <SDL_events.h>
+#include "nyan_types.h"
+
+// Input recording for reproducible runs. A recording holds the settings that
+// shape the workload, then per frame the tick count the frame was rendered
+// at and the input events polled in it. Replaying feeds both back, so the
+// same frames are simulated no matter how fast they are rendered. Only the
+// event types the demo reacts to are stored, as variable length integers.
+// Quality governor level changes are stored too: they change what is
+// simulated, and the frame times they are based on differ between runs.
+
+struct NyanReplayHeader
+{
+    int windowWidth = 0;
+    int windowHeight = 0;
+    u32 swarmCount = 0;
+    u32 trailLength = 0;
+    bool software = false;
+    bool varied = false;
+    float budgetMs = 0.0f;  // frame time budget of the governor, 0 if not governed
+};
+
+struct NyanRecorder;
+
+// Returns nullptr on error.
+NyanRecorder *nyan_recorder_open(const char *filename, const NyanReplayHeader &header);
+
+// Starts a new frame rendered at 'ticks' milliseconds.
+void nyan_recorder_frame(NyanRecorder *recorder, u32 ticks);
+
+// Adds an event to the current frame. Unsupported event types are skipped.
+void nyan_recorder_event(NyanRecorder *recorder, const SDL_Event &event);
+
+// Records that the governor switched to 'level' at the end of the current frame.
+void nyan_recorder_governor_level(NyanRecorder *recorder, int level);
+
+// Returns false if writing failed at any point.
+bool nyan_recorder_close(NyanRecorder *recorder);
+
+struct NyanReplay;
+
+// Reads the header of a recording. Returns nullptr on error.
+NyanReplay *nyan_replay_open(const char *filename, NyanReplayHeader &header);
+void nyan_replay_close(NyanReplay *replay);
+
+// Moves on to the next recorded frame and returns its tick count in 'ticks'.
+// Returns false at the end of the recording.
+bool nyan_replay_next_frame(NyanReplay *replay, u32 &ticks);
+
+// Returns the events of the current frame one by one, like SDL_PollEvent().
+bool nyan_replay_poll_event(NyanReplay *replay, SDL_Event &event);
+
+// Governor level as of the end of the current frame, 0 until the first
+// change. Valid once all events of the frame were polled.
+int nyan_replay_governor_level(const NyanReplay *replay);
+
+#endif // SRC_NYAN_REPLAY_H
@@ -0,0 +1,316 @@
+#include "nyan_sheets.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "log.h"
+#include "nyan_soft.h"
+#include "sdl_nyan.h"
+
+struct NyanSheet
+{
+    SDL_Renderer *renderer = nullptr;  // nullptr once released
+    NyanSheetVariant variant;          // as requested, the cache key
+    bool premultiplied = false;        // what the texture actually holds
+    SDL_Texture *texture = nullptr;
+    size_t textureBytes = 0;
+    int refs = 0;
+};
+
+struct NyanSheetCache
+{
+    std::mutex mutex;
+    // Few renderers times few variants, a linear search is fine.
+    std::vector<std::unique_ptr<NyanSheet>> sheets;
+    u64 hits = 0;
+    u64 uploads = 0;
+};
+
+static NyanSheetCache nyan_sheet_cache;
+
+// The decoded sprites all variants are made from.
+static const NyanImage &nyan_base_sheet()
+{
+    static std::once_flag once;
+    static NyanImage sheet;
+    std::call_once(once, [] { sheet = nyan_decode_sprite_sheet(); });
+    return sheet;
+}
+
+static bool same_variant(const NyanSheetVariant &a, const NyanSheetVariant &b)
+{
+    return a.direction == b.direction && a.scale == b.scale && a.upscale == b.upscale
+        && a.premultiplied == b.premultiplied;
+}
+
+static NyanImage make_variant_pixels(const NyanSheetVariant &variant)
+{
+    const auto &base = nyan_base_sheet();
+    NyanImage result;
+
+    if (variant.direction == NyanDirection::Left)
+    {
+        // Mirrors each sprite in its own cell so the sprite rects stay the same.
+        const int spriteWidth = NYAN_SPRITE_WIDTH;
+        NyanImage mirrored = base;
+
+        for (int y=0; y<base.height; ++y)
+        {
+            const u32 *src = base.pixels.data() + y * base.width;
+            u32 *dst = mirrored.pixels.data() + y * base.width;
+
+            for (int x=0; x<base.width; ++x)
+                dst[x] = src[(x / spriteWidth) * spriteWidth + spriteWidth - 1 - x % spriteWidth];
+        }
+
+        result = nyan_upscale_sheet(mirrored, NyanBuiltinSprites::Set, variant.scale, variant.upscale);
+    }
+    else
+        result = nyan_upscale_sheet(base, NyanBuiltinSprites::Set, variant.scale, variant.upscale);
+
+    if (variant.premultiplied)
+    {
+        for (auto &p: result.pixels)
+        {
+            const u32 a = p >> 24;
+            const u32 c0 = ((p & 0xff) * a + 127) / 255;
+            const u32 c1 = (((p >> 8) & 0xff) * a + 127) / 255;
+            const u32 c2 = (((p >> 16) & 0xff) * a + 127) / 255;
+            p = (a << 24) | (c2 << 16) | (c1 << 8) | c0;
+        }
+    }
+
+    return result;
+}
+
+static SDL_Texture *upload_sheet(SDL_Renderer *renderer, const NyanSheetVariant &variant, bool &premultiplied)
+{
+    auto pixels = make_variant_pixels(variant);
+    premultiplied = variant.premultiplied;
+    auto texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                                     pixels.width, pixels.height);
+
+    if (!texture)
+    {
+        log_error("nyan_sheet_acquire/SDL_CreateTexture: %s", SDL_GetError());
+        return nullptr;
+    }
+
+    // result = src + dst * (1 - srcAlpha)
+    static const auto premultipliedBlend = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+
+    if (premultiplied && SDL_SetTextureBlendMode(texture, premultipliedBlend))
+    {
+        log_warn("nyan_sheet_acquire: renderer does not support premultiplied alpha, using straight alpha");
+        NyanSheetVariant straight = variant;
+        straight.premultiplied = premultiplied = false;
+        pixels = make_variant_pixels(straight);
+    }
+
+    if (!premultiplied && SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND))
+    {
+        log_error("nyan_sheet_acquire/SDL_SetTextureBlendMode: %s", SDL_GetError());
+        SDL_DestroyTexture(texture);
+        return nullptr;
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+    // Pixel art, keep it sharp when drawn at fractional scales.
+    SDL_SetTextureScaleMode(texture, SDL_ScaleModeNearest);
+#endif
+
+    if (SDL_UpdateTexture(texture, nullptr, pixels.pixels.data(), pixels.width * NYAN_BBP))
+    {
+        log_error("nyan_sheet_acquire/SDL_UpdateTexture: %s", SDL_GetError());
+        SDL_DestroyTexture(texture);
+        return nullptr;
+    }
+
+    return texture;
+}
+
+// Removes 'sheet' from the cache and deletes it. Locked by the caller.
+static void erase_sheet(NyanSheetCache &cache, NyanSheet *sheet)
+{
+    if (sheet->texture)
+        SDL_DestroyTexture(sheet->texture);
+
+    cache.sheets.erase(std::find_if(cache.sheets.begin(), cache.sheets.end(),
+                                    [sheet] (const auto &p) { return p.get() == sheet; }));
+}
+
+NyanSheet *nyan_sheet_acquire(SDL_Renderer *renderer, const NyanSheetVariant &variant)
+{
+    if (!renderer || variant.scale < 1)
+    {
+        log_error("nyan_sheet_acquire: invalid arguments");
+        return nullptr;
+    }
+
+    auto &cache = nyan_sheet_cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto &sheet: cache.sheets)
+    {
+        if (sheet->renderer == renderer && same_variant(sheet->variant, variant))
+        {
+            ++sheet->refs;
+            ++cache.hits;
+            return sheet.get();
+        }
+    }
+
+    bool premultiplied = false;
+    auto texture = upload_sheet(renderer, variant, premultiplied);
+
+    if (!texture)
+        return nullptr;
+
+    auto sheet = std::make_unique<NyanSheet>();
+    sheet->renderer = renderer;
+    sheet->variant = variant;
+    sheet->premultiplied = premultiplied;
+    sheet->texture = texture;
+    sheet->textureBytes = static_cast<size_t>(nyan_sheet_rect().w) * nyan_sheet_rect().h
+        * variant.scale * variant.scale * NYAN_BBP;
+    sheet->refs = 1;
+    ++cache.uploads;
+
+    log_debug("nyan_sheet_acquire: uploaded %dx%s sheet for renderer %p (%s%s), %zu bytes",
+              variant.scale, variant.upscale == NyanUpscaleFilter::ScaleNx ? " ScaleNx" : "",
+              static_cast<void *>(renderer), variant.direction == NyanDirection::Left ? "left" : "right",
+              premultiplied ? ", premultiplied" : "", sheet->textureBytes);
+
+    cache.sheets.emplace_back(std::move(sheet));
+    return cache.sheets.back().get();
+}
+
+NyanSheet *nyan_sheet_retain(NyanSheet *sheet)
+{
+    if (sheet)
+    {
+        std::lock_guard<std::mutex> lock(nyan_sheet_cache.mutex);
+        ++sheet->refs;
+    }
+
+    return sheet;
+}
+
+void nyan_sheet_release(NyanSheet *sheet)
+{
+    if (!sheet)
+        return;
+
+    auto &cache = nyan_sheet_cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    assert(sheet->refs > 0);
+
+    // Orphans of released renderers are not cached anymore.
+    if (--sheet->refs == 0 && !sheet->renderer)
+        erase_sheet(cache, sheet);
+}
+
+SDL_Texture *nyan_sheet_texture(const NyanSheet *sheet)
+{
+    return sheet ? sheet->texture : nullptr;
+}
+
+NyanSheetVariant nyan_sheet_variant(const NyanSheet *sheet)
+{
+    if (!sheet)
+        return {};
+
+    auto result = sheet->variant;
+    result.premultiplied = sheet->premultiplied;
+    return result;
+}
+
+SDL_Rect nyan_sheet_sprite_rect(const NyanSheet *sheet, size_t index)
+{
+    auto rect = nyan_sprite_rect(index);
+    const int scale = sheet ? sheet->variant.scale : 1;
+    return { rect.x * scale, rect.y * scale, rect.w * scale, rect.h * scale };
+}
+
+void nyan_sheets_release_renderer(SDL_Renderer *renderer)
+{
+    auto &cache = nyan_sheet_cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (size_t i=0; i<cache.sheets.size();)
+    {
+        auto sheet = cache.sheets[i].get();
+
+        if (sheet->renderer != renderer)
+        {
+            ++i;
+            continue;
+        }
+
+        SDL_DestroyTexture(sheet->texture);
+        sheet->texture = nullptr;
+        sheet->renderer = nullptr;
+
+        if (sheet->refs == 0)
+            cache.sheets.erase(cache.sheets.begin() + i);
+        else
+            ++i;
+    }
+}
+
+void nyan_destroy_renderer(SDL_Renderer *renderer)
+{
+    if (!renderer)
+        return;
+
+    nyan_sheets_release_renderer(renderer);
+    SDL_DestroyRenderer(renderer);
+}
+
+void nyan_sheets_trim()
+{
+    auto &cache = nyan_sheet_cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (size_t i=0; i<cache.sheets.size();)
+    {
+        auto sheet = cache.sheets[i].get();
+
+        if (sheet->refs)
+        {
+            ++i;
+            continue;
+        }
+
+        if (sheet->texture)
+            SDL_DestroyTexture(sheet->texture);
+
+        cache.sheets.erase(cache.sheets.begin() + i);
+    }
+}
+
+NyanSheetCacheStats nyan_sheet_cache_stats()
+{
+    auto &cache = nyan_sheet_cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    NyanSheetCacheStats stats;
+    stats.hits = cache.hits;
+    stats.uploads = cache.uploads;
+
+    for (const auto &sheet: cache.sheets)
+    {
+        if (sheet->texture)
+        {
+            ++stats.sheets;
+            stats.textureBytes += sheet->textureBytes;
+        }
+    }
+
+    return stats;
+}
@@ -0,0 +1,72 @@
+#ifndef SRC_NYAN_SHEETS_H
+#define SRC_NYAN_SHEETS_H
+
+#include <SDL_render.h>
+#include "nyan_types.h"
+#include "nyan_upscale.h"
+
+// Cache of sprite sheet textures, one per renderer and variant. The sprites
+// are decoded once per process, every variant is derived from that decode
+// and uploaded once per renderer. Sheets are reference counted; a sheet
+// without references stays cached until nyan_sheets_trim() or until its
+// renderer goes away.
+//
+// SDL_DestroyRenderer() destroys all textures of the renderer, so the cache
+// must be told before that happens: destroy renderers using sheets with
+// nyan_destroy_renderer(), or call nyan_sheets_release_renderer() before
+// SDL_DestroyRenderer() and SDL_DestroyWindow().
+
+enum class NyanDirection : u8
+{
+    Right,  // the sprites as drawn
+    Left,   // mirrored horizontally
+};
+
+struct NyanSheetVariant
+{
+    NyanDirection direction = NyanDirection::Right;
+    // Integer upscale, for crisp sprites on high-DPI outputs or at a fixed
+    // zoom that are drawn 1:1. Sprite rects grow by the same factor.
+    int scale = 1;
+    NyanUpscaleFilter upscale = NyanUpscaleFilter::Nearest;
+    // Color channels multiplied by alpha. The texture uses a matching blend
+    // mode; renderers that do not support it get straight alpha instead.
+    bool premultiplied = false;
+};
+
+struct NyanSheet;
+
+// Returns the cached sheet for 'renderer' and 'variant' with its reference
+// count incremented, creating it on first use. Returns nullptr on error.
+NyanSheet *nyan_sheet_acquire(SDL_Renderer *renderer, const NyanSheetVariant &variant = {});
+NyanSheet *nyan_sheet_retain(NyanSheet *sheet);
+void nyan_sheet_release(NyanSheet *sheet);
+
+// nullptr once the renderer of the sheet went away.
+SDL_Texture *nyan_sheet_texture(const NyanSheet *sheet);
+NyanSheetVariant nyan_sheet_variant(const NyanSheet *sheet);
+
+// nyan_sprite_rect() scaled to the sheet, indices wrap around the same way.
+SDL_Rect nyan_sheet_sprite_rect(const NyanSheet *sheet, size_t index);
+
+// Destroys the textures of all sheets cached for 'renderer'. Sheets that are
+// still referenced stay valid as handles but have no texture anymore.
+void nyan_sheets_release_renderer(SDL_Renderer *renderer);
+
+// nyan_sheets_release_renderer() followed by SDL_DestroyRenderer().
+void nyan_destroy_renderer(SDL_Renderer *renderer);
+
+// Destroys all cached sheets without references.
+void nyan_sheets_trim();
+
+struct NyanSheetCacheStats
+{
+    size_t sheets = 0;         // cached, including unreferenced ones
+    size_t textureBytes = 0;   // texture memory of the cached sheets
+    u64 hits = 0;              // nyan_sheet_acquire() served from the cache
+    u64 uploads = 0;           // textures created
+};
+
+NyanSheetCacheStats nyan_sheet_cache_stats();
+
+#endif // SRC_NYAN_SHEETS_H
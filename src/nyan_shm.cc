@@ -0,0 +1,308 @@
+#include "nyan_shm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include "log.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const u32 ShmMagic = 0x4e41594e;  // "NYAN" in little endian memory
+static const u32 ShmVersion = 1;
+
+// The atomics live in memory shared between processes, which only works if
+// they do not fall back to a lock.
+static_assert(std::atomic<u64>::is_always_lock_free, "need lock-free 64-bit atomics");
+
+struct NyanShmSlot
+{
+    // Odd while the producer writes the slot. Even values mean the slot holds
+    // a complete frame.
+    alignas(64) std::atomic<u64> seq;
+    u64 number;
+    u64 renderStartNs;
+    u64 publishNs;
+};
+
+struct NyanShmHeader
+{
+    u32 magic;
+    u32 version;
+    u32 width;
+    u32 height;
+    u32 slotCount;
+    u32 pitch;        // in pixels
+    u64 pixelOffset;  // from the start of the mapping to the pixels of slot 0
+    u64 slotStride;   // bytes from one slot's pixels to the next
+    alignas(64) std::atomic<u64> published;  // frames published so far
+    std::atomic<u32> closed;
+    NyanShmSlot slots[NYAN_SHM_MAX_SLOTS];
+};
+
+struct NyanShmMapping
+{
+    std::string name;
+    int fd = -1;
+    void *data = nullptr;
+    size_t size = 0;
+
+    NyanShmHeader *header() const { return static_cast<NyanShmHeader *>(data); }
+
+    u32 *slot_pixels(u32 slot) const
+    {
+        auto base = static_cast<u8 *>(data) + header()->pixelOffset + slot * header()->slotStride;
+        return reinterpret_cast<u32 *>(base);
+    }
+};
+
+struct NyanShmRing
+{
+    NyanShmMapping map;
+    u64 frame = 0;  // number of the frame being written
+};
+
+struct NyanShmReader
+{
+    NyanShmMapping map;
+    u64 lastNumber = ~0ull;
+};
+
+static void unmap(NyanShmMapping &map)
+{
+    if (map.data)
+        munmap(map.data, map.size);
+
+    if (map.fd >= 0)
+        close(map.fd);
+}
+
+u64 nyan_shm_now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<u64>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+NyanShmRing *nyan_shm_ring_create(const char *name, int width, int height, u32 slotCount)
+{
+    slotCount = std::min(std::max(slotCount, 2u), NYAN_SHM_MAX_SLOTS);
+
+    // Slots start on page boundaries.
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t pixelOffset = (sizeof(NyanShmHeader) + page - 1) / page * page;
+    const size_t slotStride = (static_cast<size_t>(width) * height * 4 + page - 1) / page * page;
+
+    auto ring = new NyanShmRing;
+    auto &map = ring->map;
+    map.name = name;
+    map.size = pixelOffset + slotStride * slotCount;
+
+    shm_unlink(name);
+    map.fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (map.fd < 0 || ftruncate(map.fd, static_cast<off_t>(map.size)))
+    {
+        log_error("nyan_shm_ring_create: could not create '%s': %s", name, std::strerror(errno));
+        unmap(map);
+        shm_unlink(name);
+        delete ring;
+        return nullptr;
+    }
+
+    map.data = mmap(nullptr, map.size, PROT_READ | PROT_WRITE, MAP_SHARED, map.fd, 0);
+
+    if (map.data == MAP_FAILED)
+    {
+        log_error("nyan_shm_ring_create: mmap failed: %s", std::strerror(errno));
+        map.data = nullptr;
+        unmap(map);
+        shm_unlink(name);
+        delete ring;
+        return nullptr;
+    }
+
+    // ftruncate() zero fills, so all atomics start out as 0.
+    auto header = map.header();
+    header->version = ShmVersion;
+    header->width = width;
+    header->height = height;
+    header->slotCount = slotCount;
+    header->pitch = width;
+    header->pixelOffset = pixelOffset;
+    header->slotStride = slotStride;
+
+    // Readers check the magic last.
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ShmMagic;
+
+    return ring;
+}
+
+void nyan_shm_ring_destroy(NyanShmRing *ring)
+{
+    if (!ring)
+        return;
+
+    ring->map.header()->closed.store(1, std::memory_order_release);
+    unmap(ring->map);
+    shm_unlink(ring->map.name.c_str());
+    delete ring;
+}
+
+NyanFramebuffer nyan_shm_ring_begin_frame(NyanShmRing *ring, u64 renderStartNs)
+{
+    auto header = ring->map.header();
+    const u32 index = static_cast<u32>(ring->frame % header->slotCount);
+    auto &slot = header->slots[index];
+
+    // Seqlock write: odd sequence first, the release fence keeps the pixel
+    // writes after it.
+    slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.number = ring->frame;
+    slot.renderStartNs = renderStartNs;
+
+    return { ring->map.slot_pixels(index), static_cast<int>(header->width), static_cast<int>(header->height),
+             static_cast<int>(header->pitch) };
+}
+
+void nyan_shm_ring_end_frame(NyanShmRing *ring)
+{
+    auto header = ring->map.header();
+    auto &slot = header->slots[ring->frame % header->slotCount];
+
+    slot.publishNs = nyan_shm_now_ns();
+    slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    header->published.store(++ring->frame, std::memory_order_release);
+}
+
+NyanShmReader *nyan_shm_reader_open(const char *name)
+{
+    auto reader = new NyanShmReader;
+    auto &map = reader->map;
+    map.name = name;
+    map.fd = shm_open(name, O_RDONLY, 0);
+
+    struct stat st;
+
+    if (map.fd < 0 || fstat(map.fd, &st) || static_cast<size_t>(st.st_size) < sizeof(NyanShmHeader))
+    {
+        log_error("nyan_shm_reader_open: could not open '%s': %s", name, std::strerror(errno));
+        unmap(map);
+        delete reader;
+        return nullptr;
+    }
+
+    map.size = static_cast<size_t>(st.st_size);
+    map.data = mmap(nullptr, map.size, PROT_READ, MAP_SHARED, map.fd, 0);
+
+    if (map.data == MAP_FAILED)
+    {
+        log_error("nyan_shm_reader_open: mmap failed: %s", std::strerror(errno));
+        map.data = nullptr;
+        unmap(map);
+        delete reader;
+        return nullptr;
+    }
+
+    const auto header = map.header();
+
+    if (header->magic != ShmMagic || header->version != ShmVersion)
+    {
+        log_error("nyan_shm_reader_open: '%s' is not a frame ring of this version", name);
+        unmap(map);
+        delete reader;
+        return nullptr;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return reader;
+}
+
+void nyan_shm_reader_close(NyanShmReader *reader)
+{
+    if (!reader)
+        return;
+
+    unmap(reader->map);
+    delete reader;
+}
+
+bool nyan_shm_reader_closed(const NyanShmReader *reader)
+{
+    return reader->map.header()->closed.load(std::memory_order_acquire);
+}
+
+bool nyan_shm_reader_acquire(NyanShmReader *reader, NyanShmFrame &frame)
+{
+    const auto header = reader->map.header();
+    const u64 published = header->published.load(std::memory_order_acquire);
+
+    if (!published || published - 1 == reader->lastNumber)
+        return false;
+
+    const u64 number = published - 1;
+    const u32 index = static_cast<u32>(number % header->slotCount);
+    const auto &slot = header->slots[index];
+    const u64 seq = slot.seq.load(std::memory_order_acquire);
+
+    // Odd: already being overwritten, the newer frame shows up soon.
+    if (seq & 1)
+        return false;
+
+    frame.pixels = reader->map.slot_pixels(index);
+    frame.width = static_cast<int>(header->width);
+    frame.height = static_cast<int>(header->height);
+    frame.pitch = static_cast<int>(header->pitch);
+    frame.number = slot.number;
+    frame.renderStartNs = slot.renderStartNs;
+    frame.publishNs = slot.publishNs;
+    frame.seq = seq;
+
+    reader->lastNumber = number;
+    return frame.number == number;
+}
+
+bool nyan_shm_reader_release(NyanShmReader *reader, const NyanShmFrame &frame)
+{
+    const auto header = reader->map.header();
+    const auto &slot = header->slots[frame.number % header->slotCount];
+
+    // Seqlock read: all reads of the frame happen before the second load.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == frame.seq;
+}
+#else
+u64 nyan_shm_now_ns()
+{
+    return 0;
+}
+
+NyanShmRing *nyan_shm_ring_create(const char *name, int, int, u32)
+{
+    log_error("nyan_shm_ring_create: cannot create '%s', shared memory rings need POSIX", name);
+    return nullptr;
+}
+
+void nyan_shm_ring_destroy(NyanShmRing *) {}
+NyanFramebuffer nyan_shm_ring_begin_frame(NyanShmRing *, u64) { return {}; }
+void nyan_shm_ring_end_frame(NyanShmRing *) {}
+
+NyanShmReader *nyan_shm_reader_open(const char *name)
+{
+    log_error("nyan_shm_reader_open: cannot open '%s', shared memory rings need POSIX", name);
+    return nullptr;
+}
+
+void nyan_shm_reader_close(NyanShmReader *) {}
+bool nyan_shm_reader_closed(const NyanShmReader *) { return true; }
+bool nyan_shm_reader_acquire(NyanShmReader *, NyanShmFrame &) { return false; }
+bool nyan_shm_reader_release(NyanShmReader *, const NyanShmFrame &) { return false; }
+#endif
@@ -0,0 +1,67 @@
+#ifndef SRC_NYAN_SHM_H
+#define SRC_NYAN_SHM_H
+
+#include "nyan_soft.h"
+#include "nyan_types.h"
+
+// Ring of framebuffers in POSIX shared memory, so other local processes can
+// read rendered frames in place without copying them. The producer renders
+// straight into the next slot; each slot is guarded by a sequence counter
+// (a seqlock), nothing ever blocks. A consumer maps the ring by name, looks
+// at the newest frame and checks afterwards that the producer did not lap
+// it while reading. With N slots a consumer has N - 1 frame times to finish.
+// Not available on Windows.
+
+static const u32 NYAN_SHM_MAX_SLOTS = 8;
+
+// Monotonic clock shared by all processes on the machine, for latencies.
+u64 nyan_shm_now_ns();
+
+// Producer side.
+struct NyanShmRing;
+
+// Creates (or replaces) the shared memory object 'name', e.g. "/sdl_nyan",
+// holding 'slotCount' frames of width x height ARGB8888 pixels. Returns
+// nullptr on error.
+NyanShmRing *nyan_shm_ring_create(const char *name, int width, int height, u32 slotCount = 3);
+
+// Marks the ring as closed for consumers, unmaps and unlinks it.
+void nyan_shm_ring_destroy(NyanShmRing *ring);
+
+// Returns the framebuffer of the next slot. 'renderStartNs' is passed on to
+// consumers for latency measurements.
+NyanFramebuffer nyan_shm_ring_begin_frame(NyanShmRing *ring, u64 renderStartNs);
+
+// Publishes the frame started with nyan_shm_ring_begin_frame().
+void nyan_shm_ring_end_frame(NyanShmRing *ring);
+
+// Consumer side.
+struct NyanShmReader;
+
+struct NyanShmFrame
+{
+    const u32 *pixels = nullptr;  // points into the shared mapping
+    int width = 0;
+    int height = 0;
+    int pitch = 0;                // in pixels
+    u64 number = 0;               // frames published before this one
+    u64 renderStartNs = 0;
+    u64 publishNs = 0;
+    u64 seq = 0;                  // slot sequence when acquired
+};
+
+NyanShmReader *nyan_shm_reader_open(const char *name);
+void nyan_shm_reader_close(NyanShmReader *reader);
+
+// True once the producer has destroyed the ring.
+bool nyan_shm_reader_closed(const NyanShmReader *reader);
+
+// Gets the newest published frame if it is newer than the last one acquired.
+// Returns false if there is none yet.
+bool nyan_shm_reader_acquire(NyanShmReader *reader, NyanShmFrame &frame);
+
+// Ends reading 'frame'. Returns false if the producer started overwriting
+// it in the meantime, the pixels read may be torn then.
+bool nyan_shm_reader_release(NyanShmReader *reader, const NyanShmFrame &frame);
+
+#endif // SRC_NYAN_SHM_H
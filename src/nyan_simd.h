@@ -0,0 +1,20 @@
+#ifndef SRC_NYAN_SIMD_H
+#define SRC_NYAN_SIMD_H
+
+// Optional x86 SIMD code paths. Kernels are compiled for a specific
+// instruction set with NYAN_TARGET() and picked at runtime using SDL's CPU
+// feature detection, so the default build still runs on any x86 CPU and
+// other architectures fall back to the scalar code.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NYAN_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NYAN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NYAN_TARGET(isa)
+#endif
+
+#endif // SRC_NYAN_SIMD_H
@@ -0,0 +1,684 @@
+#include "nyan_soft.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float NYAN_DEG2RAD = 3.14159265358979323846f / 180.0f;
+
+NyanFramebuffer nyan_framebuffer(NyanImage &image)
+{
+    return { image.pixels.data(), image.width, image.height, image.width };
+}
+
+void nyan_compute_sprite_trims(const NyanImage &sheet, const NyanSpriteSet &set, NyanSpriteTrim *trims)
+{
+    for (int i=0; i<set.frameCount; ++i)
+    {
+        const auto r = nyan_sprite_set_rect(set, i);
+        int x0 = r.w, y0 = r.h, x1 = -1, y1 = -1;
+
+        for (int y=0; y<r.h; ++y)
+        {
+            const u32 *row = sheet.pixels.data() + (r.y + y) * sheet.width + r.x;
+
+            for (int x=0; x<r.w; ++x)
+            {
+                if (row[x] >> 24)
+                {
+                    x0 = std::min(x0, x); x1 = std::max(x1, x);
+                    y0 = std::min(y0, y); y1 = std::max(y1, y);
+                }
+            }
+        }
+
+        if (x1 < 0) // fully transparent
+            trims[i] = { { r.x, r.y, 0, 0 }, { 0, 0 } };
+        else
+            trims[i] = { { r.x + x0, r.y + y0, x1 - x0 + 1, y1 - y0 + 1 }, { x0, y0 } };
+    }
+}
+
+NyanSpanImage nyan_make_span_image(const NyanImage &image)
+{
+    NyanSpanImage result;
+    result.width = std::min(image.width, 0xffff);
+    result.height = image.height;
+    result.rowSpans.reserve(image.height + 1);
+
+    for (int y=0; y<result.height; ++y)
+    {
+        result.rowSpans.push_back(result.spans.size());
+        const u32 *row = image.pixels.data() + y * image.width;
+
+        for (int x=0; x<result.width;)
+        {
+            const u32 a = row[x] >> 24;
+
+            if (a == 0)
+            {
+                ++x;
+                continue;
+            }
+
+            // A span ends at the first pixel of a different kind.
+            const bool opaque = a == 0xff;
+            int end = x + 1;
+
+            while (end < result.width && (row[end] >> 24) != 0 && ((row[end] >> 24) == 0xff) == opaque)
+                ++end;
+
+            result.spans.push_back({ static_cast<u16>(x), static_cast<u16>(end - x),
+                                     static_cast<u32>(result.texels.size()), opaque });
+            result.texels.insert(result.texels.end(), row + x, row + end);
+            x = end;
+        }
+    }
+
+    result.rowSpans.push_back(result.spans.size());
+    return result;
+}
+
+static SDL_Rect intersect_rects(const SDL_Rect &a, const SDL_Rect &b)
+{
+    const int x0 = std::max(a.x, b.x);
+    const int y0 = std::max(a.y, b.y);
+    const int x1 = std::min(a.x + a.w, b.x + b.w);
+    const int y1 = std::min(a.y + a.h, b.y + b.h);
+    return { x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0) };
+}
+
+SDL_Rect nyan_draw_cmd_bounds(const NyanDrawCmd &cmd)
+{
+    const float px = cmd.dst.x + cmd.center.x;
+    const float py = cmd.dst.y + cmd.center.y;
+
+    if (cmd.angle == 0.0f)
+    {
+        const int x0 = static_cast<int>(std::floor(cmd.dst.x));
+        const int y0 = static_cast<int>(std::floor(cmd.dst.y));
+        const int x1 = static_cast<int>(std::ceil(cmd.dst.x + cmd.dst.w));
+        const int y1 = static_cast<int>(std::ceil(cmd.dst.y + cmd.dst.h));
+        return { x0, y0, x1 - x0, y1 - y0 };
+    }
+
+    const float c = std::cos(cmd.angle * NYAN_DEG2RAD);
+    const float s = std::sin(cmd.angle * NYAN_DEG2RAD);
+    const float xs[2] = { -cmd.center.x, cmd.dst.w - cmd.center.x };
+    const float ys[2] = { -cmd.center.y, cmd.dst.h - cmd.center.y };
+
+    float minX = px, maxX = px, minY = py, maxY = py;
+
+    for (float lx: xs)
+    {
+        for (float ly: ys)
+        {
+            const float x = px + lx * c - ly * s;
+            const float y = py + lx * s + ly * c;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+        }
+    }
+
+    const int x0 = static_cast<int>(std::floor(minX));
+    const int y0 = static_cast<int>(std::floor(minY));
+    const int x1 = static_cast<int>(std::ceil(maxX));
+    const int y1 = static_cast<int>(std::ceil(maxY));
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+void nyan_fill(const NyanFramebuffer &fb, const SDL_Rect &rect, u32 color)
+{
+    const auto r = intersect_rects(rect, { 0, 0, fb.width, fb.height });
+
+    for (int y=r.y; y<r.y+r.h; ++y)
+        std::fill_n(fb.pixels + y * fb.pitch + r.x, r.w, color);
+}
+
+// Source-over blending of straight alpha ARGB pixels.
+static inline u32 blend_pixel(u32 src, u32 dst)
+{
+    const u32 a = src >> 24;
+
+    if (a == 0xff)
+        return src;
+
+    if (a == 0)
+        return dst;
+
+    const u32 ia = 255 - a;
+    u32 rb = (src & 0xff00ff) * a + (dst & 0xff00ff) * ia;
+    u32 g = (src & 0x00ff00) * a + (dst & 0x00ff00) * ia;
+    // x / 255 == (x + 128 + ((x + 128) >> 8)) >> 8 for the range used here.
+    rb += 0x800080;
+    g += 0x008000;
+    rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+    g = ((g + ((g >> 8) & 0x00ff00)) >> 8) & 0x00ff00;
+    const u32 outA = a + ((dst >> 24) * ia + 127) / 255;
+    return (outA << 24) | rb | g;
+}
+
+static inline bool is_white(const SDL_Color &c)
+{
+    return (c.r & c.g & c.b & c.a) == 0xff;
+}
+
+// Multiplies each channel by the matching channel of 'c', like SDL's texture
+// color and alpha mod.
+static inline u32 modulate_pixel(u32 texel, const SDL_Color &c)
+{
+    auto mul = [] (u32 x, u32 y) { const u32 p = x * y + 128; return (p + (p >> 8)) >> 8; };
+    return (mul(texel >> 24, c.a) << 24) | (mul((texel >> 16) & 0xff, c.r) << 16)
+        | (mul((texel >> 8) & 0xff, c.g) << 8) | mul(texel & 0xff, c.b);
+}
+
+// Blends one texel into 'dst'. The instrumented variant also classifies the
+// write and bumps the overdraw count of the pixel if 'overdraw' is set.
+template<bool Instrumented>
+static inline void blit_pixel(u32 texel, u32 &dst, NyanFillStats &stats, u16 *overdraw)
+{
+    if (Instrumented)
+    {
+        const u32 a = texel >> 24;
+
+        if (a == 0)
+        {
+            ++stats.skipped;
+            return;
+        }
+
+        if (a == 0xff)
+            ++stats.written;
+        else
+            ++stats.blended;
+
+        if (overdraw && *overdraw != 0xffff)
+            ++*overdraw;
+    }
+
+    dst = blend_pixel(texel, dst);
+}
+
+static u16 *overdraw_row(NyanOverdrawMap *overdraw, int y)
+{
+    return overdraw ? overdraw->counts.data() + y * overdraw->width : nullptr;
+}
+
+// Texel access used by the blit kernels, overloaded for each sheet format.
+static inline u32 sheet_texel(const NyanImage &sheet, int x, int y)
+{
+    return sheet.pixels[y * sheet.width + x];
+}
+
+static inline u32 sheet_texel(const NyanIndexedImage &sheet, int x, int y)
+{
+    return sheet.palette[sheet.indices[y * sheet.width + x]];
+}
+
+// First span of row 'y' that ends after 'x'.
+static inline const NyanSpan *find_span(const NyanSpanImage &sheet, int y, int x)
+{
+    const NyanSpan *begin = sheet.spans.data() + sheet.rowSpans[y];
+    const NyanSpan *end = sheet.spans.data() + sheet.rowSpans[y + 1];
+    return std::partition_point(begin, end, [x] (const NyanSpan &span) { return span.x + span.length <= x; });
+}
+
+static inline u32 sheet_texel(const NyanSpanImage &sheet, int x, int y)
+{
+    const NyanSpan *span = find_span(sheet, y, x);
+
+    if (span == sheet.spans.data() + sheet.rowSpans[y + 1] || span->x > x)
+        return 0;
+
+    return sheet.texels[span->texels + x - span->x];
+}
+
+// Returns 'count' consecutive texels of row 'y' starting at 'x'. Indexed
+// sheets are expanded into 'scratch', which must hold 'count' pixels.
+static inline const u32 *sheet_row(const NyanImage &sheet, int x, int y, int, u32 *)
+{
+    return sheet.pixels.data() + y * sheet.width + x;
+}
+
+static inline const u32 *sheet_row(const NyanIndexedImage &sheet, int x, int y, int count, u32 *scratch)
+{
+    nyan_expand_indices(sheet.indices.data() + y * sheet.width + x, count,
+                        sheet.palette.data(), sheet.palette.size(), scratch);
+    return scratch;
+}
+
+template<bool Instrumented, typename Sheet>
+static size_t blit_unrotated(const NyanFramebuffer &fb, const SDL_Rect &clip, const Sheet &sheet,
+                             const NyanDrawCmd &cmd, NyanFillStats &stats, NyanOverdrawMap *overdraw)
+{
+    static const int RowChunk = 256;
+    const int dx = static_cast<int>(std::floor(cmd.dst.x + 0.5f));
+    const int dy = static_cast<int>(std::floor(cmd.dst.y + 0.5f));
+    const auto area = intersect_rects({ dx, dy, cmd.src.w, cmd.src.h }, clip);
+    const bool modulate = !is_white(cmd.color);
+    u32 scratch[RowChunk];
+
+    for (int y=area.y; y<area.y+area.h; ++y)
+    {
+        u16 *od = overdraw_row(overdraw, y);
+
+        for (int x=area.x; x<area.x+area.w; x+=RowChunk)
+        {
+            const int n = std::min(RowChunk, area.x + area.w - x);
+            const u32 *src = sheet_row(sheet, cmd.src.x + x - dx, cmd.src.y + y - dy, n, scratch);
+            u32 *dst = fb.pixels + y * fb.pitch + x;
+
+            for (int i=0; i<n; ++i)
+            {
+                const u32 texel = modulate ? modulate_pixel(src[i], cmd.color) : src[i];
+                blit_pixel<Instrumented>(texel, dst[i], stats, od ? od + x + i : nullptr);
+            }
+        }
+    }
+
+    return static_cast<size_t>(area.w) * area.h;
+}
+
+// Span images only visit the non-transparent runs of each row. Opaque runs
+// are copied, only translucent ones are blended.
+template<bool Instrumented>
+static size_t blit_unrotated(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanSpanImage &sheet,
+                             const NyanDrawCmd &cmd, NyanFillStats &stats, NyanOverdrawMap *overdraw)
+{
+    const int dx = static_cast<int>(std::floor(cmd.dst.x + 0.5f));
+    const int dy = static_cast<int>(std::floor(cmd.dst.y + 0.5f));
+    const auto area = intersect_rects({ dx, dy, cmd.src.w, cmd.src.h }, clip);
+    const bool modulate = !is_white(cmd.color);
+    size_t touched = 0;
+
+    for (int y=area.y; y<area.y+area.h; ++y)
+    {
+        // Sheet columns [x0, x1) map to framebuffer columns starting at area.x.
+        const int sy = cmd.src.y + y - dy;
+        const int x0 = cmd.src.x + area.x - dx;
+        const int x1 = x0 + area.w;
+        const NyanSpan *span = find_span(sheet, sy, x0);
+        const NyanSpan *rowEnd = sheet.spans.data() + sheet.rowSpans[sy + 1];
+        u32 *dst = fb.pixels + y * fb.pitch + area.x - x0;
+        u16 *od = overdraw_row(overdraw, y);
+
+        for (; span != rowEnd && span->x < x1; ++span)
+        {
+            const int s0 = std::max<int>(span->x, x0);
+            const int s1 = std::min<int>(span->x + span->length, x1);
+            const u32 *src = sheet.texels.data() + span->texels - span->x;
+
+            if (span->opaque && !modulate)
+            {
+                std::memcpy(dst + s0, src + s0, (s1 - s0) * sizeof(u32));
+
+                if (Instrumented)
+                {
+                    stats.written += s1 - s0;
+
+                    for (int x=s0; od && x<s1; ++x)
+                    {
+                        u16 &count = od[area.x - x0 + x];
+                        count += count != 0xffff;
+                    }
+                }
+            }
+            else
+            {
+                for (int x=s0; x<s1; ++x)
+                {
+                    const u32 texel = modulate ? modulate_pixel(src[x], cmd.color) : src[x];
+                    blit_pixel<Instrumented>(texel, dst[x], stats, od ? od + area.x - x0 + x : nullptr);
+                }
+            }
+
+            touched += s1 - s0;
+        }
+    }
+
+    return touched;
+}
+
+// Narrows [lo, hi) to the indices i for which 0 <= f0 + df * i < limit.
+static void clip_span(float f0, float df, float limit, int &lo, int &hi)
+{
+    if (df == 0.0f)
+    {
+        if (f0 < 0.0f || f0 >= limit)
+            hi = lo;
+        return;
+    }
+
+    float first, last;
+
+    if (df > 0.0f)
+    {
+        first = std::ceil(-f0 / df);
+        last = std::ceil((limit - f0) / df);
+    }
+    else
+    {
+        first = std::floor((limit - f0) / df) + 1.0f;
+        last = std::floor(-f0 / df) + 1.0f;
+    }
+
+    const float begin = static_cast<float>(lo);
+    const float end = static_cast<float>(hi);
+    lo = static_cast<int>(std::clamp(first, begin, end));
+    hi = std::max(lo, static_cast<int>(std::clamp(last, begin, end)));
+}
+
+template<bool Instrumented, typename Sheet>
+static size_t blit_transformed(const NyanFramebuffer &fb, const SDL_Rect &clip, const Sheet &sheet,
+                               const NyanDrawCmd &cmd, NyanFillStats &stats, NyanOverdrawMap *overdraw)
+{
+    const auto area = intersect_rects(nyan_draw_cmd_bounds(cmd), clip);
+
+    if (area.w <= 0 || area.h <= 0)
+        return 0;
+
+    // Inverse mapping from destination pixel centers to source texels. The
+    // row start is computed for x=0, not for the clipped area, so a pixel maps
+    // to the same texel no matter which tile it is rasterized in.
+    const float c = std::cos(cmd.angle * NYAN_DEG2RAD);
+    const float s = std::sin(cmd.angle * NYAN_DEG2RAD);
+    const float px = cmd.dst.x + cmd.center.x;
+    const float py = cmd.dst.y + cmd.center.y;
+    const float scaleX = cmd.src.w / cmd.dst.w;
+    const float scaleY = cmd.src.h / cmd.dst.h;
+    const float du = c * scaleX;
+    const float dv = -s * scaleY;
+    const float fx = 0.5f - px;
+    const bool modulate = !is_white(cmd.color);
+    size_t touched = 0;
+
+    for (int y=area.y; y<area.y+area.h; ++y)
+    {
+        const float fy = y + 0.5f - py;
+        const float u0 = (c * fx + s * fy + cmd.center.x) * scaleX;
+        const float v0 = (-s * fx + c * fy + cmd.center.y) * scaleY;
+
+        int lo = area.x, hi = area.x + area.w;
+        clip_span(u0, du, cmd.src.w, lo, hi);
+        clip_span(v0, dv, cmd.src.h, lo, hi);
+
+        u32 *dst = fb.pixels + y * fb.pitch;
+        u16 *od = overdraw_row(overdraw, y);
+
+        for (int i=lo; i<hi; ++i)
+        {
+            const int u = std::clamp(static_cast<int>(u0 + du * i), 0, cmd.src.w - 1);
+            const int v = std::clamp(static_cast<int>(v0 + dv * i), 0, cmd.src.h - 1);
+            u32 texel = sheet_texel(sheet, cmd.src.x + u, cmd.src.y + v);
+
+            if (modulate)
+                texel = modulate_pixel(texel, cmd.color);
+
+            blit_pixel<Instrumented>(texel, dst[i], stats, od ? od + i : nullptr);
+        }
+
+        touched += hi - lo;
+    }
+
+    return touched;
+}
+
+template<bool Instrumented, typename Sheet>
+static size_t blit_impl(const NyanFramebuffer &fb, const SDL_Rect &clip, const Sheet &sheet,
+                        const NyanDrawCmd &cmd, NyanFillStats &stats, NyanOverdrawMap *overdraw)
+{
+    if (cmd.angle == 0.0f && cmd.dst.w == cmd.src.w && cmd.dst.h == cmd.src.h)
+        return blit_unrotated<Instrumented>(fb, clip, sheet, cmd, stats, overdraw);
+
+    return blit_transformed<Instrumented>(fb, clip, sheet, cmd, stats, overdraw);
+}
+
+template<typename Sheet>
+static size_t blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const Sheet &sheet, const NyanDrawCmd &cmd,
+                   NyanFillStats *stats, NyanOverdrawMap *overdraw)
+{
+    const auto fbClip = intersect_rects(clip, { 0, 0, fb.width, fb.height });
+
+    if (cmd.src.w <= 0 || cmd.src.h <= 0 || cmd.dst.w <= 0.0f || cmd.dst.h <= 0.0f)
+        return 0;
+
+    if (!stats && !overdraw)
+    {
+        NyanFillStats unused;
+        return blit_impl<false>(fb, fbClip, sheet, cmd, unused, nullptr);
+    }
+
+    NyanFillStats local;
+    const size_t touched = blit_impl<true>(fb, fbClip, sheet, cmd, local, overdraw);
+
+    if (stats)
+        *stats += local;
+
+    return touched;
+}
+
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanImage &sheet, const NyanDrawCmd &cmd,
+                 NyanFillStats *stats, NyanOverdrawMap *overdraw)
+{
+    return blit(fb, clip, sheet, cmd, stats, overdraw);
+}
+
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanIndexedImage &sheet,
+                 const NyanDrawCmd &cmd, NyanFillStats *stats, NyanOverdrawMap *overdraw)
+{
+    return blit(fb, clip, sheet, cmd, stats, overdraw);
+}
+
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanSpanImage &sheet,
+                 const NyanDrawCmd &cmd, NyanFillStats *stats, NyanOverdrawMap *overdraw)
+{
+    return blit(fb, clip, sheet, cmd, stats, overdraw);
+}
+
+static const u32 HeatmapColors[] = {
+    0xff000000u, 0xff0000ffu, 0xff00ffffu, 0xff00ff00u, 0xffffff00u, 0xffff0000u, 0xffffffffu
+};
+
+void nyan_overdraw_heatmap(const NyanOverdrawMap &overdraw, const NyanFramebuffer &out, u16 maxCount)
+{
+    if (!maxCount)
+    {
+        for (auto n: overdraw.counts)
+            maxCount = std::max(maxCount, n);
+        maxCount = std::max<u16>(maxCount, 1);
+    }
+
+    const int stops = static_cast<int>(SDL_arraysize(HeatmapColors)) - 1;
+    const int w = std::min(overdraw.width, out.width);
+    const int h = std::min(overdraw.height, out.height);
+
+    for (int y=0; y<h; ++y)
+    {
+        const u16 *src = overdraw.counts.data() + y * overdraw.width;
+        u32 *dst = out.pixels + y * out.pitch;
+
+        for (int x=0; x<w; ++x)
+        {
+            // Linear interpolation between the color stops.
+            const int t = std::min<int>(src[x], maxCount) * stops * 256 / maxCount;
+            const int i = std::min(t >> 8, stops - 1);
+            const u32 f = std::min(t - (i << 8), 256);
+            const u32 c0 = HeatmapColors[i], c1 = HeatmapColors[i + 1];
+            u32 result = 0xff000000u;
+
+            for (int shift=0; shift<24; shift+=8)
+            {
+                const u32 a = (c0 >> shift) & 0xff, b = (c1 >> shift) & 0xff;
+                result |= ((a * (256 - f) + b * f) >> 8) << shift;
+            }
+
+            dst[x] = result;
+        }
+    }
+}
+
+struct NyanTileRasterizer
+{
+    NyanJobSystem *jobs = nullptr;
+    int tileSize = 64;
+    int tilesX = 0;
+    int tilesY = 0;
+    // Command indices binned per tile in draw order, tile t owns
+    // binItems[binStart[t], binStart[t + 1]). Flat arrays, so a frame only
+    // allocates when it needs more than any frame before.
+    std::vector<u32> binStart;
+    std::vector<u32> binCursor;
+    std::vector<u32> binItems;
+    std::vector<SDL_Rect> cmdTiles;  // tile range of each command, w/h are the last tile
+    std::vector<u64> tilePixels;     // pixels touched per tile
+
+    // Instrumentation, see nyan_tile_rasterizer_set_instrumentation().
+    bool collectStats = false;
+    NyanOverdrawMap *overdraw = nullptr;
+    std::vector<NyanFillStats> tileStats;
+};
+
+NyanTileRasterizer *nyan_tile_rasterizer_create(NyanJobSystem *jobs, int tileSize)
+{
+    auto rast = new NyanTileRasterizer;
+    rast->jobs = jobs;
+    rast->tileSize = std::max(8, tileSize);
+    return rast;
+}
+
+void nyan_tile_rasterizer_destroy(NyanTileRasterizer *rast)
+{
+    delete rast;
+}
+
+template<typename Sheet>
+static void tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const Sheet &sheet,
+                           const NyanDrawCmd *cmds, size_t count, u32 clearColor)
+{
+    const int ts = rast->tileSize;
+    rast->tilesX = (fb.width + ts - 1) / ts;
+    rast->tilesY = (fb.height + ts - 1) / ts;
+    const size_t tileCount = static_cast<size_t>(rast->tilesX) * rast->tilesY;
+    rast->tilePixels.assign(tileCount, 0);
+    rast->tileStats.assign(rast->collectStats ? tileCount : 0, NyanFillStats());
+
+    auto overdraw = rast->overdraw;
+
+    if (overdraw)
+    {
+        // Cleared per tile below.
+        overdraw->width = fb.width;
+        overdraw->height = fb.height;
+        overdraw->counts.resize(static_cast<size_t>(fb.width) * fb.height);
+    }
+
+    // Pass 1: count the commands per tile.
+    const SDL_Rect fbRect = { 0, 0, fb.width, fb.height };
+    rast->binStart.assign(tileCount + 1, 0);
+    rast->cmdTiles.resize(count);
+
+    for (size_t i=0; i<count; ++i)
+    {
+        const auto b = intersect_rects(nyan_draw_cmd_bounds(cmds[i]), fbRect);
+        auto &tiles = rast->cmdTiles[i];
+
+        if (b.w <= 0 || b.h <= 0)
+        {
+            tiles = { 0, 0, -1, -1 };
+            continue;
+        }
+
+        tiles = { b.x / ts, b.y / ts, (b.x + b.w - 1) / ts, (b.y + b.h - 1) / ts };
+
+        for (int ty=tiles.y; ty<=tiles.h; ++ty)
+            for (int tx=tiles.x; tx<=tiles.w; ++tx)
+                ++rast->binStart[ty * rast->tilesX + tx + 1];
+    }
+
+    // Pass 2: prefix sum, then scatter. Scattering in submission order keeps
+    // each bin sorted by draw order.
+    for (size_t t=0; t<tileCount; ++t)
+        rast->binStart[t + 1] += rast->binStart[t];
+
+    rast->binItems.resize(rast->binStart[tileCount]);
+    rast->binCursor.assign(rast->binStart.begin(), rast->binStart.end() - 1);
+
+    for (size_t i=0; i<count; ++i)
+    {
+        const auto &tiles = rast->cmdTiles[i];
+
+        for (int ty=tiles.y; ty<=tiles.h; ++ty)
+            for (int tx=tiles.x; tx<=tiles.w; ++tx)
+                rast->binItems[rast->binCursor[ty * rast->tilesX + tx]++] = static_cast<u32>(i);
+    }
+
+    nyan_parallel_for(rast->jobs, tileCount, 1, [&] (size_t begin, size_t end)
+    {
+        for (size_t t=begin; t<end; ++t)
+        {
+            const int tx = t % rast->tilesX;
+            const int ty = t / rast->tilesX;
+            const SDL_Rect tileRect = { tx * ts, ty * ts, ts, ts };
+
+            nyan_fill(fb, tileRect, clearColor);
+            u64 touched = 0;
+            NyanFillStats *stats = rast->collectStats ? &rast->tileStats[t] : nullptr;
+
+            if (overdraw)
+            {
+                const auto r = intersect_rects(tileRect, { 0, 0, fb.width, fb.height });
+                for (int y=r.y; y<r.y+r.h; ++y)
+                    std::fill_n(overdraw->counts.data() + y * overdraw->width + r.x, r.w, 0);
+            }
+
+            for (u32 j=rast->binStart[t]; j<rast->binStart[t + 1]; ++j)
+                touched += nyan_blit(fb, tileRect, sheet, cmds[rast->binItems[j]], stats, overdraw);
+
+            rast->tilePixels[t] = touched;
+        }
+    });
+}
+
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor)
+{
+    tile_rasterize(rast, fb, sheet, cmds, count, clearColor);
+}
+
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanIndexedImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor)
+{
+    tile_rasterize(rast, fb, sheet, cmds, count, clearColor);
+}
+
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanSpanImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor)
+{
+    tile_rasterize(rast, fb, sheet, cmds, count, clearColor);
+}
+
+void nyan_tile_rasterizer_set_instrumentation(NyanTileRasterizer *rast, bool collectStats, NyanOverdrawMap *overdraw)
+{
+    rast->collectStats = collectStats;
+    rast->overdraw = overdraw;
+}
+
+NyanFillStats nyan_tile_rasterizer_fill_stats(const NyanTileRasterizer *rast)
+{
+    NyanFillStats result;
+
+    for (const auto &stats: rast->tileStats)
+        result += stats;
+
+    return result;
+}
+
+u64 nyan_tile_rasterizer_pixels_touched(const NyanTileRasterizer *rast)
+{
+    u64 result = 0;
+
+    for (auto n: rast->tilePixels)
+        result += n;
+
+    return result;
+}
@@ -0,0 +1,189 @@
+#ifndef SRC_NYAN_SOFT_H
+#define SRC_NYAN_SOFT_H
+
+#include <SDL_rect.h>
+#include <vector>
+#include "nyan_jobs.h"
+#include "nyan_types.h"
+#include "sdl_nyan.h"
+
+// CPU side rendering of nyans. All pixels are ARGB8888, the same format used
+// for the sprite sheet texture.
+
+// Owning pixel buffer, pitch == width.
+struct NyanImage
+{
+    std::vector<u32> pixels;
+    int width = 0;
+    int height = 0;
+};
+
+// Non-owning view of a render target. Can point into a NyanImage or into a
+// locked streaming SDL_Texture. Pitch is in pixels.
+struct NyanFramebuffer
+{
+    u32 *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+};
+
+// 8-bit palette indexed image. Holds the same pixels as a NyanImage in a
+// quarter of the memory, sprites rarely use more than a handful of colors.
+// All fully transparent pixels share palette entry 0.
+struct NyanIndexedImage
+{
+    std::vector<u8> indices;
+    std::vector<u32> palette;
+    int width = 0;
+    int height = 0;
+};
+
+// Run-length encoded image. Each row is stored as a sorted list of spans of
+// either fully opaque or translucent pixels, transparent pixels are left out.
+// Unrotated 1:1 blits skip the gaps and copy opaque spans without blending.
+// Rotated and scaled blits need a binary search per texel and are slower than
+// with a NyanImage. Width is limited to 65535 pixels.
+struct NyanSpan
+{
+    u16 x;        // first pixel of the span in the row
+    u16 length;
+    u32 texels;   // offset into NyanSpanImage::texels
+    bool opaque;  // every texel has alpha 255
+};
+
+struct NyanSpanImage
+{
+    std::vector<NyanSpan> spans;
+    std::vector<u32> rowSpans; // spans of row y are [rowSpans[y], rowSpans[y + 1])
+    std::vector<u32> texels;
+    int width = 0;
+    int height = 0;
+};
+
+// Per frame fill-rate counters of the CPU blitters. Every pixel touched by a
+// blit is exactly one of these.
+struct NyanFillStats
+{
+    u64 written = 0;  // opaque texel replaced the pixel
+    u64 blended = 0;  // translucent texel blended onto the pixel
+    u64 skipped = 0;  // fully transparent texel, pixel left alone
+
+    u64 touched() const { return written + blended + skipped; }
+
+    NyanFillStats &operator+=(const NyanFillStats &o)
+    {
+        written += o.written;
+        blended += o.blended;
+        skipped += o.skipped;
+        return *this;
+    }
+};
+
+// Number of non-transparent writes per framebuffer pixel. Saturates at 0xffff.
+struct NyanOverdrawMap
+{
+    std::vector<u16> counts;
+    int width = 0;
+    int height = 0;
+};
+
+// Decodes the built-in sprites into a CPU side sheet with the same layout as
+// the texture returned by make_nyan_sprite_sheet_from_mem(). The sprites are
+// decoded in parallel if 'jobs' is given.
+NyanImage nyan_decode_sprite_sheet(NyanJobSystem *jobs = nullptr);
+
+// Decodes the frames of another sprite set, one PNG (or any format
+// stb_image reads) per frame, into a sheet laid out as described by 'set'.
+// Returns an empty image if the set has no frames or columns, or if a frame
+// fails to decode or has the wrong size.
+NyanImage nyan_decode_sprite_set(const NyanSpriteSet &set, const u8 *const *frameData, const size_t *frameSizes,
+                                 NyanJobSystem *jobs = nullptr);
+
+// Uploads a CPU side sheet into a new texture set up for alpha blending.
+// Returns nullptr on error.
+SDL_Texture *nyan_make_sheet_texture(SDL_Renderer *renderer, const NyanImage &sheet);
+
+// Memory used by stb_image while decoding sprites. Each decode allocates
+// from a pooled arena that is reset afterwards and kept for the next sheet,
+// so only the first sheet touches the heap.
+struct NyanDecodeStats
+{
+    size_t peakBytes = 0;     // most memory a single sprite decode needed
+    size_t arenaBytes = 0;    // held by all decode arenas
+    size_t arenaCount = 0;
+    u64 heapAllocations = 0;  // allocations that did not fit into an arena
+};
+
+NyanDecodeStats nyan_decode_stats();
+
+NyanFramebuffer nyan_framebuffer(NyanImage &image);
+
+// Builds the palette of 'image' in order of first appearance. Returns false
+// and leaves 'out' alone if the image has more than 256 distinct colors.
+bool nyan_make_indexed_image(const NyanImage &image, NyanIndexedImage &out);
+
+NyanSpanImage nyan_make_span_image(const NyanImage &image);
+
+// dst[i] = palette[indices[i]] for i in [0, count). Palettes of up to 16
+// colors are expanded with SSSE3 byte shuffles if the CPU supports them.
+void nyan_expand_indices(const u8 *indices, size_t count, const u32 *palette, size_t paletteSize, u32 *dst);
+
+// Computes the trim rects of all frames of 'set' in 'sheet'. 'trims' needs
+// room for set.frameCount entries.
+void nyan_compute_sprite_trims(const NyanImage &sheet, const NyanSpriteSet &set, NyanSpriteTrim *trims);
+
+// Conservative integer screen bounds of the rotated and scaled destination quad.
+SDL_Rect nyan_draw_cmd_bounds(const NyanDrawCmd &cmd);
+
+// Fills 'rect' (clipped to the framebuffer) with 'color'.
+void nyan_fill(const NyanFramebuffer &fb, const SDL_Rect &rect, u32 color);
+
+// Alpha blends the sprite described by 'cmd' into 'fb', touching only pixels
+// inside 'clip'. Uses nearest sampling, unrotated 1:1 draws take a faster
+// row copy path. Returns the number of framebuffer pixels touched, for span
+// images that excludes the transparent gaps.
+// Instrumentation is optional: 'stats' is added to, 'overdraw' must have the
+// same size as 'fb'. Without both the uninstrumented kernels are used.
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanImage &sheet, const NyanDrawCmd &cmd,
+                 NyanFillStats *stats = nullptr, NyanOverdrawMap *overdraw = nullptr);
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanIndexedImage &sheet,
+                 const NyanDrawCmd &cmd, NyanFillStats *stats = nullptr, NyanOverdrawMap *overdraw = nullptr);
+size_t nyan_blit(const NyanFramebuffer &fb, const SDL_Rect &clip, const NyanSpanImage &sheet,
+                 const NyanDrawCmd &cmd, NyanFillStats *stats = nullptr, NyanOverdrawMap *overdraw = nullptr);
+
+// Renders 'overdraw' as a black-blue-cyan-green-yellow-red-white heatmap.
+// maxCount == 0 scales to the largest count in the map.
+void nyan_overdraw_heatmap(const NyanOverdrawMap &overdraw, const NyanFramebuffer &out, u16 maxCount = 0);
+
+// Splits the framebuffer into square tiles, bins the draw commands by their
+// rotated bounds and rasterizes the tiles in parallel on the job system.
+// Commands overlapping multiple tiles are drawn into each of them, within a
+// tile the submission order is preserved.
+struct NyanTileRasterizer;
+
+NyanTileRasterizer *nyan_tile_rasterizer_create(NyanJobSystem *jobs, int tileSize = 64);
+void nyan_tile_rasterizer_destroy(NyanTileRasterizer *rast);
+
+// Clears 'fb' to 'clearColor' and draws 'cmds' on top.
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor);
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanIndexedImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor);
+void nyan_tile_rasterize(NyanTileRasterizer *rast, const NyanFramebuffer &fb, const NyanSpanImage &sheet,
+                         const NyanDrawCmd *cmds, size_t count, u32 clearColor);
+
+// Number of framebuffer pixels touched by sprite blits during the last
+// nyan_tile_rasterize() call, not counting the clear.
+u64 nyan_tile_rasterizer_pixels_touched(const NyanTileRasterizer *rast);
+
+// Enables per frame fill-rate counters and/or overdraw counting. The
+// overdraw map is resized to the framebuffer on each nyan_tile_rasterize()
+// call and must stay alive until instrumentation is turned off again.
+void nyan_tile_rasterizer_set_instrumentation(NyanTileRasterizer *rast, bool collectStats,
+                                              NyanOverdrawMap *overdraw = nullptr);
+
+// Counters of the last nyan_tile_rasterize() call, zero if not collected.
+NyanFillStats nyan_tile_rasterizer_fill_stats(const NyanTileRasterizer *rast);
+
+#endif // SRC_NYAN_SOFT_H
@@ -0,0 +1,87 @@
+#ifndef SRC_NYAN_SPRITE_SET_H
+#define SRC_NYAN_SPRITE_SET_H
+
+#include <SDL_rect.h>
+#include <array>
+#include <cstddef>
+
+// Layout of a sprite sheet: 'frameCount' frames of frameWidth x frameHeight
+// pixels, 'columns' frames per row, filled row by row. The built-in nyans
+// are a single row of 12 frames of 36x26 pixels.
+struct NyanSpriteSet
+{
+    int frameWidth = 0;
+    int frameHeight = 0;
+    int frameCount = 0;
+    int columns = 0;
+};
+
+constexpr int nyan_sprite_set_rows(const NyanSpriteSet &set)
+{
+    return set.columns ? (set.frameCount + set.columns - 1) / set.columns : 0;
+}
+
+constexpr SDL_Rect nyan_sprite_set_sheet_rect(const NyanSpriteSet &set)
+{
+    return { 0, 0, set.columns * set.frameWidth, nyan_sprite_set_rows(set) * set.frameHeight };
+}
+
+// An empty rect if the set has no columns.
+constexpr SDL_Rect nyan_sprite_set_rect(const NyanSpriteSet &set, size_t index)
+{
+    if (!set.columns)
+        return { 0, 0, 0, 0 };
+
+    const int i = static_cast<int>(index);
+    return { (i % set.columns) * set.frameWidth, (i / set.columns) * set.frameHeight,
+             set.frameWidth, set.frameHeight };
+}
+
+constexpr bool operator==(const NyanSpriteSet &a, const NyanSpriteSet &b)
+{
+    return a.frameWidth == b.frameWidth && a.frameHeight == b.frameHeight
+        && a.frameCount == b.frameCount && a.columns == b.columns;
+}
+
+constexpr bool operator!=(const NyanSpriteSet &a, const NyanSpriteSet &b)
+{
+    return !(a == b);
+}
+
+// The same description as compile time constants. Code templated on the
+// traits gets its frame rects from a constexpr table instead of computing
+// them per sprite. rect() wraps indices past the last frame around, like an
+// animation loops.
+template<int FrameWidth, int FrameHeight, int FrameCount, int Columns = FrameCount>
+struct NyanSpriteSetTraits
+{
+    static_assert(FrameWidth > 0 && FrameHeight > 0 && FrameCount > 0 && Columns > 0, "empty sprite set");
+
+    static constexpr NyanSpriteSet Set = { FrameWidth, FrameHeight, FrameCount, Columns };
+    static constexpr SDL_Rect SheetRect = nyan_sprite_set_sheet_rect(Set);
+
+    static constexpr std::array<SDL_Rect, FrameCount> make_rects()
+    {
+        std::array<SDL_Rect, FrameCount> result = {};
+        for (size_t i=0; i<result.size(); ++i)
+            result[i] = nyan_sprite_set_rect(Set, i);
+        return result;
+    }
+
+    static constexpr std::array<SDL_Rect, FrameCount> Rects = make_rects();
+
+    static constexpr size_t count() { return FrameCount; }
+    static constexpr const SDL_Rect &rect(size_t index) { return Rects[index % FrameCount]; }
+};
+
+// Runtime sprite sets with the same interface as NyanSpriteSetTraits, for
+// code templated on the set. Wraps indices the same way.
+struct NyanSpriteSetView
+{
+    NyanSpriteSet set;
+
+    size_t count() const { return set.frameCount; }
+    SDL_Rect rect(size_t index) const { return nyan_sprite_set_rect(set, set.frameCount ? index % set.frameCount : 0); }
+};
+
+#endif // SRC_NYAN_SPRITE_SET_H
@@ -0,0 +1,307 @@
+#include "nyan_swarm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// std::mt19937 output is fixed by the standard, the std distributions are
+// not. These map it the same way with every standard library, so a seed gives
+// the same swarm everywhere, which golden images and replays rely on.
+static float random_float(std::mt19937 &rng, float min, float max)
+{
+    return min + (max - min) * static_cast<float>(rng() >> 8) * (1.0f / 16777216.0f);
+}
+
+static int random_int(std::mt19937 &rng, int min, int max)
+{
+    return min + static_cast<int>(rng() % static_cast<u32>(max - min + 1));
+}
+
+void nyan_swarm_populate(NyanSwarm &swarm, size_t count, const SDL_FRect &world, u32 seed)
+{
+    std::mt19937 rng(seed);
+
+    swarm.world = world;
+    swarm.cats.resize(count);
+
+    for (auto &cat: swarm.cats)
+    {
+        cat.pos.x = random_float(rng, world.x, world.x + world.w);
+        cat.pos.y = random_float(rng, world.y, world.y + world.h);
+        cat.vel.x = random_float(rng, -120.0f, 120.0f);
+        cat.vel.y = random_float(rng, -120.0f, 120.0f);
+        cat.angle = random_float(rng, 0.0f, 360.0f);
+        cat.spin = random_float(rng, -90.0f, 90.0f);
+    }
+}
+
+void nyan_swarm_vary_looks(NyanSwarm &swarm, u32 seed)
+{
+    std::mt19937 rng(seed);
+    const float frameCount = static_cast<float>(swarm.sprites.frameCount);
+
+    for (auto &cat: swarm.cats)
+    {
+        cat.color.r = static_cast<u8>(random_int(rng, 64, 255));
+        cat.color.g = static_cast<u8>(random_int(rng, 64, 255));
+        cat.color.b = static_cast<u8>(random_int(rng, 64, 255));
+        cat.color.a = static_cast<u8>(random_int(rng, 96, 255));
+        cat.animPhase = random_float(rng, 0.0f, frameCount);
+        cat.animSpeed = random_float(rng, 0.5f, 2.0f);
+    }
+}
+
+static void step_cat(NyanCat &cat, const SDL_FRect &world, float dt)
+{
+    const float xMax = world.x + world.w;
+    const float yMax = world.y + world.h;
+
+    cat.pos.x += cat.vel.x * dt;
+    cat.pos.y += cat.vel.y * dt;
+
+    if (cat.pos.x < world.x) { cat.pos.x = world.x; cat.vel.x = -cat.vel.x; }
+    if (cat.pos.x > xMax) { cat.pos.x = xMax; cat.vel.x = -cat.vel.x; }
+    if (cat.pos.y < world.y) { cat.pos.y = world.y; cat.vel.y = -cat.vel.y; }
+    if (cat.pos.y > yMax) { cat.pos.y = yMax; cat.vel.y = -cat.vel.y; }
+
+    cat.angle += cat.spin * dt;
+    if (cat.angle >= 360.0f) cat.angle -= 360.0f;
+    if (cat.angle < 0.0f) cat.angle += 360.0f;
+}
+
+void nyan_swarm_step(NyanSwarm &swarm, float dt, NyanJobSystem *jobs)
+{
+    nyan_parallel_for(jobs, swarm.cats.size(), 4096, [&swarm, dt] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+            step_cat(swarm.cats[i], swarm.world, dt);
+    });
+}
+
+void nyan_swarm_step_lod(NyanSwarm &swarm, float dt, const SDL_FRect &nearRect, u32 frame, u32 interval,
+                         NyanJobSystem *jobs)
+{
+    if (interval <= 1)
+    {
+        nyan_swarm_step(swarm, dt, jobs);
+        return;
+    }
+
+    const float farDt = dt * interval;
+    const u32 group = frame % interval;
+    const float x1 = nearRect.x + nearRect.w;
+    const float y1 = nearRect.y + nearRect.h;
+
+    nyan_parallel_for(jobs, swarm.cats.size(), 4096, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            auto &cat = swarm.cats[i];
+            const bool near = cat.pos.x >= nearRect.x && cat.pos.x <= x1 && cat.pos.y >= nearRect.y && cat.pos.y <= y1;
+
+            if (near)
+                step_cat(cat, swarm.world, dt);
+            else if (i % interval == group)
+                step_cat(cat, swarm.world, farDt);
+        }
+    });
+}
+
+float nyan_swarm_cat_radius(const NyanSwarm &swarm)
+{
+    const float w = swarm.sprites.frameWidth, h = swarm.sprites.frameHeight;
+    const float dx = std::max(swarm.pivot.x, w - swarm.pivot.x);
+    const float dy = std::max(swarm.pivot.y, h - swarm.pivot.y);
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+SDL_FRect nyan_camera_world_rect(const NyanCamera &cam)
+{
+    const float w = cam.viewWidth / cam.zoom;
+    const float h = cam.viewHeight / cam.zoom;
+    return { cam.center.x - w * 0.5f, cam.center.y - h * 0.5f, w, h };
+}
+
+SDL_FPoint nyan_camera_to_screen(const NyanCamera &cam, const SDL_FPoint &world)
+{
+    return {
+        (world.x - cam.center.x) * cam.zoom + cam.viewWidth * 0.5f,
+        (world.y - cam.center.y) * cam.zoom + cam.viewHeight * 0.5f
+    };
+}
+
+SDL_FPoint nyan_camera_to_world(const NyanCamera &cam, const SDL_FPoint &screen)
+{
+    return {
+        (screen.x - cam.viewWidth * 0.5f) / cam.zoom + cam.center.x,
+        (screen.y - cam.viewHeight * 0.5f) / cam.zoom + cam.center.y
+    };
+}
+
+void nyan_camera_pan(NyanCamera &cam, float screenDx, float screenDy)
+{
+    cam.center.x -= screenDx / cam.zoom;
+    cam.center.y -= screenDy / cam.zoom;
+}
+
+void nyan_camera_zoom_at(NyanCamera &cam, float factor, const SDL_FPoint &screenPos)
+{
+    static const float ZoomMin = 1.0f / 64.0f;
+    static const float ZoomMax = 64.0f;
+
+    const auto anchor = nyan_camera_to_world(cam, screenPos);
+    cam.zoom = std::clamp(cam.zoom * factor, ZoomMin, ZoomMax);
+    const auto moved = nyan_camera_to_world(cam, screenPos);
+    cam.center.x += anchor.x - moved.x;
+    cam.center.y += anchor.y - moved.y;
+}
+
+static int grid_cell_coord(float v, float origin, float cellSize, int cellCount)
+{
+    const int c = static_cast<int>(std::floor((v - origin) / cellSize));
+    return std::clamp(c, 0, cellCount - 1);
+}
+
+void nyan_grid_build(NyanGrid &grid, const SDL_FRect &bounds, float cellSize,
+                     const NyanCat *cats, size_t count)
+{
+    grid.bounds = bounds;
+    grid.cellSize = cellSize;
+    grid.cols = std::max(1, static_cast<int>(std::ceil(bounds.w / cellSize)));
+    grid.rows = std::max(1, static_cast<int>(std::ceil(bounds.h / cellSize)));
+
+    const size_t cellCount = static_cast<size_t>(grid.cols) * grid.rows;
+    grid.cellStart.assign(cellCount + 1, 0);
+    grid.items.resize(count);
+    grid.itemCells.resize(count);
+
+    // Pass 1: count cats per cell. Cats outside the bounds are clamped into
+    // the border cells so they are never lost.
+    for (size_t i=0; i<count; ++i)
+    {
+        const int cx = grid_cell_coord(cats[i].pos.x, bounds.x, cellSize, grid.cols);
+        const int cy = grid_cell_coord(cats[i].pos.y, bounds.y, cellSize, grid.rows);
+        const u32 cell = cy * grid.cols + cx;
+        grid.itemCells[i] = cell;
+        ++grid.cellStart[cell + 1];
+    }
+
+    // Pass 2: prefix sum.
+    for (size_t c=0; c<cellCount; ++c)
+        grid.cellStart[c + 1] += grid.cellStart[c];
+
+    // Pass 3: scatter the cat indices into their cells.
+    grid.cellCursor.assign(grid.cellStart.begin(), grid.cellStart.end() - 1);
+
+    for (size_t i=0; i<count; ++i)
+        grid.items[grid.cellCursor[grid.itemCells[i]]++] = static_cast<u32>(i);
+}
+
+void nyan_grid_query(const NyanGrid &grid, const SDL_FRect &rect, float margin, std::vector<u32> &out)
+{
+    const float x0 = rect.x - margin;
+    const float y0 = rect.y - margin;
+    const float x1 = rect.x + rect.w + margin;
+    const float y1 = rect.y + rect.h + margin;
+
+    const auto &b = grid.bounds;
+
+    // Completely outside of the world. The border cells also hold clamped
+    // cats, so only reject if the query misses the bounds entirely.
+    if (x1 < b.x || y1 < b.y || x0 > b.x + b.w || y0 > b.y + b.h)
+        return;
+
+    const int cx0 = grid_cell_coord(x0, b.x, grid.cellSize, grid.cols);
+    const int cy0 = grid_cell_coord(y0, b.y, grid.cellSize, grid.rows);
+    const int cx1 = grid_cell_coord(x1, b.x, grid.cellSize, grid.cols);
+    const int cy1 = grid_cell_coord(y1, b.y, grid.cellSize, grid.rows);
+
+    for (int cy=cy0; cy<=cy1; ++cy)
+    {
+        // Cells of one row are contiguous in 'items'.
+        const u32 first = grid.cellStart[cy * grid.cols + cx0];
+        const u32 last = grid.cellStart[cy * grid.cols + cx1 + 1];
+        out.insert(out.end(), grid.items.begin() + first, grid.items.begin() + last);
+    }
+}
+
+size_t nyan_swarm_cull(const NyanSwarm &swarm, const NyanGrid &grid, const NyanCamera &cam,
+                       std::vector<u32> &visible)
+{
+    const auto view = nyan_camera_world_rect(cam);
+    const float radius = nyan_swarm_cat_radius(swarm);
+
+    visible.clear();
+    nyan_grid_query(grid, view, radius, visible);
+
+    // Exact test of the bounding circle against the view rect.
+    const float r2 = radius * radius;
+    auto outside = [&] (u32 i)
+    {
+        const auto &p = swarm.cats[i].pos;
+        const float dx = p.x - std::clamp(p.x, view.x, view.x + view.w);
+        const float dy = p.y - std::clamp(p.y, view.y, view.y + view.h);
+        return dx * dx + dy * dy > r2;
+    };
+
+    visible.erase(std::remove_if(visible.begin(), visible.end(), outside), visible.end());
+    std::sort(visible.begin(), visible.end());
+    return visible.size();
+}
+
+// 'Sprites' is NyanBuiltinSprites, with the frame count and rects known at
+// compile time, or a NyanSpriteSetView.
+template<typename Sprites>
+static void build_draw_cmds(const NyanSwarm &swarm, const NyanCamera &cam, const std::vector<u32> &visible,
+                            float animTime, const Sprites &sprites, const NyanSpriteTrim *trims,
+                            std::vector<NyanDrawCmd> &cmds, NyanJobSystem *jobs)
+{
+    const SDL_FPoint rotCenter = { swarm.pivot.x * cam.zoom, swarm.pivot.y * cam.zoom };
+    const float w = sprites.rect(0).w * cam.zoom;
+    const float h = sprites.rect(0).h * cam.zoom;
+    const size_t frameCount = sprites.count();
+
+    cmds.resize(visible.size());
+
+    nyan_parallel_for(jobs, visible.size(), 4096, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto &cat = swarm.cats[visible[i]];
+            const auto frame = static_cast<size_t>(std::fmod(animTime * cat.animSpeed + cat.animPhase,
+                                                             static_cast<float>(frameCount)));
+            const auto spriteIndex = std::min<size_t>(frame, frameCount - 1);
+            const auto screen = nyan_camera_to_screen(cam, cat.pos);
+            cmds[i] = { sprites.rect(spriteIndex), { screen.x - rotCenter.x, screen.y - rotCenter.y, w, h },
+                        rotCenter, swarm.upright ? 0.0f : cat.angle, cat.color };
+
+            if (trims)
+                cmds[i] = nyan_trim_draw_cmd(&cmds[i], &trims[spriteIndex]);
+        }
+    });
+}
+
+void nyan_swarm_draw_cmds(const NyanSwarm &swarm, const NyanCamera &cam, const std::vector<u32> &visible,
+                          float animTime, std::vector<NyanDrawCmd> &cmds, NyanJobSystem *jobs)
+{
+    if (swarm.sprites == NyanBuiltinSprites::Set)
+    {
+        NyanSpriteTrim trims[NYAN_SPRITE_COUNT];
+
+        for (size_t i=0; i<NYAN_SPRITE_COUNT; ++i)
+            trims[i] = nyan_sprite_trim(i);
+
+        build_draw_cmds(swarm, cam, visible, animTime, NyanBuiltinSprites(), swarm.trimSprites ? trims : nullptr,
+                        cmds, jobs);
+    }
+    else if (swarm.sprites.frameCount > 0)
+    {
+        const bool trim = swarm.trimSprites
+            && swarm.spriteTrims.size() == static_cast<size_t>(swarm.sprites.frameCount);
+
+        build_draw_cmds(swarm, cam, visible, animTime, NyanSpriteSetView{ swarm.sprites },
+                        trim ? swarm.spriteTrims.data() : nullptr, cmds, jobs);
+    }
+    else
+        cmds.clear();
+}
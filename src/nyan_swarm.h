@@ -0,0 +1,115 @@
+#ifndef SRC_NYAN_SWARM_H
+#define SRC_NYAN_SWARM_H
+
+#include <SDL_render.h>
+#include <vector>
+#include "nyan_jobs.h"
+#include "nyan_types.h"
+#include "sdl_nyan.h"
+
+// Large populations of nyans moving around in a world that is bigger than the
+// window. Cats are binned into a uniform grid each step so that rendering only
+// has to look at the cells overlapping the camera viewport.
+
+struct NyanCat
+{
+    SDL_FPoint pos = {};  // world position of the rotation pivot
+    SDL_FPoint vel = {};  // world units per second
+    float angle = 0.0f;   // degrees, clockwise like SDL_RenderCopyEx()
+    float spin = 0.0f;    // degrees per second
+    SDL_Color color = { 255, 255, 255, 255 };  // tint and alpha
+    float animPhase = 0.0f;  // animation frame offset
+    float animSpeed = 1.0f;  // animation speed multiplier
+};
+
+struct NyanSwarm
+{
+    std::vector<NyanCat> cats;
+    SDL_FRect world = {};
+    // Layout of the sheet the draw commands refer to. The built-in set has
+    // its rects resolved at compile time.
+    NyanSpriteSet sprites = NyanBuiltinSprites::Set;
+    // Rotation pivot relative to the sprite rect origin. Same as the
+    // rotCenter used by the spinny circle in the demo.
+    SDL_FPoint pivot = { NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT };
+    // Draw the trimmed sprite rects, skipping the fully transparent border.
+    // Other sprite sets are only trimmed if 'spriteTrims' holds a trim per
+    // frame, see nyan_compute_sprite_trims().
+    bool trimSprites = true;
+    std::vector<NyanSpriteTrim> spriteTrims;
+    // Draw all cats upright, ignoring NyanCat::angle. Unrotated blits are a
+    // lot cheaper for the CPU rasterizer.
+    bool upright = false;
+};
+
+struct NyanCamera
+{
+    SDL_FPoint center = {};  // world position shown in the middle of the view
+    float zoom = 1.0f;       // screen pixels per world unit
+    int viewWidth = 0;
+    int viewHeight = 0;
+};
+
+// Uniform grid over the swarm world. Rebuilt from scratch every step using a
+// counting sort: 'items' holds cat indices grouped by cell, the indices for
+// cell c are items[cellStart[c] .. cellStart[c+1]).
+struct NyanGrid
+{
+    SDL_FRect bounds = {};
+    float cellSize = 64.0f;
+    int cols = 0;
+    int rows = 0;
+    std::vector<u32> cellStart;
+    std::vector<u32> items;
+    // scratch space reused between builds
+    std::vector<u32> itemCells;
+    std::vector<u32> cellCursor;
+};
+
+// Scatters 'count' cats over 'world' with random velocities and spins. The
+// result only depends on 'seed', not on the compiler or standard library.
+void nyan_swarm_populate(NyanSwarm &swarm, size_t count, const SDL_FRect &world, u32 seed = 42);
+// Gives every cat a random tint, alpha, animation phase and speed, as
+// reproducible as nyan_swarm_populate().
+void nyan_swarm_vary_looks(NyanSwarm &swarm, u32 seed = 42);
+void nyan_swarm_step(NyanSwarm &swarm, float dt, NyanJobSystem *jobs = nullptr);
+
+// Like nyan_swarm_step(), but cats outside of 'nearRect' are only simulated
+// every 'interval' frames, in 'interval' groups taking turns, with a time
+// step of interval * dt. 'frame' counts the calls.
+void nyan_swarm_step_lod(NyanSwarm &swarm, float dt, const SDL_FRect &nearRect, u32 frame, u32 interval,
+                         NyanJobSystem *jobs = nullptr);
+
+// Radius around the pivot that contains the sprite at any rotation angle.
+float nyan_swarm_cat_radius(const NyanSwarm &swarm);
+
+SDL_FRect nyan_camera_world_rect(const NyanCamera &cam);
+SDL_FPoint nyan_camera_to_screen(const NyanCamera &cam, const SDL_FPoint &world);
+SDL_FPoint nyan_camera_to_world(const NyanCamera &cam, const SDL_FPoint &screen);
+void nyan_camera_pan(NyanCamera &cam, float screenDx, float screenDy);
+// Multiplies the zoom by 'factor' keeping the world point under 'screenPos' in place.
+void nyan_camera_zoom_at(NyanCamera &cam, float factor, const SDL_FPoint &screenPos);
+
+void nyan_grid_build(NyanGrid &grid, const SDL_FRect &bounds, float cellSize,
+                     const NyanCat *cats, size_t count);
+
+// Appends the indices of all cats whose pivot lies in a cell overlapping 'rect'
+// grown by 'margin' on each side. This is a conservative candidate set, use
+// nyan_swarm_cull() for the exact test.
+void nyan_grid_query(const NyanGrid &grid, const SDL_FRect &rect, float margin, std::vector<u32> &out);
+
+// Fills 'visible' with the indices of all cats whose rotated sprite may overlap
+// the camera viewport. Indices are sorted so the draw order matches the order
+// of swarm.cats. Returns the number of visible cats.
+size_t nyan_swarm_cull(const NyanSwarm &swarm, const NyanGrid &grid, const NyanCamera &cam,
+                       std::vector<u32> &visible);
+
+// Fills 'cmds' with screen space draw commands for the cats listed in
+// 'visible'. 'animTime' is the global animation time in frames, each cat shows
+// sprite (animTime * animSpeed + animPhase) modulo the frame count. Submit
+// the commands with nyan_render_geometry() or rasterize them on the CPU using
+// nyan_tile_rasterize().
+void nyan_swarm_draw_cmds(const NyanSwarm &swarm, const NyanCamera &cam, const std::vector<u32> &visible,
+                          float animTime, std::vector<NyanDrawCmd> &cmds, NyanJobSystem *jobs = nullptr);
+
+#endif // SRC_NYAN_SWARM_H
@@ -0,0 +1,238 @@
+#include "nyan_trail.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const float NYAN_DEG2RAD = 3.14159265358979323846f / 180.0f;
+static const int BandCount = 6;
+
+// Colors and alphas of the nyan.js rainbow, top to bottom.
+static const SDL_Color BandColors[BandCount] = {
+    { 255,   0,   0, 128 },
+    { 255, 153,   0, 128 },
+    { 255, 255,   0, 128 },
+    {  51, 255,   0, 128 },
+    {   0, 153, 255, 179 },
+    { 102,  51, 255, 128 },
+};
+
+void nyan_trails_reset(NyanTrails &trails, size_t catCount, size_t capacity)
+{
+    trails.capacity = std::max<size_t>(capacity, 2);
+    trails.points.assign(catCount * trails.capacity, SDL_FPoint());
+    trails.heads.assign(catCount, 0);
+    trails.counts.assign(catCount, 0);
+}
+
+SDL_FPoint nyan_swarm_sprite_center(const NyanSwarm &swarm, const NyanCat &cat)
+{
+    const float c = std::cos(cat.angle * NYAN_DEG2RAD);
+    const float s = std::sin(cat.angle * NYAN_DEG2RAD);
+    const float lx = swarm.sprites.frameWidth * 0.5f - swarm.pivot.x;
+    const float ly = swarm.sprites.frameHeight * 0.5f - swarm.pivot.y;
+    return { cat.pos.x + lx * c - ly * s, cat.pos.y + lx * s + ly * c };
+}
+
+void nyan_trails_update(NyanTrails &trails, const NyanSwarm &swarm, NyanJobSystem *jobs)
+{
+    const size_t catCount = std::min(swarm.cats.size(), trails.heads.size());
+    const float minDist2 = trails.spacing * trails.spacing;
+
+    nyan_parallel_for(jobs, catCount, 4096, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto pos = nyan_swarm_sprite_center(swarm, swarm.cats[i]);
+            SDL_FPoint *ring = trails.points.data() + i * trails.capacity;
+            u32 &head = trails.heads[i];
+            u32 &count = trails.counts[i];
+
+            if (count)
+            {
+                const float dx = pos.x - ring[head].x, dy = pos.y - ring[head].y;
+
+                if (dx * dx + dy * dy < minDist2)
+                    continue;
+
+                head = (head + 1) % trails.capacity;
+            }
+
+            ring[head] = pos;
+            count = std::min<u32>(count + 1, trails.capacity);
+        }
+    });
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+// The live position goes in front of the recorded ones so the ribbon reaches
+// the cat, unless it was just recorded.
+static bool trail_has_live_point(const NyanTrails &trails, size_t cat, const SDL_FPoint &live)
+{
+    const auto &newest = trails.points[cat * trails.capacity + trails.heads[cat]];
+    return newest.x != live.x || newest.y != live.y;
+}
+
+static size_t trail_point_count(const NyanTrails &trails, size_t cat, const SDL_FPoint &live)
+{
+    const size_t n = trails.counts[cat];
+    return n ? n + trail_has_live_point(trails, cat, live) : 0;
+}
+
+// Point k of the trail of 'cat', newest first.
+static SDL_FPoint trail_point(const NyanTrails &trails, size_t cat, const SDL_FPoint &live, bool hasLive, size_t k)
+{
+    if (hasLive)
+    {
+        if (k == 0)
+            return live;
+        --k;
+    }
+
+    const auto cap = trails.capacity;
+    return trails.points[cat * cap + (trails.heads[cat] + cap - k) % cap];
+}
+
+size_t nyan_trails_build_geometry(NyanTrails &trails, const NyanSwarm &swarm, const NyanCamera &cam,
+                                  NyanJobSystem *jobs)
+{
+    const size_t catCount = std::min(swarm.cats.size(), trails.heads.size());
+    const float halfWidth = trails.bandWidth * BandCount * 0.5f;
+    auto view = nyan_camera_world_rect(cam);
+    view = { view.x - halfWidth, view.y - halfWidth, view.w + 2.0f * halfWidth, view.h + 2.0f * halfWidth };
+
+    // Pass 1: vertex and index counts per cat, zero for trails outside of the view.
+    trails.vertexStart.resize(catCount + 1);
+    trails.indexStart.resize(catCount + 1);
+
+    nyan_parallel_for(jobs, catCount, 1024, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto live = nyan_swarm_sprite_center(swarm, swarm.cats[i]);
+            const size_t n = trail_point_count(trails, i, live);
+            const bool hasLive = n && trail_has_live_point(trails, i, live);
+            float x0 = live.x, y0 = live.y, x1 = live.x, y1 = live.y;
+
+            for (size_t k=0; k<n; ++k)
+            {
+                const auto p = trail_point(trails, i, live, hasLive, k);
+                x0 = std::min(x0, p.x); x1 = std::max(x1, p.x);
+                y0 = std::min(y0, p.y); y1 = std::max(y1, p.y);
+            }
+
+            const bool visible = n >= 2 && x1 >= view.x && y1 >= view.y
+                && x0 <= view.x + view.w && y0 <= view.y + view.h;
+            // Two vertices per band and point, a quad per band between two points.
+            trails.vertexStart[i + 1] = visible ? n * BandCount * 2 : 0;
+            trails.indexStart[i + 1] = visible ? (n - 1) * BandCount * 6 : 0;
+        }
+    });
+
+    // Pass 2: prefix sums.
+    trails.vertexStart[0] = 0;
+    trails.indexStart[0] = 0;
+    size_t visibleTrails = 0;
+
+    for (size_t i=0; i<catCount; ++i)
+    {
+        visibleTrails += trails.vertexStart[i + 1] != 0;
+        trails.vertexStart[i + 1] += trails.vertexStart[i];
+        trails.indexStart[i + 1] += trails.indexStart[i];
+    }
+
+    // Trails grow until they are full and cats move in and out of view.
+    // Reserve room for the visible trails at full length plus some headroom,
+    // so the buffers settle instead of reallocating every few frames.
+    const size_t vertexCount = trails.vertexStart[catCount];
+    const size_t indexCount = trails.indexStart[catCount];
+    const size_t fullPoints = (visibleTrails + visibleTrails / 4) * (trails.capacity + 1);
+
+    if (vertexCount > trails.vertices.capacity())
+        trails.vertices.reserve(std::max(vertexCount, fullPoints * BandCount * 2));
+    if (indexCount > trails.indices.capacity())
+        trails.indices.reserve(std::max(indexCount, fullPoints * BandCount * 6));
+
+    trails.vertices.resize(vertexCount);
+    trails.indices.resize(indexCount);
+
+    // Pass 3: ribbon vertices. Each point gets a pair of vertices per band,
+    // offset along the normal of the path at that point.
+    nyan_parallel_for(jobs, catCount, 256, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const u32 first = trails.vertexStart[i];
+            const size_t n = (trails.vertexStart[i + 1] - first) / (BandCount * 2);
+
+            if (!n)
+                continue;
+
+            const auto live = nyan_swarm_sprite_center(swarm, swarm.cats[i]);
+            const bool hasLive = trail_has_live_point(trails, i, live);
+            SDL_Vertex *v = trails.vertices.data() + first;
+            int *idx = trails.indices.data() + trails.indexStart[i];
+
+            for (size_t k=0; k<n; ++k)
+            {
+                // Direction of travel from the neighbouring points, pointing at the cat.
+                const auto prev = trail_point(trails, i, live, hasLive, std::min(k + 1, n - 1));
+                const auto next = trail_point(trails, i, live, hasLive, k ? k - 1 : 0);
+                float dx = next.x - prev.x, dy = next.y - prev.y;
+                const float len = std::sqrt(dx * dx + dy * dy);
+                dx = len > 0.0f ? dx / len : 1.0f;
+                dy = len > 0.0f ? dy / len : 0.0f;
+
+                // Screen y points down, so (-dy, dx) is to the right of the
+                // direction of travel. Red ends up on the left side.
+                const auto p = nyan_camera_to_screen(cam, trail_point(trails, i, live, hasLive, k));
+                const float nx = -dy * cam.zoom, ny = dx * cam.zoom;
+                const float fade = 1.0f - static_cast<float>(k) / n;
+
+                for (int b=0; b<BandCount; ++b)
+                {
+                    const float o0 = -halfWidth + b * trails.bandWidth;
+                    const float o1 = o0 + trails.bandWidth;
+                    SDL_Color color = BandColors[b];
+                    color.a = static_cast<u8>(color.a * fade);
+
+                    v[0] = { { p.x + nx * o0, p.y + ny * o0 }, color, { 0.0f, 0.0f } };
+                    v[1] = { { p.x + nx * o1, p.y + ny * o1 }, color, { 0.0f, 0.0f } };
+
+                    if (k + 1 < n)
+                    {
+                        // Quad between this point and the next one, same band.
+                        const int a = static_cast<int>(v - trails.vertices.data());
+                        const int c = a + BandCount * 2;
+                        *idx++ = a; *idx++ = a + 1; *idx++ = c + 1;
+                        *idx++ = c + 1; *idx++ = c; *idx++ = a;
+                    }
+
+                    v += 2;
+                }
+            }
+        }
+    });
+
+    return vertexCount;
+}
+
+int nyan_trails_render(SDL_Renderer *renderer, const NyanTrails &trails)
+{
+    if (trails.vertices.empty())
+        return 0;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    return SDL_RenderGeometry(renderer, nullptr, trails.vertices.data(), static_cast<int>(trails.vertices.size()),
+                              trails.indices.data(), static_cast<int>(trails.indices.size()));
+}
+#else
+size_t nyan_trails_build_geometry(NyanTrails &, const NyanSwarm &, const NyanCamera &, NyanJobSystem *)
+{
+    return 0;
+}
+
+int nyan_trails_render(SDL_Renderer *, const NyanTrails &)
+{
+    return SDL_SetError("nyan_trails_render: SDL_RenderGeometry() needs SDL 2.0.18");
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef SRC_NYAN_TRAIL_H
+#define SRC_NYAN_TRAIL_H
+
+#include <SDL_render.h>
+#include <SDL_version.h>
+#include <vector>
+#include "nyan_jobs.h"
+#include "nyan_swarm.h"
+#include "nyan_types.h"
+
+// Rainbow trails for swarm cats, the six colored bands of nyan.js drawn as a
+// ribbon along the path each cat took. The recent positions of all cats live
+// in one pooled allocation, every cat owns a fixed size ring buffer in it.
+// Geometry for all trails is built in parallel and drawn with a single
+// SDL_RenderGeometry() call, which needs SDL 2.0.18 or newer.
+
+struct NyanTrails
+{
+    size_t capacity = 0;     // positions kept per cat
+    float spacing = 4.0f;    // world distance between recorded positions
+    float bandWidth = 3.0f;  // world units per color band, as in nyan.js
+
+    // Ring buffers: cat i owns points[i * capacity .. (i + 1) * capacity).
+    std::vector<SDL_FPoint> points;
+    std::vector<u32> heads;   // index of the newest point in each ring
+    std::vector<u32> counts;  // number of valid points in each ring
+
+    // Geometry scratch space, reused between frames.
+    std::vector<u32> vertexStart;
+    std::vector<u32> indexStart;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    std::vector<SDL_Vertex> vertices;
+#endif
+    std::vector<int> indices;
+};
+
+// Sets up empty trails of 'capacity' points for 'catCount' cats.
+void nyan_trails_reset(NyanTrails &trails, size_t catCount, size_t capacity);
+
+// World position the trail of 'cat' follows: the center of its rotated sprite.
+SDL_FPoint nyan_swarm_sprite_center(const NyanSwarm &swarm, const NyanCat &cat);
+
+// Records the current position of each cat that moved at least 'spacing'
+// since the last recorded one. Call once per swarm step.
+void nyan_trails_update(NyanTrails &trails, const NyanSwarm &swarm, NyanJobSystem *jobs = nullptr);
+
+// Builds screen space triangles for all trails overlapping the camera view.
+// Trails fade out towards their end. Returns the number of vertices.
+size_t nyan_trails_build_geometry(NyanTrails &trails, const NyanSwarm &swarm, const NyanCamera &cam,
+                                  NyanJobSystem *jobs = nullptr);
+
+// Draws the geometry of the last nyan_trails_build_geometry() call. Returns
+// 0 on success or -1 on error, see SDL_GetError().
+int nyan_trails_render(SDL_Renderer *renderer, const NyanTrails &trails);
+
+#endif // SRC_NYAN_TRAIL_H
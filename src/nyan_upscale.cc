@@ -0,0 +1,260 @@
+#include "nyan_upscale.h"
+
+#include <SDL_cpuinfo.h>
+#include <algorithm>
+#include "nyan_simd.h"
+
+static void nearest_row_scalar(const u32 *src, int width, int scale, int x, u32 *dst)
+{
+    for (; x<width; ++x)
+        std::fill_n(dst + x * scale, scale, src[x]);
+}
+
+#ifdef NYAN_X86_SIMD
+// Four source pixels per iteration, for the common scales 2, 3 and 4. Returns
+// the number of source pixels done.
+NYAN_TARGET("sse2")
+static int nearest_row_sse2(const u32 *src, int width, int scale, u32 *dst)
+{
+    int x = 0;
+
+    if (scale == 2)
+    {
+        for (; x+4<=width; x+=4)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 2), _mm_unpacklo_epi32(p, p));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 2 + 4), _mm_unpackhi_epi32(p, p));
+        }
+    }
+    else if (scale == 3)
+    {
+        // p0 p0 p0 p1 | p1 p1 p2 p2 | p2 p3 p3 p3
+        for (; x+4<=width; x+=4)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+            auto out = reinterpret_cast<__m128i *>(dst + x * 3);
+            _mm_storeu_si128(out + 0, _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+    }
+    else if (scale == 4)
+    {
+        for (; x+4<=width; x+=4)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+            auto out = reinterpret_cast<__m128i *>(dst + x * 4);
+            _mm_storeu_si128(out + 0, _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_storeu_si128(out + 3, _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+
+    return x;
+}
+#endif
+
+static NyanImage upscale_nearest(const NyanImage &src, int scale, NyanJobSystem *jobs)
+{
+    NyanImage result;
+    result.width = src.width * scale;
+    result.height = src.height * scale;
+    result.pixels.resize(static_cast<size_t>(result.width) * result.height);
+
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSE2 = SDL_HasSSE2();
+#endif
+
+    nyan_parallel_for(jobs, src.height, 16, [&] (size_t begin, size_t end)
+    {
+        for (size_t y=begin; y<end; ++y)
+        {
+            const u32 *in = src.pixels.data() + y * src.width;
+            u32 *out = result.pixels.data() + y * scale * result.width;
+            int x = 0;
+
+#ifdef NYAN_X86_SIMD
+            if (hasSSE2)
+                x = nearest_row_sse2(in, src.width, scale, out);
+#endif
+
+            nearest_row_scalar(in, src.width, scale, x, out);
+
+            // The other rows of the block are copies of the first.
+            for (int r=1; r<scale; ++r)
+                std::copy(out, out + result.width, out + r * result.width);
+        }
+    });
+
+    return result;
+}
+
+// Scale2x of pixels [x, end) of a frame row 'e' with the rows above ('b') and
+// below ('h'), clamped at the frame edges. Writes two output rows.
+static void scale2x_row_scalar(const u32 *b, const u32 *e, const u32 *h, int width, int x, int end,
+                               u32 *out0, u32 *out1)
+{
+    for (; x<end; ++x)
+    {
+        const u32 B = b[x], H = h[x], E = e[x];
+        const u32 D = e[std::max(x - 1, 0)];
+        const u32 F = e[std::min(x + 1, width - 1)];
+
+        out0[x * 2]     = D == B && B != F && D != H ? D : E;
+        out0[x * 2 + 1] = B == F && B != D && F != H ? F : E;
+        out1[x * 2]     = D == H && D != B && H != F ? D : E;
+        out1[x * 2 + 1] = H == F && H != D && B != F ? F : E;
+    }
+}
+
+#ifdef NYAN_X86_SIMD
+// Four pixels per iteration, starting at x = 1 where the left neighbor
+// needs no clamping and stopping before the last pixel. Returns the first
+// pixel not done.
+NYAN_TARGET("sse2")
+static int scale2x_row_sse2(const u32 *b, const u32 *e, const u32 *h, int width, u32 *out0, u32 *out1)
+{
+    int x = 1;
+
+    for (; x+4<width; x+=4)
+    {
+        const __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+        const __m128i D = _mm_loadu_si128(reinterpret_cast<const __m128i *>(e + x - 1));
+        const __m128i E = _mm_loadu_si128(reinterpret_cast<const __m128i *>(e + x));
+        const __m128i F = _mm_loadu_si128(reinterpret_cast<const __m128i *>(e + x + 1));
+        const __m128i H = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + x));
+
+        const __m128i eqDB = _mm_cmpeq_epi32(D, B);
+        const __m128i eqBF = _mm_cmpeq_epi32(B, F);
+        const __m128i eqDH = _mm_cmpeq_epi32(D, H);
+        const __m128i eqHF = _mm_cmpeq_epi32(H, F);
+
+        auto select = [] (__m128i mask, __m128i a, __m128i b)
+        {
+            return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+        };
+
+        const __m128i e0 = select(_mm_andnot_si128(_mm_or_si128(eqBF, eqDH), eqDB), D, E);
+        const __m128i e1 = select(_mm_andnot_si128(_mm_or_si128(eqDB, eqHF), eqBF), F, E);
+        const __m128i e2 = select(_mm_andnot_si128(_mm_or_si128(eqDB, eqHF), eqDH), D, E);
+        const __m128i e3 = select(_mm_andnot_si128(_mm_or_si128(eqDH, eqBF), eqHF), F, E);
+
+        auto row0 = reinterpret_cast<__m128i *>(out0 + x * 2);
+        auto row1 = reinterpret_cast<__m128i *>(out1 + x * 2);
+        _mm_storeu_si128(row0, _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128(row0 + 1, _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128(row1, _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128(row1 + 1, _mm_unpackhi_epi32(e2, e3));
+    }
+
+    return x;
+}
+#endif
+
+static void scale2x_row(const u32 *b, const u32 *e, const u32 *h, int width, u32 *out0, u32 *out1)
+{
+#ifdef NYAN_X86_SIMD
+    static const bool hasSSE2 = SDL_HasSSE2();
+
+    if (hasSSE2 && width > 1)
+    {
+        scale2x_row_scalar(b, e, h, width, 0, 1, out0, out1);
+        const int x = scale2x_row_sse2(b, e, h, width, out0, out1);
+        scale2x_row_scalar(b, e, h, width, x, width, out0, out1);
+        return;
+    }
+#endif
+
+    scale2x_row_scalar(b, e, h, width, 0, width, out0, out1);
+}
+
+// AdvMAME3x of a frame row, see scale2x_row_scalar(). Three output rows.
+static void scale3x_row(const u32 *b, const u32 *e, const u32 *h, int width, u32 *out0, u32 *out1, u32 *out2)
+{
+    for (int x=0; x<width; ++x)
+    {
+        const int l = std::max(x - 1, 0);
+        const int r = std::min(x + 1, width - 1);
+        const u32 A = b[l], B = b[x], C = b[r];
+        const u32 D = e[l], E = e[x], F = e[r];
+        const u32 G = h[l], H = h[x], I = h[r];
+
+        u32 *o0 = out0 + x * 3, *o1 = out1 + x * 3, *o2 = out2 + x * 3;
+        o0[0] = o0[1] = o0[2] = o1[0] = o1[1] = o1[2] = o2[0] = o2[1] = o2[2] = E;
+
+        if (B == H || D == F)
+            continue;
+
+        o0[0] = D == B ? D : E;
+        o0[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+        o0[2] = B == F ? F : E;
+        o1[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+        o1[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+        o2[0] = D == H ? D : E;
+        o2[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+        o2[2] = H == F ? F : E;
+    }
+}
+
+// One Scale2x or Scale3x pass over every frame of 'set'.
+static NyanImage upscale_frames(const NyanImage &src, const NyanSpriteSet &set, int factor, NyanJobSystem *jobs)
+{
+    NyanImage result;
+    result.width = src.width * factor;
+    result.height = src.height * factor;
+    result.pixels.resize(static_cast<size_t>(result.width) * result.height);
+
+    nyan_parallel_for(jobs, set.frameCount, 1, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto frame = nyan_sprite_set_rect(set, i);
+
+            for (int y=0; y<frame.h; ++y)
+            {
+                auto row = [&] (int fy) { return src.pixels.data() + (frame.y + fy) * src.width + frame.x; };
+                auto outRow = [&] (int k)
+                {
+                    return result.pixels.data() + ((frame.y + y) * factor + k) * result.width + frame.x * factor;
+                };
+
+                const u32 *b = row(std::max(y - 1, 0));
+                const u32 *e = row(y);
+                const u32 *h = row(std::min(y + 1, frame.h - 1));
+
+                if (factor == 2)
+                    scale2x_row(b, e, h, frame.w, outRow(0), outRow(1));
+                else
+                    scale3x_row(b, e, h, frame.w, outRow(0), outRow(1), outRow(2));
+            }
+        }
+    });
+
+    return result;
+}
+
+NyanImage nyan_upscale_sheet(const NyanImage &sheet, const NyanSpriteSet &set, int scale, NyanUpscaleFilter filter,
+                             NyanJobSystem *jobs)
+{
+    if (scale < 1)
+        return {};
+
+    if (filter == NyanUpscaleFilter::Nearest)
+        return scale == 1 ? sheet : upscale_nearest(sheet, scale, jobs);
+
+    NyanImage result = sheet;
+    NyanSpriteSet resultSet = set;
+
+    while (scale % 2 == 0 || scale % 3 == 0)
+    {
+        const int factor = scale % 2 == 0 ? 2 : 3;
+        result = upscale_frames(result, resultSet, factor, jobs);
+        resultSet.frameWidth *= factor;
+        resultSet.frameHeight *= factor;
+        scale /= factor;
+    }
+
+    return scale == 1 ? result : upscale_nearest(result, scale, jobs);
+}
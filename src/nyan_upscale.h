@@ -0,0 +1,29 @@
+#ifndef SRC_NYAN_UPSCALE_H
+#define SRC_NYAN_UPSCALE_H
+
+#include "nyan_jobs.h"
+#include "nyan_soft.h"
+#include "nyan_sprite_set.h"
+
+// Integer upscaling of sprite sheets, done once when a sheet is made so that
+// enlarged sprites are drawn 1:1 instead of being scaled every frame.
+
+enum class NyanUpscaleFilter : u8
+{
+    Nearest,  // every pixel becomes a scale x scale block
+    // Scale2x/Scale3x (EPX/AdvMAME) pixel art filters: diagonal edges are
+    // smoothed, colors are kept, nothing is blended. Scales are made of
+    // factors of 2 and 3, e.g. 4 is Scale2x twice; other factors fall back to
+    // nearest for the rest.
+    ScaleNx,
+};
+
+// Returns 'sheet' scaled up by 'scale'. ScaleNx works on each frame of 'set'
+// on its own, so neighboring frames do not bleed into each other, and runs
+// on the job system if given. Nearest at scales 2, 3 and 4 and Scale2x use
+// SSE2 if available.
+// Returns an empty image if 'scale' is less than 1.
+NyanImage nyan_upscale_sheet(const NyanImage &sheet, const NyanSpriteSet &set, int scale,
+                             NyanUpscaleFilter filter = NyanUpscaleFilter::Nearest, NyanJobSystem *jobs = nullptr);
+
+#endif // SRC_NYAN_UPSCALE_H
@@ -2,13 +2,32 @@
 
 #include <SDL.h>
 #include <SDL_render.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "log.h"
+#include "nyan_mip.h"
+#include "nyan_soft.h"
 #include "nyan_types.h"
 
+// stb_image allocations go to the arena of the current NyanDecodeScope, or
+// to the heap outside of one.
+static void *nyan_stbi_malloc(size_t size);
+static void *nyan_stbi_realloc(void *p, size_t oldSize, size_t newSize);
+static void nyan_stbi_free(void *p);
+
+#define STBI_MALLOC(size) nyan_stbi_malloc(size)
+#define STBI_REALLOC_SIZED(p, oldSize, newSize) nyan_stbi_realloc(p, oldSize, newSize)
+#define STBI_FREE(p) nyan_stbi_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -27,6 +46,185 @@ static void nyan_sdl_error(const char *const msg)
     log_error("%s: %s", msg, SDL_GetError());
 }
 
+// Bump allocator for one decode. Frees are no-ops, the arena is reset as a
+// whole. Allocations that do not fit go to the heap; the block is grown to
+// the high-water mark on reset so the next decode fits.
+struct NyanDecodeArena
+{
+    static const size_t Alignment = 16;
+
+    u8 *block = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t highWater = 0;   // including heap allocations
+    size_t heapBytes = 0;
+    void *last = nullptr;   // can grow in place
+
+    ~NyanDecodeArena() { std::free(block); }
+
+    bool owns(const void *p) const { return p >= block && p < block + capacity; }
+
+    void *alloc(size_t size)
+    {
+        size = (size + Alignment - 1) & ~(Alignment - 1);
+
+        if (used + size > capacity)
+        {
+            heapBytes += size;
+            highWater = std::max(highWater, used + heapBytes);
+            return std::malloc(size);
+        }
+
+        last = block + used;
+        used += size;
+        highWater = std::max(highWater, used + heapBytes);
+        return last;
+    }
+
+    void reset()
+    {
+        if (highWater > capacity)
+        {
+            std::free(block);
+            capacity = (highWater + 4095) & ~size_t(4095);
+            block = static_cast<u8 *>(std::malloc(capacity));
+        }
+
+        used = 0;
+        highWater = 0;
+        heapBytes = 0;
+        last = nullptr;
+    }
+};
+
+struct NyanDecodeArenaPool
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<NyanDecodeArena>> arenas;
+    std::vector<NyanDecodeArena *> free;
+    size_t arenaBytes = 0;
+    size_t peakBytes = 0;
+    std::atomic<u64> heapAllocations{0};
+};
+
+static NyanDecodeArenaPool nyan_decode_arenas;
+static thread_local NyanDecodeArena *nyan_current_arena = nullptr;
+
+// Routes the stb_image allocations of the calling thread to a pooled arena
+// while alive. Everything stb_image returns must be freed within the scope.
+class NyanDecodeScope
+{
+    public:
+        NyanDecodeScope()
+        {
+            auto &pool = nyan_decode_arenas;
+            std::lock_guard<std::mutex> lock(pool.mutex);
+
+            if (pool.free.empty())
+            {
+                pool.arenas.emplace_back(new NyanDecodeArena);
+                pool.free.push_back(pool.arenas.back().get());
+            }
+
+            arena = pool.free.back();
+            pool.free.pop_back();
+            nyan_current_arena = arena;
+        }
+
+        ~NyanDecodeScope()
+        {
+            auto &pool = nyan_decode_arenas;
+            nyan_current_arena = nullptr;
+
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.peakBytes = std::max(pool.peakBytes, arena->highWater);
+            pool.arenaBytes -= arena->capacity;
+            arena->reset();
+            pool.arenaBytes += arena->capacity;
+            pool.free.push_back(arena);
+        }
+
+        NyanDecodeScope(const NyanDecodeScope &) = delete;
+        NyanDecodeScope &operator=(const NyanDecodeScope &) = delete;
+
+    private:
+        NyanDecodeArena *arena;
+};
+
+static void *nyan_stbi_malloc(size_t size)
+{
+    if (auto arena = nyan_current_arena)
+    {
+        const size_t heapBytes = arena->heapBytes;
+        void *p = arena->alloc(size);
+
+        if (arena->heapBytes != heapBytes)
+            nyan_decode_arenas.heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        return p;
+    }
+
+    return std::malloc(size);
+}
+
+static void *nyan_stbi_realloc(void *p, size_t oldSize, size_t newSize)
+{
+    auto arena = nyan_current_arena;
+
+    if (!arena)
+        return std::realloc(p, newSize);
+
+    // Already moved to the heap.
+    if (p && !arena->owns(p))
+    {
+        arena->heapBytes += newSize - std::min(oldSize, newSize);
+        arena->highWater = std::max(arena->highWater, arena->used + arena->heapBytes);
+        return std::realloc(p, newSize);
+    }
+
+    // The zlib output buffer keeps growing, usually as the newest allocation.
+    if (p && p == arena->last)
+    {
+        const size_t offset = static_cast<u8 *>(p) - arena->block;
+        const size_t size = (newSize + NyanDecodeArena::Alignment - 1) & ~(NyanDecodeArena::Alignment - 1);
+
+        if (offset + size <= arena->capacity)
+        {
+            arena->used = offset + size;
+            arena->highWater = std::max(arena->highWater, arena->used + arena->heapBytes);
+            return p;
+        }
+    }
+
+    void *result = nyan_stbi_malloc(newSize);
+
+    if (result && p)
+        std::memcpy(result, p, std::min(oldSize, newSize));
+
+    return result;
+}
+
+static void nyan_stbi_free(void *p)
+{
+    auto arena = nyan_current_arena;
+
+    if (!arena || !arena->owns(p))
+        std::free(p);
+}
+
+NyanDecodeStats nyan_decode_stats()
+{
+    auto &pool = nyan_decode_arenas;
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    NyanDecodeStats stats;
+    stats.peakBytes = pool.peakBytes;
+    stats.arenaBytes = pool.arenaBytes;
+    stats.arenaCount = pool.arenas.size();
+    stats.heapAllocations = pool.heapAllocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
 template<size_t Size>
 [[maybe_unused]] const char *aprintf(std::array<char, Size> &buf, const char *fmt, ...)
 {
@@ -55,6 +253,7 @@ static SDL_Texture *make_nyan_sprite_sheet_from_files(SDL_Renderer *renderer, co
     {
         auto filename = aprintf(strBuf, "%s/%c%zu.png", NYAN_PATH, dir, i+1);
         log_trace("make_nyan_sprite_sheet_from_files: loading %s", filename);
+        NyanDecodeScope scope;
         int w = 0, h = 0, bytes_per_pixel = 0;
         u8 *data = stbi_load(filename, &w, &h, &bytes_per_pixel, 0);
         assert(w == NYAN_SPRITE_WIDTH && h == NYAN_SPRITE_HEIGHT && bytes_per_pixel == NYAN_BBP);
@@ -67,36 +266,312 @@ static SDL_Texture *make_nyan_sprite_sheet_from_files(SDL_Renderer *renderer, co
     return result;
 }
 
-SDL_Texture *make_nyan_sprite_sheet_from_mem(SDL_Renderer *renderer)
+static const uint8_t *const nyan_data_ptrs[] = { r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, nullptr };
+
+static const size_t nyan_data_sizes[] = {
+        sizeof(r1), sizeof(r2), sizeof(r3), sizeof(r4), sizeof(r5), sizeof(r6),
+        sizeof(r7), sizeof(r8), sizeof(r9), sizeof(r10), sizeof(r11), sizeof(r12)
+};
+
+// Trim rects of the built-in sprites, filled in by the first decode.
+static NyanSpriteTrim nyan_builtin_trims[NYAN_SPRITE_COUNT];
+static std::once_flag nyan_builtin_trims_once;
+static std::atomic<bool> nyan_builtin_trims_ready;
+
+NyanImage nyan_decode_sprite_set(const NyanSpriteSet &set, const u8 *const *frameData, const size_t *frameSizes,
+                                 NyanJobSystem *jobs)
 {
-    static const uint8_t *const data_ptrs[] = { r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, nullptr };
+    if (set.frameCount <= 0 || set.columns <= 0 || set.frameWidth <= 0 || set.frameHeight <= 0)
+    {
+        log_error("nyan_decode_sprite_set: invalid sprite set");
+        return {};
+    }
 
-    static const size_t data_sizes[] = {
-            sizeof(r1), sizeof(r2), sizeof(r3), sizeof(r4), sizeof(r5), sizeof(r6),
-            sizeof(r7), sizeof(r8), sizeof(r9), sizeof(r10), sizeof(r11), sizeof(r12)
-    };
+    const auto sheetRect = nyan_sprite_set_sheet_rect(set);
 
-    static const auto textureRect = nyan_sheet_rect();
+    NyanImage result;
+    result.width = sheetRect.w;
+    result.height = sheetRect.h;
+    result.pixels.resize(static_cast<size_t>(result.width) * result.height);
+    std::atomic<bool> ok(true);
+
+    // Each sprite goes into its own part of the sheet, so decoding can run in parallel.
+    nyan_parallel_for(jobs, set.frameCount, 1, [&] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            log_trace("nyan_decode_sprite_set: loading data %zu", i);
+            NyanDecodeScope scope;
+            int w = 0, h = 0, bytes_per_pixel = 0;
+            u8 *data = stbi_load_from_memory(frameData[i], static_cast<int>(frameSizes[i]), &w, &h,
+                                             &bytes_per_pixel, NYAN_BBP);
+
+            if (!data || w != set.frameWidth || h != set.frameHeight)
+            {
+                log_error("nyan_decode_sprite_set: frame %zu: %s", i,
+                          data ? "unexpected size" : stbi_failure_reason());
+                ok = false;
+                STBI_FREE(data);
+                continue;
+            }
+
+            const auto destRect = nyan_sprite_set_rect(set, i);
+            for (int y=0; y<destRect.h; ++y)
+                std::memcpy(&result.pixels[(destRect.y + y) * result.width + destRect.x],
+                            data + y * NYAN_BBP * set.frameWidth, NYAN_BBP * set.frameWidth);
+            STBI_FREE(data);
+        }
+    });
+
+    return ok ? result : NyanImage{};
+}
+
+NyanImage nyan_decode_sprite_sheet(NyanJobSystem *jobs)
+{
+    auto result = nyan_decode_sprite_set(NyanBuiltinSprites::Set, nyan_data_ptrs, nyan_data_sizes, jobs);
+    assert(!result.pixels.empty());
+
+    std::call_once(nyan_builtin_trims_once, [&result]
+    {
+        nyan_compute_sprite_trims(result, NyanBuiltinSprites::Set, nyan_builtin_trims);
+        nyan_builtin_trims_ready.store(true, std::memory_order_release);
+    });
+
+    return result;
+}
+
+SDL_Texture *nyan_make_sheet_texture(SDL_Renderer *renderer, const NyanImage &sheet)
+{
     auto result = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
-                                    textureRect.w, textureRect.h);
+                                    sheet.width, sheet.height);
 
     if (!result)
-        nyan_sdl_fatal("make_nyan_sprite_sheet_from_mem/SDL_CreateTexture");
-
-    if (SDL_SetTextureBlendMode(result, SDL_BLENDMODE_BLEND))
-        nyan_sdl_fatal("make_nyan_sprite_sheet_from_mem/SDL_SetTextureBlendMode");
+    {
+        nyan_sdl_error("nyan_make_sheet_texture/SDL_CreateTexture");
+        return nullptr;
+    }
 
-    for (size_t i=0; data_ptrs[i]; ++i)
+    if (SDL_SetTextureBlendMode(result, SDL_BLENDMODE_BLEND)
+        || SDL_UpdateTexture(result, nullptr, sheet.pixels.data(), NYAN_BBP * sheet.width))
     {
-        log_trace("make_nyan_sprite_sheet_from_mem: loading data %zu", i);
-        int w = 0, h = 0, bytes_per_pixel = 0;
-        u8 *data = stbi_load_from_memory(data_ptrs[i], data_sizes[i], &w, &h, &bytes_per_pixel, 0);
-        assert(w == NYAN_SPRITE_WIDTH && h == NYAN_SPRITE_HEIGHT && bytes_per_pixel == NYAN_BBP);
-        auto destRect = nyan_sprite_rect(i);
-        if (SDL_UpdateTexture(result, &destRect, data, NYAN_BBP * NYAN_SPRITE_WIDTH))
-            nyan_sdl_fatal("make_nyan_sprite_sheet_from_mem/SDL_UpdateTexture");
-        STBI_FREE(data);
+        nyan_sdl_error("nyan_make_sheet_texture");
+        SDL_DestroyTexture(result);
+        return nullptr;
     }
 
     return result;
 }
+
+SDL_Texture *make_nyan_sprite_sheet_from_mem(SDL_Renderer *renderer)
+{
+    auto result = nyan_make_sheet_texture(renderer, nyan_decode_sprite_sheet());
+
+    if (!result)
+        nyan_sdl_fatal("make_nyan_sprite_sheet_from_mem");
+
+    return result;
+}
+
+NyanSpriteTrim nyan_sprite_trim(size_t index)
+{
+    if (!nyan_builtin_trims_ready.load(std::memory_order_acquire))
+        nyan_decode_sprite_sheet();
+
+    return nyan_builtin_trims[index % NYAN_SPRITE_COUNT];
+}
+
+NyanDrawCmd nyan_trim_draw_cmd(const NyanDrawCmd *cmd, const NyanSpriteTrim *trim)
+{
+    const float scaleX = cmd->dst.w / cmd->src.w;
+    const float scaleY = cmd->dst.h / cmd->src.h;
+    const float offsetX = trim->offset.x * scaleX;
+    const float offsetY = trim->offset.y * scaleY;
+
+    NyanDrawCmd result;
+    result.src = trim->src;
+    result.dst = { cmd->dst.x + offsetX, cmd->dst.y + offsetY, trim->src.w * scaleX, trim->src.h * scaleY };
+    result.center = { cmd->center.x - offsetX, cmd->center.y - offsetY };
+    result.angle = cmd->angle;
+    result.color = cmd->color;
+    return result;
+}
+
+static bool same_color(const SDL_Color &a, const SDL_Color &b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static void set_texture_color(SDL_Texture *texture, const SDL_Color &color)
+{
+    SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+    SDL_SetTextureAlphaMod(texture, color.a);
+}
+
+// 'srcRect' maps the source rect of a command into 'texture'.
+template<typename SrcRect>
+static void render_draw_cmds(SDL_Renderer *renderer, SDL_Texture *texture, const NyanDrawCmd *cmds, size_t count,
+                             SrcRect srcRect)
+{
+    const SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Color current = white;
+
+    for (size_t i=0; i<count; ++i)
+    {
+        const auto &cmd = cmds[i];
+
+        if (!same_color(cmd.color, current))
+        {
+            set_texture_color(texture, cmd.color);
+            current = cmd.color;
+        }
+
+        const SDL_Rect src = srcRect(cmd);
+        SDL_RenderCopyExF(renderer, texture, &src, &cmd.dst, cmd.angle, &cmd.center, SDL_FLIP_NONE);
+    }
+
+    if (!same_color(current, white))
+        set_texture_color(texture, white);
+}
+
+void nyan_render_draw_cmds(SDL_Renderer *renderer, SDL_Texture *nyanSheet, const NyanDrawCmd *cmds, size_t count)
+{
+    render_draw_cmds(renderer, nyanSheet, cmds, count, [] (const NyanDrawCmd &cmd) { return cmd.src; });
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+struct NyanGeometryBatch
+{
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+
+NyanGeometryBatch *nyan_geometry_batch_create(void)
+{
+    return new NyanGeometryBatch;
+}
+
+void nyan_geometry_batch_destroy(NyanGeometryBatch *batch)
+{
+    delete batch;
+}
+
+// Fills the batch with one quad per command and submits it. 'srcRect'
+// returns the texel rect a command samples from.
+template<typename SrcRect>
+static int render_geometry(SDL_Renderer *renderer, SDL_Texture *texture, NyanGeometryBatch *batch,
+                           const NyanDrawCmd *cmds, size_t count, SrcRect srcRect)
+{
+    int texWidth = 0, texHeight = 0;
+
+    if (SDL_QueryTexture(texture, nullptr, nullptr, &texWidth, &texHeight))
+        return -1;
+
+    const float invW = 1.0f / texWidth;
+    const float invH = 1.0f / texHeight;
+    const float deg2rad = 3.14159265358979323846f / 180.0f;
+
+    // Grows with headroom, the number of visible cats changes from frame to frame.
+    if (count * 4 > batch->vertices.capacity())
+    {
+        batch->vertices.reserve((count + count / 4) * 4);
+        batch->indices.reserve((count + count / 4) * 6);
+    }
+
+    batch->vertices.resize(count * 4);
+
+    // Two triangles per quad, only regenerated when the batch grows.
+    const size_t oldQuads = batch->indices.size() / 6;
+
+    for (size_t q=oldQuads; q<count; ++q)
+    {
+        const int v = static_cast<int>(q * 4);
+        batch->indices.insert(batch->indices.end(), { v, v + 1, v + 2, v + 2, v + 3, v });
+    }
+
+    for (size_t i=0; i<count; ++i)
+    {
+        const auto &cmd = cmds[i];
+        const SDL_FRect src = srcRect(cmd);
+        const float c = std::cos(cmd.angle * deg2rad);
+        const float s = std::sin(cmd.angle * deg2rad);
+        const float px = cmd.dst.x + cmd.center.x;
+        const float py = cmd.dst.y + cmd.center.y;
+        const float u0 = src.x * invW, u1 = (src.x + src.w) * invW;
+        const float v0 = src.y * invH, v1 = (src.y + src.h) * invH;
+
+        // Corners relative to the rotation center, clockwise from top-left.
+        const float xs[4] = { -cmd.center.x, cmd.dst.w - cmd.center.x, cmd.dst.w - cmd.center.x, -cmd.center.x };
+        const float ys[4] = { -cmd.center.y, -cmd.center.y, cmd.dst.h - cmd.center.y, cmd.dst.h - cmd.center.y };
+        const float us[4] = { u0, u1, u1, u0 };
+        const float vs[4] = { v0, v0, v1, v1 };
+
+        auto vertex = batch->vertices.data() + i * 4;
+
+        for (int k=0; k<4; ++k)
+        {
+            vertex[k].position = { px + xs[k] * c - ys[k] * s, py + xs[k] * s + ys[k] * c };
+            vertex[k].color = cmd.color;
+            vertex[k].tex_coord = { us[k], vs[k] };
+        }
+    }
+
+    return SDL_RenderGeometry(renderer, texture, batch->vertices.data(), static_cast<int>(count * 4),
+                              batch->indices.data(), static_cast<int>(count * 6));
+}
+
+int nyan_render_geometry(SDL_Renderer *renderer, SDL_Texture *nyanSheet, NyanGeometryBatch *batch,
+                         const NyanDrawCmd *cmds, size_t count)
+{
+    auto srcRect = [] (const NyanDrawCmd &cmd) -> SDL_FRect
+    {
+        return { static_cast<float>(cmd.src.x), static_cast<float>(cmd.src.y),
+                 static_cast<float>(cmd.src.w), static_cast<float>(cmd.src.h) };
+    };
+
+    return render_geometry(renderer, nyanSheet, batch, cmds, count, srcRect);
+}
+
+int nyan_render_geometry_mipmapped(SDL_Renderer *renderer, SDL_Texture *atlasTexture, const NyanMipChain &chain,
+                                   NyanGeometryBatch *batch, const NyanDrawCmd *cmds, size_t count)
+{
+    auto srcRect = [&chain] (const NyanDrawCmd &cmd)
+    {
+        return nyan_mip_src_rect(chain, cmd.src, nyan_mip_select_level(chain, cmd));
+    };
+
+    return render_geometry(renderer, atlasTexture, batch, cmds, count, srcRect);
+}
+#else
+struct NyanGeometryBatch {};
+
+NyanGeometryBatch *nyan_geometry_batch_create(void)
+{
+    return new NyanGeometryBatch;
+}
+
+void nyan_geometry_batch_destroy(NyanGeometryBatch *batch)
+{
+    delete batch;
+}
+
+int nyan_render_geometry(SDL_Renderer *renderer, SDL_Texture *nyanSheet, NyanGeometryBatch *,
+                         const NyanDrawCmd *cmds, size_t count)
+{
+    nyan_render_draw_cmds(renderer, nyanSheet, cmds, count);
+    return 0;
+}
+
+// Without SDL_RenderGeometry() every command samples level 0 of the atlas.
+int nyan_render_geometry_mipmapped(SDL_Renderer *renderer, SDL_Texture *atlasTexture, const NyanMipChain &chain,
+                                   NyanGeometryBatch *, const NyanDrawCmd *cmds, size_t count)
+{
+    auto srcRect = [&chain] (const NyanDrawCmd &cmd)
+    {
+        const SDL_FRect src = nyan_mip_src_rect(chain, cmd.src, 0);
+        return SDL_Rect { static_cast<int>(src.x), static_cast<int>(src.y), cmd.src.w, cmd.src.h };
+    };
+
+    render_draw_cmds(renderer, atlasTexture, cmds, count, srcRect);
+    return 0;
+}
+#endif
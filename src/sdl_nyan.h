@@ -2,28 +2,84 @@
 #define SRC_SDL_NYAN_H
 
 #include <SDL_render.h>
-
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include "nyan_sprite_set.h"
 
 #define NYAN_SPRITE_COUNT 12u
 #define NYAN_SPRITE_WIDTH 36u
 #define NYAN_SPRITE_HEIGHT 26u
 #define NYAN_BBP 4u
 
+// The built-in sprites, see nyan_sprite_set.h.
+using NyanBuiltinSprites = NyanSpriteSetTraits<NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT, NYAN_SPRITE_COUNT>;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 SDL_Texture *make_nyan_sprite_sheet_from_mem(SDL_Renderer *renderer);
 
-static SDL_Rect nyan_sprite_rect(size_t index)
+// Frame 'index' of the built-in sheet. Indices wrap around, as for
+// nyan_sprite_trim().
+static constexpr SDL_Rect nyan_sprite_rect(size_t index)
 {
-    return SDL_Rect{ static_cast<int>(NYAN_SPRITE_WIDTH * index), 0, NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT};
+    return NyanBuiltinSprites::rect(index);
 }
 
 static constexpr SDL_Rect nyan_sheet_rect()
 {
-    return { 0, 0, NYAN_SPRITE_COUNT * NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT };
+    return NyanBuiltinSprites::SheetRect;
 }
 
+// Tight bounding box of the non-transparent pixels of a sprite. 'src' is the
+// trimmed rect inside the sheet, 'offset' its position relative to the
+// top-left corner of the untrimmed nyan_sprite_rect().
+typedef struct NyanSpriteTrim
+{
+    SDL_Rect src;
+    SDL_Point offset;
+} NyanSpriteTrim;
+
+// Trim rects of the built-in sprites. Computed once when the sprites are
+// first decoded. Indices wrap around.
+NyanSpriteTrim nyan_sprite_trim(size_t index);
+
+// One sprite draw with the same semantics as SDL_RenderCopyExF(): 'src' is
+// scaled to 'dst' and rotated by 'angle' degrees clockwise around 'center'
+// which is relative to the top-left corner of 'dst'. 'color' modulates the
+// sprite like SDL_SetTextureColorMod() and SDL_SetTextureAlphaMod().
+typedef struct NyanDrawCmd
+{
+    SDL_Rect src;
+    SDL_FRect dst;
+    SDL_FPoint center;
+    float angle;
+    SDL_Color color = { 255, 255, 255, 255 };
+} NyanDrawCmd;
+
+// Replaces the full sprite rect used by 'cmd' with the trimmed one. The
+// destination is shrunk accordingly and the rotation center adjusted, so the
+// visible result does not change.
+NyanDrawCmd nyan_trim_draw_cmd(const NyanDrawCmd *cmd, const NyanSpriteTrim *trim);
+
+// Submits the draw commands in order using SDL_RenderCopyExF(). The texture
+// color and alpha mod is changed whenever the command color changes and
+// reset afterwards.
+void nyan_render_draw_cmds(SDL_Renderer *renderer, SDL_Texture *nyanSheet, const NyanDrawCmd *cmds, size_t count);
+
+// Vertex and index scratch buffers for nyan_render_geometry(). Reuse one
+// between frames to avoid allocations.
+typedef struct NyanGeometryBatch NyanGeometryBatch;
+
+NyanGeometryBatch *nyan_geometry_batch_create(void);
+void nyan_geometry_batch_destroy(NyanGeometryBatch *batch);
+
+// Submits all draw commands with a single SDL_RenderGeometry() call. The
+// command colors become vertex colors, so differently tinted sprites still
+// batch. Falls back to nyan_render_draw_cmds() if SDL is older than 2.0.18.
+// Returns 0 on success or -1 on error, see SDL_GetError().
+int nyan_render_geometry(SDL_Renderer *renderer, SDL_Texture *nyanSheet, NyanGeometryBatch *batch,
+                         const NyanDrawCmd *cmds, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
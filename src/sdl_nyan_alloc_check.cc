@@ -0,0 +1,397 @@
+#include "log.h"
+#include "nyan_args.h"
+#include "nyan_jobs.h"
+#include "nyan_soft.h"
+#include "nyan_swarm.h"
+#include "nyan_trail.h"
+#include "nyan_types.h"
+#include <sdl_nyan.h>
+#include <SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+// Checks that the swarm frame loop (simulate, build draw commands, rasterize
+// or submit, present) does not allocate once it is warmed up. Every heap
+// allocation of the process is counted: on glibc malloc() and friends are
+// interposed, which also catches operator new and SDL. Elsewhere operator
+// new is replaced and SDL's allocator hooked. Exits with 1 if any allocation
+// happens after the warmup frames.
+
+struct AllocCounter
+{
+    std::atomic<bool> armed{false};
+    std::atomic<u64> count{0};
+    std::atomic<u64> bytes{0};
+    bool backtraces = false;
+    std::atomic<int> tracesLeft{3};
+};
+
+static AllocCounter alloc_counter;
+
+static void count_allocation(size_t size)
+{
+    auto &c = alloc_counter;
+
+    if (!c.armed.load(std::memory_order_relaxed))
+        return;
+
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+
+#ifdef __GLIBC__
+    // backtrace() does not allocate once libgcc is loaded, see main().
+    static thread_local bool inTrace = false;
+
+    if (c.backtraces && !inTrace && c.tracesLeft.fetch_sub(1) > 0)
+    {
+        inTrace = true;
+        void *frames[32];
+        const int n = backtrace(frames, 32);
+        static const char header[] = "allocation after warmup:\n";
+        [[maybe_unused]] auto written = write(2, header, sizeof(header) - 1);
+        backtrace_symbols_fd(frames, n, 2);
+        inTrace = false;
+    }
+#endif
+}
+
+#ifdef __GLIBC__
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *p, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *p);
+
+    void *malloc(size_t size)
+    {
+        count_allocation(size);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        count_allocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *p, size_t size)
+    {
+        count_allocation(size);
+        return __libc_realloc(p, size);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **p, size_t alignment, size_t size)
+    {
+        count_allocation(size);
+        *p = __libc_memalign(alignment, size);
+        return *p ? 0 : ENOMEM;
+    }
+
+    void free(void *p)
+    {
+        __libc_free(p);
+    }
+}
+#else
+void *operator new(size_t size)
+{
+    count_allocation(size);
+
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+static void *SDLCALL sdl_malloc(size_t size)
+{
+    count_allocation(size);
+    return std::malloc(size);
+}
+
+static void *SDLCALL sdl_calloc(size_t count, size_t size)
+{
+    count_allocation(count * size);
+    return std::calloc(count, size);
+}
+
+static void *SDLCALL sdl_realloc(void *p, size_t size)
+{
+    count_allocation(size);
+    return std::realloc(p, size);
+}
+
+static void SDLCALL sdl_free(void *p)
+{
+    std::free(p);
+}
+#endif
+
+static void nyan_sdl_fatal(const char *const msg)
+{
+    log_fatal("%s: %s", msg, SDL_GetError());
+    abort();
+}
+
+struct CheckOptions
+{
+    std::string backend = "tiles";
+    size_t nyanCount = 10000;
+    int frames = 300;
+    int warmup = 30;
+    int width = 1280;
+    int height = 720;
+    unsigned threadCount = 0;
+    size_t trailLength = 0;
+    bool variedLooks = false;
+    bool backtraces = false;
+};
+
+// The demo's swarm scene without a window.
+struct CheckScene
+{
+    NyanJobSystem *jobs = nullptr;
+    NyanSwarm swarm;
+    NyanGrid grid;
+    NyanCamera camera;
+    NyanTrails trails;
+    std::vector<u32> visible;
+    std::vector<NyanDrawCmd> cmds;
+};
+
+static void step_scene(CheckScene &scene, const CheckOptions &opts, int frame)
+{
+    const float dt = 1.0f / 60.0f;
+    nyan_swarm_step(scene.swarm, dt, scene.jobs);
+
+    if (opts.trailLength)
+        nyan_trails_update(scene.trails, scene.swarm, scene.jobs);
+
+    nyan_grid_build(scene.grid, scene.swarm.world, 64.0f, scene.swarm.cats.data(), scene.swarm.cats.size());
+    nyan_swarm_cull(scene.swarm, scene.grid, scene.camera, scene.visible);
+    nyan_swarm_draw_cmds(scene.swarm, scene.camera, scene.visible, frame * dt * 1000.0f / 48.0f, scene.cmds,
+                         scene.jobs);
+
+    if (opts.trailLength)
+        nyan_trails_build_geometry(scene.trails, scene.swarm, scene.camera, scene.jobs);
+}
+
+int main(int argc, char *argv[])
+{
+    log_set_level(LOG_INFO);
+
+    CheckOptions opts;
+
+    for (int i=1; i<argc; ++i)
+    {
+        auto arg_is = [&] (const char *name) { return std::strcmp(argv[i], name) == 0 && i+1 < argc; };
+
+        if (arg_is("--backend"))
+            opts.backend = argv[++i];
+        else if (arg_is("--cats") && nyan_parse_arg(argv[i+1], opts.nyanCount))
+            ++i;
+        else if (arg_is("--frames") && nyan_parse_arg(argv[i+1], opts.frames, 1))
+            ++i;
+        else if (arg_is("--warmup") && nyan_parse_arg(argv[i+1], opts.warmup, 1))
+            ++i;
+        else if (arg_is("--width") && nyan_parse_arg(argv[i+1], opts.width))
+            ++i;
+        else if (arg_is("--height") && nyan_parse_arg(argv[i+1], opts.height))
+            ++i;
+        else if (arg_is("--threads") && nyan_parse_arg(argv[i+1], opts.threadCount))
+            ++i;
+        else if (arg_is("--trails") && nyan_parse_arg(argv[i+1], opts.trailLength))
+            ++i;
+        else if (std::strcmp(argv[i], "--varied") == 0)
+            opts.variedLooks = true;
+        else if (std::strcmp(argv[i], "--backtraces") == 0)
+            opts.backtraces = true;
+        else
+        {
+            log_error("Usage: %s [--backend tiles|sdl] [--cats <count>] [--frames <count>] [--warmup <count>]"
+                      " [--width <px>] [--height <px>] [--threads <count>] [--trails <length>] [--varied]"
+                      " [--backtraces]", argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.warmup >= opts.frames)
+    {
+        log_error("--warmup %d leaves none of the %d frames to check", opts.warmup, opts.frames);
+        return 1;
+    }
+
+#ifdef __GLIBC__
+    // Loads libgcc now, backtrace() would allocate on first use.
+    if (opts.backtraces)
+    {
+        void *frames[1];
+        backtrace(frames, 1);
+    }
+#else
+    if (SDL_SetMemoryFunctions(sdl_malloc, sdl_calloc, sdl_realloc, sdl_free))
+        nyan_sdl_fatal("SDL_SetMemoryFunctions");
+#endif
+
+    if (SDL_Init(SDL_INIT_TIMER))
+        nyan_sdl_fatal("SDL_Init");
+
+    const bool useSdl = opts.backend == "sdl";
+
+    CheckScene scene;
+    scene.jobs = nyan_jobs_create(opts.threadCount);
+
+    // Same world and camera as the demo's swarm scene.
+    const float side = std::max(2048.0f, std::sqrt(static_cast<float>(opts.nyanCount)) * 48.0f);
+    nyan_swarm_populate(scene.swarm, opts.nyanCount, { 0.0f, 0.0f, side, side });
+    if (opts.variedLooks)
+        nyan_swarm_vary_looks(scene.swarm);
+    scene.camera.center = { side * 0.5f, side * 0.5f };
+    scene.camera.viewWidth = opts.width;
+    scene.camera.viewHeight = opts.height;
+    nyan_trails_reset(scene.trails, opts.trailLength ? opts.nyanCount : 0, opts.trailLength);
+
+    // Software rasterizer: renders into 'frame'.
+    NyanTileRasterizer *rast = nullptr;
+    NyanImage sheet, frame;
+
+    // SDL: the software renderer drawing into 'surface'.
+    SDL_Surface *surface = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *nyanSheet = nullptr;
+    NyanGeometryBatch *batch = nullptr;
+
+    if (useSdl)
+    {
+        surface = SDL_CreateRGBSurfaceWithFormat(0, opts.width, opts.height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface)
+            nyan_sdl_fatal("SDL_CreateRGBSurfaceWithFormat");
+        renderer = SDL_CreateSoftwareRenderer(surface);
+        if (!renderer)
+            nyan_sdl_fatal("SDL_CreateSoftwareRenderer");
+        nyanSheet = make_nyan_sprite_sheet_from_mem(renderer);
+        batch = nyan_geometry_batch_create();
+    }
+    else
+    {
+        rast = nyan_tile_rasterizer_create(scene.jobs);
+        sheet = nyan_decode_sprite_sheet(scene.jobs);
+        frame.width = opts.width;
+        frame.height = opts.height;
+        frame.pixels.resize(static_cast<size_t>(opts.width) * opts.height);
+    }
+
+    // Per frame allocation counts, sized up front.
+    std::vector<u64> frameAllocs(opts.frames, 0);
+    alloc_counter.backtraces = opts.backtraces;
+
+    for (int i=0; i<opts.frames; ++i)
+    {
+        // Counting starts with the first frame after the warmup.
+        if (i == opts.warmup)
+            alloc_counter.armed.store(true);
+
+        const u64 before = alloc_counter.count.load();
+        step_scene(scene, opts, i);
+
+        if (useSdl)
+        {
+            SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+            SDL_RenderClear(renderer);
+
+            if (opts.trailLength && nyan_trails_render(renderer, scene.trails))
+                nyan_sdl_fatal("nyan_trails_render");
+
+            if (nyan_render_geometry(renderer, nyanSheet, batch, scene.cmds.data(), scene.cmds.size()))
+                nyan_sdl_fatal("nyan_render_geometry");
+
+            SDL_RenderPresent(renderer);
+        }
+        else
+        {
+            nyan_tile_rasterize(rast, nyan_framebuffer(frame), sheet, scene.cmds.data(), scene.cmds.size(),
+                                0xff808080u);
+        }
+
+        frameAllocs[i] = alloc_counter.count.load() - before;
+    }
+
+    alloc_counter.armed.store(false);
+
+    const u64 count = alloc_counter.count.load();
+    const u64 bytes = alloc_counter.bytes.load();
+    int badFrames = 0;
+
+    for (int i=opts.warmup; i<opts.frames; ++i)
+    {
+        if (frameAllocs[i] && badFrames++ < 10)
+            log_error("frame %d: %llu allocations", i, static_cast<unsigned long long>(frameAllocs[i]));
+    }
+
+    log_info("%s, %zu cats, %d frames after %d warmup frames: %llu allocations, %llu bytes, %d frames allocated",
+             opts.backend.c_str(), opts.nyanCount, opts.frames - opts.warmup, opts.warmup,
+             static_cast<unsigned long long>(count), static_cast<unsigned long long>(bytes), badFrames);
+
+    nyan_geometry_batch_destroy(batch);
+    SDL_DestroyTexture(nyanSheet);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+    nyan_tile_rasterizer_destroy(rast);
+    nyan_jobs_destroy(scene.jobs);
+    SDL_Quit();
+
+    return count ? 1 : 0;
+}
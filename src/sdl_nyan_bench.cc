@@ -0,0 +1,714 @@
+#include "log.h"
+#include "nyan_args.h"
+#include "nyan_audio.h"
+#include "nyan_gl.h"
+#include "nyan_jobs.h"
+#include "nyan_soft.h"
+#include "nyan_swarm.h"
+#include "nyan_trail.h"
+#include "nyan_types.h"
+#include <sdl_nyan.h>
+#include <SDL.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// Headless benchmarks. Nothing in here needs a window or a display, the SDL
+// path uses SDL's software renderer on an offscreen surface. The exception is
+// the OpenGL backend, it needs a display or SDL_VIDEODRIVER=offscreen and is
+// skipped without one.
+
+static void nyan_sdl_fatal(const char *const msg)
+{
+    log_fatal("%s: %s", msg, SDL_GetError());
+    abort();
+}
+
+struct BenchOptions
+{
+    std::string bench = "swarm";
+    std::string backend = "all";
+    size_t nyanCount = 10000;
+    int frames = 100;
+    int width = 1280;
+    int height = 960;
+    unsigned threadCount = 0;
+    int tileSize = 64;
+    float zoom = 1.0f;
+    bool trimSprites = true;
+    bool indexedSheet = false;
+    bool variedLooks = false;
+    size_t trailLength = 0;
+    bool fillStats = false;
+    std::string heatmapFile;
+    size_t voiceCount = 256;
+};
+
+struct BenchScene
+{
+    NyanSwarm swarm;
+    NyanGrid grid;
+    NyanCamera camera;
+    std::vector<u32> visible;
+    std::vector<NyanDrawCmd> cmds;
+};
+
+static double seconds_since(u64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// The world is sized so that the whole swarm is visible at the given zoom.
+static void init_bench_scene(BenchScene &scene, const BenchOptions &opts)
+{
+    const float w = opts.width / opts.zoom;
+    const float h = opts.height / opts.zoom;
+    nyan_swarm_populate(scene.swarm, opts.nyanCount, { 0.0f, 0.0f, w, h });
+    scene.swarm.trimSprites = opts.trimSprites;
+
+    if (opts.variedLooks)
+        nyan_swarm_vary_looks(scene.swarm);
+
+    scene.camera.center = { w * 0.5f, h * 0.5f };
+    scene.camera.zoom = opts.zoom;
+    scene.camera.viewWidth = opts.width;
+    scene.camera.viewHeight = opts.height;
+}
+
+static void step_bench_scene(BenchScene &scene, int frame)
+{
+    nyan_swarm_step(scene.swarm, 1.0f / 60.0f);
+    nyan_grid_build(scene.grid, scene.swarm.world, 64.0f, scene.swarm.cats.data(), scene.swarm.cats.size());
+    nyan_swarm_cull(scene.swarm, scene.grid, scene.camera, scene.visible);
+    nyan_swarm_draw_cmds(scene.swarm, scene.camera, scene.visible, static_cast<float>(frame), scene.cmds);
+}
+
+// 'pixelsTouched' is the total over all frames, 0 if unknown.
+static void report(const char *name, const BenchOptions &opts, double renderSeconds, size_t cmdCount,
+                   u64 pixelsTouched = 0)
+{
+    const double msPerFrame = 1000.0 * renderSeconds / opts.frames;
+    const double catsPerSecond = cmdCount / renderSeconds;
+    std::printf("%-16s %8zu cats %6.3f ms/frame %8.1f fps %12.0f cats/s",
+                name, opts.nyanCount, msPerFrame, 1000.0 / msPerFrame, catsPerSecond);
+
+    if (pixelsTouched)
+        std::printf(" %8.3f Mpx/frame", pixelsTouched / 1e6 / opts.frames);
+
+    std::printf("\n");
+}
+
+static void report_fill_stats(const BenchOptions &opts, const NyanFillStats &stats, u64 overdrawPixels,
+                              u64 coveredPixels, u16 maxOverdraw)
+{
+    const double frames = opts.frames;
+    std::printf("%-16s %8.3f Mpx written %8.3f Mpx blended %8.3f Mpx skipped (%.1f%% of touched) per frame\n",
+                "", stats.written / 1e6 / frames, stats.blended / 1e6 / frames, stats.skipped / 1e6 / frames,
+                stats.touched() ? 100.0 * stats.skipped / stats.touched() : 0.0);
+
+    if (coveredPixels)
+        std::printf("%-16s %8.2f avg overdraw of covered pixels, %u max, %.1f%% of the frame covered\n",
+                    "", static_cast<double>(overdrawPixels) / coveredPixels, maxOverdraw,
+                    100.0 * coveredPixels / (frames * opts.width * opts.height));
+}
+
+// Binary PPM, readable by about every image viewer.
+static bool write_ppm(const char *filename, const NyanImage &image)
+{
+    auto f = std::fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    std::fprintf(f, "P6\n%d %d\n255\n", image.width, image.height);
+    std::vector<u8> row(image.width * 3);
+
+    for (int y=0; y<image.height; ++y)
+    {
+        const u32 *src = image.pixels.data() + y * image.width;
+
+        for (int x=0; x<image.width; ++x)
+        {
+            row[x * 3 + 0] = (src[x] >> 16) & 0xff;
+            row[x * 3 + 1] = (src[x] >> 8) & 0xff;
+            row[x * 3 + 2] = src[x] & 0xff;
+        }
+
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+
+    return std::fclose(f) == 0;
+}
+
+// One SDL_RenderCopyExF() per cat or a single SDL_RenderGeometry() batch.
+static void bench_swarm_sdl(const BenchOptions &opts, bool geometry)
+{
+    auto surface = SDL_CreateRGBSurfaceWithFormat(0, opts.width, opts.height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!surface)
+        nyan_sdl_fatal("bench_swarm_sdl/SDL_CreateRGBSurfaceWithFormat");
+
+    auto renderer = SDL_CreateSoftwareRenderer(surface);
+    if (!renderer)
+        nyan_sdl_fatal("bench_swarm_sdl/SDL_CreateSoftwareRenderer");
+
+    auto nyanSheet = make_nyan_sprite_sheet_from_mem(renderer);
+    auto batch = nyan_geometry_batch_create();
+
+    BenchScene scene;
+    init_bench_scene(scene, opts);
+
+    NyanTrails trails;
+    nyan_trails_reset(trails, opts.trailLength ? opts.nyanCount : 0, opts.trailLength);
+
+    double renderSeconds = 0.0;
+    size_t cmdCount = 0;
+
+    for (int frame=0; frame<opts.frames; ++frame)
+    {
+        step_bench_scene(scene, frame);
+        nyan_trails_update(trails, scene.swarm);
+        const auto start = SDL_GetPerformanceCounter();
+        SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+        SDL_RenderClear(renderer);
+
+        if (opts.trailLength)
+        {
+            nyan_trails_build_geometry(trails, scene.swarm, scene.camera);
+
+            if (nyan_trails_render(renderer, trails))
+                nyan_sdl_fatal("bench_swarm_sdl/nyan_trails_render");
+        }
+
+        if (!geometry)
+            nyan_render_draw_cmds(renderer, nyanSheet, scene.cmds.data(), scene.cmds.size());
+        else if (nyan_render_geometry(renderer, nyanSheet, batch, scene.cmds.data(), scene.cmds.size()))
+            nyan_sdl_fatal("bench_swarm_sdl/nyan_render_geometry");
+
+        SDL_RenderFlush(renderer);
+        renderSeconds += seconds_since(start);
+        cmdCount += scene.cmds.size();
+    }
+
+    std::array<char, 32> name;
+    std::snprintf(name.data(), name.size(), "%s%s", geometry ? "sdl-geometry" : "sdl-copyex",
+                  opts.trailLength ? "+trails" : "");
+    report(name.data(), opts, renderSeconds, cmdCount);
+
+    nyan_geometry_batch_destroy(batch);
+    SDL_DestroyTexture(nyanSheet);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+}
+
+// All cats in one instanced draw call through nyan_gl.h, into a hidden
+// window. The time includes waiting for the GPU, with llvmpipe that is the
+// rasterization on the CPU.
+static void bench_swarm_gl(const BenchOptions &opts)
+{
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO))
+    {
+        log_warn("bench_swarm_gl: skipped, no video: %s", SDL_GetError());
+        return;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    auto window = SDL_CreateWindow("sdl_nyan_bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                   opts.width, opts.height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    auto context = window ? SDL_GL_CreateContext(window) : nullptr;
+    auto gl = context ? nyan_gl_renderer_create(nyan_decode_sprite_sheet()) : nullptr;
+
+    if (!gl)
+    {
+        log_warn("bench_swarm_gl: skipped, no OpenGL 3.3 context: %s", SDL_GetError());
+
+        if (context)
+            SDL_GL_DeleteContext(context);
+        if (window)
+            SDL_DestroyWindow(window);
+
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        return;
+    }
+
+    if (opts.trailLength)
+        log_warn("bench_swarm_gl: trails are not drawn by the OpenGL backend");
+
+    BenchScene scene;
+    init_bench_scene(scene, opts);
+
+    double renderSeconds = 0.0;
+    size_t cmdCount = 0;
+
+    for (int frame=0; frame<opts.frames; ++frame)
+    {
+        step_bench_scene(scene, frame);
+        const auto start = SDL_GetPerformanceCounter();
+        nyan_gl_begin_frame(gl, opts.width, opts.height, { 128, 128, 128, 255 });
+
+        if (nyan_gl_render(gl, scene.cmds.data(), scene.cmds.size()))
+            nyan_sdl_fatal("bench_swarm_gl/nyan_gl_render");
+
+        nyan_gl_finish(gl);
+        renderSeconds += seconds_since(start);
+        cmdCount += scene.cmds.size();
+    }
+
+    report("gl-instanced", opts, renderSeconds, cmdCount);
+
+    nyan_gl_renderer_destroy(gl);
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(window);
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+static void bench_swarm_tiles(const BenchOptions &opts, unsigned threadCount)
+{
+    auto jobs = nyan_jobs_create(threadCount);
+    const auto sheet = nyan_decode_sprite_sheet(jobs);
+    NyanIndexedImage indexedSheet;
+
+    if (opts.indexedSheet && !nyan_make_indexed_image(sheet, indexedSheet))
+    {
+        log_error("bench_swarm_tiles: too many colors for an indexed sheet");
+        nyan_jobs_destroy(jobs);
+        return;
+    }
+
+    auto rast = nyan_tile_rasterizer_create(jobs, opts.tileSize);
+
+    NyanImage frameImage;
+    frameImage.width = opts.width;
+    frameImage.height = opts.height;
+    frameImage.pixels.resize(opts.width * opts.height);
+    const auto fb = nyan_framebuffer(frameImage);
+
+    BenchScene scene;
+    init_bench_scene(scene, opts);
+
+    // Instrumentation slows the blitters down, the timings are only
+    // comparable between runs with the same flags.
+    NyanOverdrawMap overdraw;
+    const bool wantOverdraw = opts.fillStats || !opts.heatmapFile.empty();
+    nyan_tile_rasterizer_set_instrumentation(rast, opts.fillStats, wantOverdraw ? &overdraw : nullptr);
+
+    double renderSeconds = 0.0;
+    size_t cmdCount = 0;
+    u64 pixelsTouched = 0;
+    NyanFillStats fillStats;
+    u64 overdrawPixels = 0, coveredPixels = 0;
+    u16 maxOverdraw = 0;
+
+    for (int frame=0; frame<opts.frames; ++frame)
+    {
+        step_bench_scene(scene, frame);
+        const auto start = SDL_GetPerformanceCounter();
+        if (opts.indexedSheet)
+            nyan_tile_rasterize(rast, fb, indexedSheet, scene.cmds.data(), scene.cmds.size(), 0xff808080u);
+        else
+            nyan_tile_rasterize(rast, fb, sheet, scene.cmds.data(), scene.cmds.size(), 0xff808080u);
+        renderSeconds += seconds_since(start);
+        cmdCount += scene.cmds.size();
+        pixelsTouched += nyan_tile_rasterizer_pixels_touched(rast);
+        fillStats += nyan_tile_rasterizer_fill_stats(rast);
+
+        if (opts.fillStats)
+        {
+            for (auto n: overdraw.counts)
+            {
+                overdrawPixels += n;
+                coveredPixels += n != 0;
+                maxOverdraw = std::max(maxOverdraw, n);
+            }
+        }
+    }
+
+    std::array<char, 32> name;
+    std::snprintf(name.data(), name.size(), "tiles-%ut%s%s", nyan_jobs_thread_count(jobs),
+                  opts.trimSprites ? "" : "-untrimmed", opts.indexedSheet ? "-indexed" : "");
+    report(name.data(), opts, renderSeconds, cmdCount, pixelsTouched);
+
+    if (opts.fillStats)
+        report_fill_stats(opts, fillStats, overdrawPixels, coveredPixels, maxOverdraw);
+
+    // Overdraw of the last frame.
+    if (!opts.heatmapFile.empty())
+    {
+        nyan_overdraw_heatmap(overdraw, fb);
+
+        if (!write_ppm(opts.heatmapFile.c_str(), frameImage))
+            log_error("Could not write overdraw heatmap to '%s'", opts.heatmapFile.c_str());
+    }
+
+    nyan_tile_rasterizer_destroy(rast);
+    nyan_jobs_destroy(jobs);
+}
+
+static void bench_swarm(const BenchOptions &opts)
+{
+    NyanIndexedImage indexedSheet;
+    const auto sheet = nyan_decode_sprite_sheet();
+
+    if (nyan_make_indexed_image(sheet, indexedSheet))
+        std::printf("sprite sheet: %zu bytes ARGB, %zu bytes indexed (%zu colors)\n",
+                    sheet.pixels.size() * sizeof(u32),
+                    indexedSheet.indices.size() + indexedSheet.palette.size() * sizeof(u32),
+                    indexedSheet.palette.size());
+
+    const bool all = opts.backend == "all";
+
+    if (all || opts.backend == "sdl")
+    {
+        bench_swarm_sdl(opts, false);
+        bench_swarm_sdl(opts, true);
+    }
+
+    if (all || opts.backend == "gl")
+        bench_swarm_gl(opts);
+
+    if (opts.backend == "tiles")
+        bench_swarm_tiles(opts, opts.threadCount);
+
+    // Thread scaling of the tile rasterizer: 1, 2, 4, ... up to the CPU count.
+    if (all)
+    {
+        const unsigned maxThreads = opts.threadCount ? opts.threadCount
+            : std::max(1u, std::thread::hardware_concurrency());
+
+        for (unsigned t=1; t<maxThreads; t*=2)
+            bench_swarm_tiles(opts, t);
+
+        bench_swarm_tiles(opts, maxThreads);
+
+        // Gain from drawing trimmed sprite rects.
+        if (opts.trimSprites)
+        {
+            auto untrimmed = opts;
+            untrimmed.trimSprites = false;
+            bench_swarm_tiles(untrimmed, maxThreads);
+        }
+
+        if (!opts.indexedSheet)
+        {
+            auto indexed = opts;
+            indexed.indexedSheet = true;
+            bench_swarm_tiles(indexed, maxThreads);
+        }
+    }
+}
+
+struct SpriteSet
+{
+    const char *name;
+    NyanImage image;
+    std::vector<SDL_Rect> rects;
+};
+
+static SpriteSet make_builtin_sprite_set(int scale)
+{
+    const auto sheet = nyan_decode_sprite_sheet();
+    SpriteSet set = { scale == 1 ? "nyan" : "nyan-x8", {}, {} };
+    set.image.width = sheet.width * scale;
+    set.image.height = sheet.height * scale;
+    set.image.pixels.resize(set.image.width * set.image.height);
+
+    for (int y=0; y<set.image.height; ++y)
+        for (int x=0; x<set.image.width; ++x)
+            set.image.pixels[y * set.image.width + x] = sheet.pixels[(y / scale) * sheet.width + x / scale];
+
+    for (size_t i=0; i<NYAN_SPRITE_COUNT; ++i)
+    {
+        const auto r = nyan_sprite_rect(i);
+        set.rects.push_back({ r.x * scale, r.y * scale, r.w * scale, r.h * scale });
+    }
+
+    return set;
+}
+
+// Large sprites with antialiased edges: discs of increasing radius, so the
+// translucent spans are exercised as well.
+static SpriteSet make_disc_sprite_set()
+{
+    static const int Size = 256;
+    static const int Count = 4;
+    SpriteSet set = { "discs", {}, {} };
+    set.image.width = Size * Count;
+    set.image.height = Size;
+    set.image.pixels.resize(set.image.width * set.image.height);
+
+    for (int i=0; i<Count; ++i)
+    {
+        const float radius = Size * (0.25f + 0.25f * i / (Count - 1)) - 1.0f;
+
+        for (int y=0; y<Size; ++y)
+        {
+            for (int x=0; x<Size; ++x)
+            {
+                const float dx = x + 0.5f - Size * 0.5f, dy = y + 0.5f - Size * 0.5f;
+                const float coverage = std::clamp(radius - std::sqrt(dx * dx + dy * dy), 0.0f, 1.0f);
+                const u32 a = static_cast<u32>(coverage * 255.0f + 0.5f);
+                set.image.pixels[y * set.image.width + i * Size + x] = (a << 24) | 0x00ff66ccu;
+            }
+        }
+
+        set.rects.push_back({ i * Size, 0, Size, Size });
+    }
+
+    return set;
+}
+
+// Plain per-pixel blending against the RLE span kernel. All draws are
+// unrotated and 1:1, the case the span kernel is built for.
+static void bench_spans(const BenchOptions &opts)
+{
+    NyanImage frameImage;
+    frameImage.width = opts.width;
+    frameImage.height = opts.height;
+    frameImage.pixels.assign(opts.width * opts.height, 0xff808080u);
+    const auto fb = nyan_framebuffer(frameImage);
+    const SDL_Rect clip = { 0, 0, opts.width, opts.height };
+
+    for (const auto &set: { make_builtin_sprite_set(1), make_builtin_sprite_set(8), make_disc_sprite_set() })
+    {
+        const auto spans = nyan_make_span_image(set.image);
+        const auto &r0 = set.rects[0];
+
+        // Roughly 4 Mpx of sprites per frame at random positions inside the framebuffer.
+        std::vector<NyanDrawCmd> cmds(std::max<size_t>(1, 4000000 / (r0.w * r0.h)));
+        u32 rng = 1;
+
+        for (size_t i=0; i<cmds.size(); ++i)
+        {
+            const auto &r = set.rects[i % set.rects.size()];
+            rng = rng * 1664525u + 1013904223u;
+            const float x = (rng >> 8) % std::max(1, opts.width - r.w);
+            rng = rng * 1664525u + 1013904223u;
+            const float y = (rng >> 8) % std::max(1, opts.height - r.h);
+            cmds[i] = { r, { x, y, static_cast<float>(r.w), static_cast<float>(r.h) }, { 0.0f, 0.0f }, 0.0f };
+        }
+
+        double seconds[2] = {};
+        u64 pixels = 0;
+
+        for (int kernel=0; kernel<2; ++kernel)
+        {
+            const auto start = SDL_GetPerformanceCounter();
+
+            for (int frame=0; frame<opts.frames; ++frame)
+            {
+                for (const auto &cmd: cmds)
+                {
+                    if (kernel == 0)
+                        pixels += nyan_blit(fb, clip, set.image, cmd);
+                    else
+                        nyan_blit(fb, clip, spans, cmd);
+                }
+            }
+
+            seconds[kernel] = seconds_since(start);
+        }
+
+        const double draws = static_cast<double>(cmds.size()) * opts.frames;
+        std::printf("%-8s %4dx%-4d %6.1f%% covered  per-pixel %8.1f ns/sprite %7.1f Mpx/s"
+                    "  spans %8.1f ns/sprite %7.1f Mpx/s  %5.2fx\n",
+                    set.name, r0.w, r0.h, 100.0 * spans.texels.size() / set.image.pixels.size(),
+                    1e9 * seconds[0] / draws, pixels / 1e6 / seconds[0],
+                    1e9 * seconds[1] / draws, pixels / 1e6 / seconds[1], seconds[0] / seconds[1]);
+    }
+}
+
+// Scheduling overhead of nyan_parallel_for() for fine-grained tasks. Each
+// element does a tiny fixed amount of work, the serial loop is the baseline.
+static void bench_jobs(const BenchOptions &opts)
+{
+    static const size_t ElementCount = 1u << 20;
+    std::vector<u32> data(ElementCount);
+
+    auto kernel = [&data] (size_t begin, size_t end)
+    {
+        for (size_t i=begin; i<end; ++i)
+            data[i] = data[i] * 1664525u + 1013904223u;
+    };
+
+    auto start = SDL_GetPerformanceCounter();
+    for (int frame=0; frame<opts.frames; ++frame)
+        kernel(0, ElementCount);
+    const double serialSeconds = seconds_since(start);
+
+    std::printf("%-16s %8s %10.3f ms/run\n", "serial", "-", 1000.0 * serialSeconds / opts.frames);
+
+    auto jobs = nyan_jobs_create(opts.threadCount);
+
+    for (size_t grain: { 1u << 4, 1u << 6, 1u << 8, 1u << 10, 1u << 12, 1u << 14 })
+    {
+        start = SDL_GetPerformanceCounter();
+        for (int frame=0; frame<opts.frames; ++frame)
+            nyan_parallel_for(jobs, ElementCount, grain, kernel);
+        const double seconds = seconds_since(start);
+        const double taskCount = static_cast<double>(ElementCount / grain) * opts.frames;
+
+        std::array<char, 32> name;
+        std::snprintf(name.data(), name.size(), "jobs-%ut", nyan_jobs_thread_count(jobs));
+        std::printf("%-16s %8zu %10.3f ms/run %8.1f ns/task %6.2fx\n", name.data(), grain,
+                    1000.0 * seconds / opts.frames, 1e9 * seconds / taskCount, serialSeconds / seconds);
+    }
+
+    nyan_jobs_destroy(jobs);
+}
+
+// Mixer throughput without an audio device. Looping meows are mixed in
+// blocks of 512 frames the way the audio callback would request them.
+static void bench_mixer(const BenchOptions &opts)
+{
+    static const int SampleRate = 48000;
+    static const size_t BlockFrames = 512;
+
+    const auto meow = nyan_sound_meow(SampleRate);
+    std::vector<float> outF32(BlockFrames * 2);
+    std::vector<s16> outS16(BlockFrames * 2);
+    const size_t blockCount = static_cast<size_t>(opts.frames) * 10;
+    const double audioSeconds = static_cast<double>(blockCount * BlockFrames) / SampleRate;
+
+    for (bool simd: { false, true })
+    {
+        for (bool s16Out: { false, true })
+        {
+            auto mixer = nyan_mixer_create(SampleRate, opts.voiceCount);
+
+            if (nyan_mixer_set_simd(mixer, simd) != simd)
+            {
+                nyan_mixer_destroy(mixer);
+                continue;
+            }
+
+            for (size_t v=0; v<opts.voiceCount; ++v)
+                nyan_mixer_play(mixer, &meow, 1.0f, -1.0f + 2.0f * v / opts.voiceCount, true);
+
+            const auto start = SDL_GetPerformanceCounter();
+
+            for (size_t block=0; block<blockCount; ++block)
+            {
+                if (s16Out)
+                    nyan_mixer_mix_s16(mixer, outS16.data(), BlockFrames);
+                else
+                    nyan_mixer_mix(mixer, outF32.data(), BlockFrames);
+            }
+
+            const double seconds = seconds_since(start);
+            const double voiceFrames = static_cast<double>(blockCount * BlockFrames) * opts.voiceCount;
+            std::printf("%-8s %-4s %5u voices %8.3f ns/voice-frame %9.1fx realtime\n", simd ? "sse2" : "scalar",
+                        s16Out ? "s16" : "f32", nyan_mixer_stats(mixer).active, 1e9 * seconds / voiceFrames,
+                        audioSeconds / seconds);
+            nyan_mixer_destroy(mixer);
+        }
+    }
+
+    // Twice as many one-shots as there are voices, at random gains.
+    auto mixer = nyan_mixer_create(SampleRate, opts.voiceCount);
+    u32 rng = 1;
+
+    for (size_t v=0; v<opts.voiceCount * 2; ++v)
+    {
+        rng = rng * 1664525u + 1013904223u;
+        nyan_mixer_play(mixer, &meow, static_cast<float>(rng >> 8) / (1u << 24));
+    }
+
+    nyan_mixer_mix(mixer, outF32.data(), BlockFrames);
+    const auto stats = nyan_mixer_stats(mixer);
+    std::printf("stealing: %zu requests, %llu played, %llu stolen, %llu dropped, %u active\n", opts.voiceCount * 2,
+                static_cast<unsigned long long>(stats.played), static_cast<unsigned long long>(stats.stolen),
+                static_cast<unsigned long long>(stats.dropped), stats.active);
+    nyan_mixer_destroy(mixer);
+}
+
+int main(int argc, char *argv[])
+{
+    log_set_level(LOG_INFO);
+
+    BenchOptions opts;
+
+    for (int i=1; i<argc; ++i)
+    {
+        auto arg_is = [&] (const char *name) { return std::strcmp(argv[i], name) == 0 && i+1 < argc; };
+
+        if (arg_is("--bench"))
+            opts.bench = argv[++i];
+        else if (arg_is("--backend"))
+            opts.backend = argv[++i];
+        else if (arg_is("--cats") && nyan_parse_arg(argv[i+1], opts.nyanCount))
+            ++i;
+        else if (arg_is("--frames") && nyan_parse_arg(argv[i+1], opts.frames, 1))
+            ++i;
+        else if (arg_is("--width") && nyan_parse_arg(argv[i+1], opts.width))
+            ++i;
+        else if (arg_is("--height") && nyan_parse_arg(argv[i+1], opts.height))
+            ++i;
+        else if (arg_is("--threads") && nyan_parse_arg(argv[i+1], opts.threadCount))
+            ++i;
+        else if (arg_is("--tile-size") && nyan_parse_arg(argv[i+1], opts.tileSize))
+            ++i;
+        else if (arg_is("--zoom") && nyan_parse_arg(argv[i+1], opts.zoom))
+            ++i;
+        else if (arg_is("--trails") && nyan_parse_arg(argv[i+1], opts.trailLength))
+            ++i;
+        else if (arg_is("--heatmap"))
+            opts.heatmapFile = argv[++i];
+        else if (arg_is("--voices") && nyan_parse_arg(argv[i+1], opts.voiceCount, 1))
+            ++i;
+        else if (std::strcmp(argv[i], "--no-trim") == 0)
+            opts.trimSprites = false;
+        else if (std::strcmp(argv[i], "--varied") == 0)
+            opts.variedLooks = true;
+        else if (std::strcmp(argv[i], "--indexed") == 0)
+            opts.indexedSheet = true;
+        else if (std::strcmp(argv[i], "--stats") == 0)
+            opts.fillStats = true;
+        else
+        {
+            log_error("Usage: %s [--bench swarm|spans|jobs|mixer] [--backend all|sdl|gl|tiles] [--cats <count>] [--frames <count>]"
+                      " [--width <px>] [--height <px>] [--threads <count>] [--tile-size <px>] [--zoom <factor>]"
+                      " [--no-trim] [--indexed] [--varied] [--trails <length>] [--stats] [--heatmap <file.ppm>]"
+                      " [--voices <count>]",
+                      argv[0]);
+            return 1;
+        }
+    }
+
+    if (SDL_Init(SDL_INIT_TIMER))
+        nyan_sdl_fatal("SDL_Init");
+
+    if (opts.bench == "swarm")
+    {
+        std::printf("swarm benchmark: %dx%d, %d frames\n", opts.width, opts.height, opts.frames);
+        bench_swarm(opts);
+    }
+    else if (opts.bench == "spans")
+    {
+        std::printf("span blitting benchmark: %d frames\n", opts.frames);
+        bench_spans(opts);
+    }
+    else if (opts.bench == "jobs")
+    {
+        std::printf("job system benchmark: %d runs\n", opts.frames);
+        bench_jobs(opts);
+    }
+    else if (opts.bench == "mixer")
+    {
+        std::printf("audio mixer benchmark: %d x 10 blocks\n", opts.frames);
+        bench_mixer(opts);
+    }
+    else
+    {
+        log_error("Unknown benchmark '%s'", opts.bench.c_str());
+        return 1;
+    }
+
+    SDL_Quit();
+
+    return 0;
+}
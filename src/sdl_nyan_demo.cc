@@ -3,6 +3,25 @@
 #include <sdl_nyan.h>
 #include <SDL.h>
 #include <SDL_render.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nyan_args.h"
+#include "nyan_audio.h"
+#include "nyan_export.h"
+#include "nyan_gl.h"
+#include "nyan_governor.h"
+#include "nyan_mip.h"
+#include "nyan_replay.h"
+#include "nyan_sheets.h"
+#include "nyan_shm.h"
+#include "nyan_soft.h"
+#include "nyan_swarm.h"
+#include "nyan_trail.h"
 
 static void nyan_sdl_fatal(const char *const msg)
 {
@@ -21,6 +40,8 @@ static const float NYAN_PI2 = 2.0f * NYAN_PI;
 template<typename T> T deg2rad(T deg) { return deg * NYAN_PI / 180.0; }
 template<typename T> T rad2deg(T deg) { return 180.0 * deg / NYAN_PI; }
 
+static const char *const NYAN_MUSIC_FILE = "../external/nyan/nyan/nyanlooped.ogg";
+
 struct NyanSpinnyCircle
 {
     SDL_Texture *nyanSheet = nullptr;
@@ -35,10 +56,10 @@ struct NyanSpinnyCircle
     unsigned nyanCount = 13;
 };
 
-void do_circle_nyan_step(SDL_Renderer *renderer, NyanSpinnyCircle &nsc)
+void do_circle_nyan_step(SDL_Renderer *renderer, NyanSpinnyCircle &nsc, u32 ticks)
 {
     static constexpr SDL_Point rotCenter = {NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT};
-    const size_t nyanSpriteIndex = (SDL_GetTicks() / nsc.animSpeed) % NYAN_SPRITE_COUNT;
+    const size_t nyanSpriteIndex = (ticks / nsc.animSpeed) % NYAN_SPRITE_COUNT;
     const auto sourceRect = nyan_sprite_rect(nyanSpriteIndex);
     const auto nyanRads = deg2rad(360.0f / nsc.nyanCount);
 
@@ -65,10 +86,621 @@ void do_circle_nyan_step(SDL_Renderer *renderer, NyanSpinnyCircle &nsc)
         nsc.radiusBounceIncrement = - nsc.radiusBounceIncrement;
 }
 
+struct NyanSwarmScene
+{
+    SDL_Window *window = nullptr;
+    SDL_Texture *nyanSheet = nullptr;
+    NyanGeometryBatch *geometryBatch = nullptr;
+    NyanJobSystem *jobs = nullptr;
+    NyanMipChain mips;
+    SDL_Texture *mipTexture = nullptr;  // atlas of 'mips', replaces 'nyanSheet' if set
+    NyanSwarm swarm;
+    NyanGrid grid;
+    NyanCamera camera;
+    NyanTrails trails;
+    bool drawTrails = false;
+    bool trailsPaused = false;  // turned off by the governor
+    std::vector<u32> visible;
+    std::vector<NyanDrawCmd> cmds;
+    unsigned animSpeed = 48;
+    Uint32 lastTicks = 0;
+    Uint32 lastReport = 0;
+    bool dragging = false;
+    int mouseX = 0;
+    int mouseY = 0;
+
+    // Software rendering, only used if 'rasterizer' is set.
+    NyanTileRasterizer *rasterizer = nullptr;
+    NyanImage sheetPixels;
+    SDL_Texture *frameTexture = nullptr;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    NyanOverdrawMap overdraw;
+    bool showOverdraw = false;
+
+    // OpenGL rendering instead of SDL_Renderer, only used if 'gl' is set.
+    NyanGLRenderer *gl = nullptr;
+
+    // Frame time budget, only used if 'governed' is set. Level changes
+    // alter the simulation, so they go into a recording, and a replay takes
+    // them from there instead of deciding on its own frame times.
+    bool governed = false;
+    NyanGovernor governor;
+    NyanRecorder *recorder = nullptr;
+    NyanReplay *replay = nullptr;
+    u32 frameNumber = 0;
+
+    // Audio, only used if 'mixer' is set.
+    NyanMixer *mixer = nullptr;
+    NyanSound meow;
+};
+
+// Window coordinates to renderer output coordinates. These differ on HighDPI displays.
+SDL_FPoint swarm_mouse_pos(const NyanSwarmScene &scene, int x, int y)
+{
+    int windowWidth = 0, windowHeight = 0;
+    SDL_GetWindowSize(scene.window, &windowWidth, &windowHeight);
+    const float sx = windowWidth ? static_cast<float>(scene.camera.viewWidth) / windowWidth : 1.0f;
+    const float sy = windowHeight ? static_cast<float>(scene.camera.viewHeight) / windowHeight : 1.0f;
+    return { x * sx, y * sy };
+}
+
+void init_swarm_scene(NyanSwarmScene &scene, size_t nyanCount, int viewWidth, int viewHeight)
+{
+    // Keep the density roughly constant: about one cat per 48x48 world units.
+    const float side = std::max(2048.0f, std::sqrt(static_cast<float>(nyanCount)) * 48.0f);
+    nyan_swarm_populate(scene.swarm, nyanCount, { 0.0f, 0.0f, side, side });
+    scene.camera.center = { side * 0.5f, side * 0.5f };
+    scene.camera.viewWidth = viewWidth;
+    scene.camera.viewHeight = viewHeight;
+}
+
+void handle_swarm_event(NyanSwarmScene &scene, const SDL_Event &event)
+{
+    auto &cam = scene.camera;
+
+    switch (event.type)
+    {
+        case SDL_MOUSEBUTTONDOWN:
+            scene.dragging = scene.dragging || event.button.button == SDL_BUTTON_LEFT;
+            break;
+        case SDL_MOUSEBUTTONUP:
+            scene.dragging = scene.dragging && event.button.button != SDL_BUTTON_LEFT;
+            break;
+        case SDL_MOUSEMOTION:
+            scene.mouseX = event.motion.x;
+            scene.mouseY = event.motion.y;
+
+            if (scene.dragging)
+            {
+                const auto rel = swarm_mouse_pos(scene, event.motion.xrel, event.motion.yrel);
+                nyan_camera_pan(cam, rel.x, rel.y);
+            }
+            break;
+        case SDL_MOUSEWHEEL:
+            // The position from the last motion event instead of SDL_GetMouseState(), so replays match.
+            nyan_camera_zoom_at(cam, event.wheel.y > 0 ? 1.25f : 0.8f,
+                                swarm_mouse_pos(scene, scene.mouseX, scene.mouseY));
+            break;
+        case SDL_KEYDOWN:
+            switch (event.key.keysym.sym)
+            {
+                case SDLK_LEFT:  nyan_camera_pan(cam,  64.0f, 0.0f); break;
+                case SDLK_RIGHT: nyan_camera_pan(cam, -64.0f, 0.0f); break;
+                case SDLK_UP:    nyan_camera_pan(cam, 0.0f,  64.0f); break;
+                case SDLK_DOWN:  nyan_camera_pan(cam, 0.0f, -64.0f); break;
+                case SDLK_PLUS:
+                case SDLK_KP_PLUS:
+                    nyan_camera_zoom_at(cam, 1.25f, { cam.viewWidth * 0.5f, cam.viewHeight * 0.5f });
+                    break;
+                case SDLK_MINUS:
+                case SDLK_KP_MINUS:
+                    nyan_camera_zoom_at(cam, 0.8f, { cam.viewWidth * 0.5f, cam.viewHeight * 0.5f });
+                    break;
+                case SDLK_HOME:
+                    cam.zoom = 1.0f;
+                    cam.center = { scene.swarm.world.w * 0.5f, scene.swarm.world.h * 0.5f };
+                    break;
+                case SDLK_m:
+                    // A chorus of up to 64 visible cats, louder near the center of the view.
+                    for (size_t i=0; scene.mixer && i<std::min<size_t>(64, scene.visible.size()); ++i)
+                    {
+                        const auto &cat = scene.swarm.cats[scene.visible[std::rand() % scene.visible.size()]];
+                        nyan_mixer_play_at(scene.mixer, &scene.meow, cam, cat.pos);
+                    }
+                    break;
+                case SDLK_o:
+                    if (scene.rasterizer)
+                    {
+                        scene.showOverdraw = !scene.showOverdraw;
+                        nyan_tile_rasterizer_set_instrumentation(scene.rasterizer, scene.showOverdraw,
+                                                                 scene.showOverdraw ? &scene.overdraw : nullptr);
+                    }
+                    break;
+            }
+            break;
+    }
+}
+
+// Rasterizes the swarm on the CPU into a streaming texture covering the whole output.
+void render_swarm_software(SDL_Renderer *renderer, NyanSwarmScene &scene)
+{
+    const auto &cam = scene.camera;
+
+    if (!scene.frameTexture || scene.frameWidth != cam.viewWidth || scene.frameHeight != cam.viewHeight)
+    {
+        SDL_DestroyTexture(scene.frameTexture);
+        scene.frameTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                               cam.viewWidth, cam.viewHeight);
+        if (!scene.frameTexture)
+            nyan_sdl_fatal("render_swarm_software/SDL_CreateTexture");
+        scene.frameWidth = cam.viewWidth;
+        scene.frameHeight = cam.viewHeight;
+    }
+
+    void *pixels = nullptr;
+    int pitch = 0;
+
+    if (SDL_LockTexture(scene.frameTexture, nullptr, &pixels, &pitch))
+    {
+        nyan_sdl_error("render_swarm_software/SDL_LockTexture");
+        return;
+    }
+
+    const NyanFramebuffer fb = { static_cast<u32 *>(pixels), scene.frameWidth, scene.frameHeight, pitch / 4 };
+    nyan_tile_rasterize(scene.rasterizer, fb, scene.sheetPixels, scene.cmds.data(), scene.cmds.size(), 0xff808080u);
+
+    if (scene.showOverdraw)
+        nyan_overdraw_heatmap(scene.overdraw, fb);
+
+    SDL_UnlockTexture(scene.frameTexture);
+    SDL_RenderCopy(renderer, scene.frameTexture, nullptr, nullptr);
+}
+
+void do_swarm_step(SDL_Renderer *renderer, NyanSwarmScene &scene, u32 ticks)
+{
+    const u64 frameStart = SDL_GetPerformanceCounter();
+    const float dt = std::min((ticks - scene.lastTicks) / 1000.0f, 0.1f);
+    scene.lastTicks = ticks;
+
+    if (scene.gl)
+        SDL_GL_GetDrawableSize(scene.window, &scene.camera.viewWidth, &scene.camera.viewHeight);
+    else
+        SDL_GetRendererOutputSize(renderer, &scene.camera.viewWidth, &scene.camera.viewHeight);
+
+    const auto quality = scene.governed ? nyan_governor_quality(scene.governor) : NyanQuality();
+    const bool drawTrails = scene.drawTrails && quality.trails;
+
+    // Trails restart empty instead of jumping across the paused time.
+    if (drawTrails && scene.trailsPaused)
+        nyan_trails_reset(scene.trails, scene.swarm.cats.size(), scene.trails.capacity);
+    scene.trailsPaused = scene.drawTrails && !drawTrails;
+    scene.swarm.upright = !quality.rotation;
+
+    if (quality.farUpdateInterval > 1)
+    {
+        // Near: the view plus the reach of a rotated sprite.
+        const auto view = nyan_camera_world_rect(scene.camera);
+        const float margin = nyan_swarm_cat_radius(scene.swarm);
+        const SDL_FRect nearRect = { view.x - margin, view.y - margin, view.w + 2 * margin, view.h + 2 * margin };
+        nyan_swarm_step_lod(scene.swarm, dt, nearRect, scene.frameNumber, quality.farUpdateInterval, scene.jobs);
+    }
+    else
+        nyan_swarm_step(scene.swarm, dt, scene.jobs);
+
+    ++scene.frameNumber;
+
+    if (drawTrails)
+        nyan_trails_update(scene.trails, scene.swarm, scene.jobs);
+    nyan_grid_build(scene.grid, scene.swarm.world, 64.0f, scene.swarm.cats.data(), scene.swarm.cats.size());
+    nyan_swarm_cull(scene.swarm, scene.grid, scene.camera, scene.visible);
+    nyan_governor_thin(quality, scene.visible);
+
+    const float animTime = static_cast<float>(ticks % (scene.animSpeed * NYAN_SPRITE_COUNT * 1000)) / scene.animSpeed;
+    nyan_swarm_draw_cmds(scene.swarm, scene.camera, scene.visible, animTime, scene.cmds, scene.jobs);
+
+    // Trails go below the cats, except in software mode where the frame
+    // texture covers everything drawn before it.
+    if (drawTrails)
+    {
+        nyan_trails_build_geometry(scene.trails, scene.swarm, scene.camera, scene.jobs);
+
+        if (!scene.rasterizer && nyan_trails_render(renderer, scene.trails))
+            nyan_sdl_error("do_swarm_step/nyan_trails_render");
+    }
+
+    if (scene.gl)
+    {
+        nyan_gl_begin_frame(scene.gl, scene.camera.viewWidth, scene.camera.viewHeight, { 128, 128, 128, 255 });
+
+        if (nyan_gl_render(scene.gl, scene.cmds.data(), scene.cmds.size()))
+            nyan_sdl_error("do_swarm_step/nyan_gl_render");
+    }
+    else if (scene.rasterizer)
+    {
+        render_swarm_software(renderer, scene);
+
+        if (drawTrails && nyan_trails_render(renderer, scene.trails))
+            nyan_sdl_error("do_swarm_step/nyan_trails_render");
+    }
+    else if (scene.mipTexture)
+    {
+        if (nyan_render_geometry_mipmapped(renderer, scene.mipTexture, scene.mips, scene.geometryBatch,
+                                           scene.cmds.data(), scene.cmds.size()))
+            nyan_sdl_error("do_swarm_step/nyan_render_geometry_mipmapped");
+    }
+    else if (nyan_render_geometry(renderer, scene.nyanSheet, scene.geometryBatch, scene.cmds.data(), scene.cmds.size()))
+        nyan_sdl_error("do_swarm_step/nyan_render_geometry");
+
+    // The governor sees the CPU time of the frame. The time spent waiting
+    // for vsync in SDL_RenderPresent() or SDL_GL_SwapWindow() is not load.
+    if (scene.governed && scene.replay)
+    {
+        auto &gov = scene.governor;
+
+        if (nyan_governor_set_level(gov, nyan_replay_governor_level(scene.replay)))
+            log_info("governor: level %d (%s) from the recording", gov.stats.level,
+                     nyan_governor_level_name(gov, gov.stats.level));
+    }
+    else if (scene.governed)
+    {
+        const float frameMs = (SDL_GetPerformanceCounter() - frameStart) * 1000.0f / SDL_GetPerformanceFrequency();
+        auto &gov = scene.governor;
+
+        if (nyan_governor_frame(gov, frameMs))
+        {
+            log_info("governor: level %d (%s), average frame time %.2f ms, budget %.2f ms", gov.stats.level,
+                     nyan_governor_level_name(gov, gov.stats.level), gov.stats.averageMs, gov.config.budgetMs);
+
+            if (scene.recorder)
+                nyan_recorder_governor_level(scene.recorder, gov.stats.level);
+        }
+    }
+
+    if (ticks - scene.lastReport >= 1000)
+    {
+        log_debug("swarm: %zu of %zu cats visible, zoom=%.3f",
+                  scene.visible.size(), scene.swarm.cats.size(), scene.camera.zoom);
+
+        if (scene.governed)
+        {
+            const auto &stats = scene.governor.stats;
+            log_debug("governor: level %d, max %d, average %.2f ms, %llu of %llu frames over budget,"
+                      " %llu downgrades, %llu upgrades", stats.level, stats.maxLevel, stats.averageMs,
+                      static_cast<unsigned long long>(stats.framesOverBudget),
+                      static_cast<unsigned long long>(stats.frames), static_cast<unsigned long long>(stats.downgrades),
+                      static_cast<unsigned long long>(stats.upgrades));
+        }
+
+        if (scene.showOverdraw)
+        {
+            const auto stats = nyan_tile_rasterizer_fill_stats(scene.rasterizer);
+            log_debug("fill: %llu written, %llu blended, %llu skipped",
+                      static_cast<unsigned long long>(stats.written), static_cast<unsigned long long>(stats.blended),
+                      static_cast<unsigned long long>(stats.skipped));
+        }
+
+        scene.lastReport = ticks;
+    }
+}
+
+struct NyanExportOptions
+{
+    const char *filename = nullptr;
+    NyanVideoFormat format = NyanVideoFormat::Y4M;
+    int frames = 300;
+    int fps = 30;
+    int width = 1280;
+    int height = 720;
+    const char *shmName = nullptr;
+};
+
+static void init_headless_swarm(NyanSwarmScene &scene, const NyanExportOptions &opts, size_t nyanCount,
+                                unsigned threadCount, bool varied)
+{
+    init_swarm_scene(scene, nyanCount, opts.width, opts.height);
+
+    if (varied)
+        nyan_swarm_vary_looks(scene.swarm);
+
+    scene.jobs = nyan_jobs_create(threadCount);
+    scene.sheetPixels = nyan_decode_sprite_sheet(scene.jobs);
+    scene.rasterizer = nyan_tile_rasterizer_create(scene.jobs);
+}
+
+static void destroy_headless_swarm(NyanSwarmScene &scene)
+{
+    nyan_tile_rasterizer_destroy(scene.rasterizer);
+    nyan_jobs_destroy(scene.jobs);
+    scene.rasterizer = nullptr;
+    scene.jobs = nullptr;
+}
+
+// Simulates frame number 'frame' and builds its draw commands.
+static void step_headless_swarm(NyanSwarmScene &scene, int frame, float dt)
+{
+    nyan_swarm_step(scene.swarm, dt, scene.jobs);
+    nyan_grid_build(scene.grid, scene.swarm.world, 64.0f, scene.swarm.cats.data(), scene.swarm.cats.size());
+    nyan_swarm_cull(scene.swarm, scene.grid, scene.camera, scene.visible);
+
+    const float animTime = frame * dt * 1000.0f / scene.animSpeed;
+    nyan_swarm_draw_cmds(scene.swarm, scene.camera, scene.visible, animTime, scene.cmds, scene.jobs);
+}
+
+// Renders the swarm without a window using the tile rasterizer and streams
+// the frames to a video file. Time advances by a fixed step per frame, so
+// the output does not depend on how fast it was rendered.
+int export_swarm(const NyanExportOptions &opts, size_t nyanCount, unsigned threadCount, bool varied)
+{
+    NyanSwarmScene scene;
+    init_headless_swarm(scene, opts, nyanCount, threadCount, varied);
+
+    auto writer = nyan_video_writer_open(opts.filename, opts.format, opts.width, opts.height, opts.fps);
+
+    if (!writer)
+    {
+        destroy_headless_swarm(scene);
+        return 1;
+    }
+
+    const float dt = 1.0f / opts.fps;
+    const auto start = SDL_GetPerformanceCounter();
+    u64 renderTicks = 0;
+    int frame = 0;
+
+    for (; frame<opts.frames; ++frame)
+    {
+        const auto frameStart = SDL_GetPerformanceCounter();
+        step_headless_swarm(scene, frame, dt);
+        renderTicks += SDL_GetPerformanceCounter() - frameStart;
+
+        // Waits here if the writer is behind.
+        auto image = nyan_video_writer_acquire(writer);
+
+        const auto rasterStart = SDL_GetPerformanceCounter();
+        nyan_tile_rasterize(scene.rasterizer, nyan_framebuffer(*image), scene.sheetPixels, scene.cmds.data(),
+                            scene.cmds.size(), 0xff808080u);
+        renderTicks += SDL_GetPerformanceCounter() - rasterStart;
+
+        if (!nyan_video_writer_submit(writer, image))
+            break;
+    }
+
+    NyanVideoWriterStats stats;
+    const bool ok = nyan_video_writer_close(writer, &stats);
+    const double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+    const double seconds = (SDL_GetPerformanceCounter() - start) / freq;
+    const double renderSeconds = renderTicks / freq;
+
+    log_info("export: %llu frames %dx%d in %.2f s, %.1f fps (rendering alone %.1f fps)",
+             static_cast<unsigned long long>(stats.frames), opts.width, opts.height, seconds,
+             stats.frames / seconds, frame / renderSeconds);
+    log_info("export: convert %.2f ms/frame, write %.2f ms/frame (%.1f MB/s), renderer stalled %.2f s",
+             1000.0 * stats.convertSeconds / std::max<u64>(stats.frames, 1),
+             1000.0 * stats.writeSeconds / std::max<u64>(stats.frames, 1),
+             stats.bytes / 1e6 / std::max(stats.writeSeconds, 1e-9), stats.stallSeconds);
+
+    destroy_headless_swarm(scene);
+
+    return ok ? 0 : 1;
+}
+
+// Renders the swarm without a window into a shared memory frame ring, paced
+// at the export frame rate. See sdl_nyan_shm_consumer for the reading side.
+int share_swarm(const NyanExportOptions &opts, size_t nyanCount, unsigned threadCount, bool varied)
+{
+    NyanSwarmScene scene;
+    init_headless_swarm(scene, opts, nyanCount, threadCount, varied);
+
+    auto ring = nyan_shm_ring_create(opts.shmName, opts.width, opts.height);
+
+    if (!ring)
+    {
+        destroy_headless_swarm(scene);
+        return 1;
+    }
+
+    log_info("shm: publishing %d frames of %dx%d at %d fps to '%s'", opts.frames, opts.width, opts.height, opts.fps,
+             opts.shmName);
+
+    const float dt = 1.0f / opts.fps;
+    const u64 frameNs = 1000000000ull / opts.fps;
+    const u64 start = nyan_shm_now_ns();
+    u64 renderNs = 0;
+
+    for (int frame=0; frame<opts.frames; ++frame)
+    {
+        const u64 frameStart = nyan_shm_now_ns();
+        step_headless_swarm(scene, frame, dt);
+
+        // Rasterizes straight into the shared slot.
+        auto fb = nyan_shm_ring_begin_frame(ring, frameStart);
+        nyan_tile_rasterize(scene.rasterizer, fb, scene.sheetPixels, scene.cmds.data(), scene.cmds.size(),
+                            0xff808080u);
+        nyan_shm_ring_end_frame(ring);
+
+        const u64 now = nyan_shm_now_ns();
+        renderNs += now - frameStart;
+
+        const u64 due = start + (frame + 1) * frameNs;
+        if (now < due)
+            SDL_Delay(static_cast<u32>((due - now) / 1000000));
+    }
+
+    log_info("shm: rendering took %.2f ms/frame", renderNs / 1e6 / std::max(opts.frames, 1));
+
+    nyan_shm_ring_destroy(ring);
+    destroy_headless_swarm(scene);
+
+    return 0;
+}
+
+// Frame times of a replay. Comparable across builds and machines as long as
+// the same recording and window size are used.
+static void log_replay_timing(std::vector<u64> &frameTicks)
+{
+    if (frameTicks.empty())
+        return;
+
+    const double toMs = 1000.0 / SDL_GetPerformanceFrequency();
+    u64 total = 0;
+    for (auto t: frameTicks)
+        total += t;
+
+    std::sort(frameTicks.begin(), frameTicks.end());
+    auto pct = [&] (double p)
+    {
+        return frameTicks[std::min(frameTicks.size() - 1, static_cast<size_t>(p * frameTicks.size()))] * toMs;
+    };
+
+    log_info("replay: %zu frames in %.2f s, %.1f fps", frameTicks.size(), total * toMs / 1000.0,
+             frameTicks.size() * 1000.0 / (total * toMs));
+    log_info("replay: frame time avg %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+             total * toMs / frameTicks.size(), pct(0.5), pct(0.99), frameTicks.back() * toMs);
+}
+
+// Cold start phases, each measured from the end of the previous one.
+struct NyanStartupTimer
+{
+    static const size_t MaxPhases = 8;
+
+    u64 begin = 0;
+    u64 last = 0;
+    const char *names[MaxPhases] = {};
+    u64 ticks[MaxPhases] = {};
+    size_t count = 0;
+    bool done = false;
+};
+
+static void startup_begin(NyanStartupTimer &timer)
+{
+    timer.begin = timer.last = SDL_GetPerformanceCounter();
+}
+
+static void startup_phase(NyanStartupTimer &timer, const char *name)
+{
+    const u64 now = SDL_GetPerformanceCounter();
+
+    if (timer.count < NyanStartupTimer::MaxPhases)
+    {
+        timer.names[timer.count] = name;
+        timer.ticks[timer.count++] = now - timer.last;
+    }
+
+    timer.last = now;
+}
+
+static void log_startup_times(const NyanStartupTimer &timer)
+{
+    const double toMs = 1000.0 / SDL_GetPerformanceFrequency();
+    std::string phases;
+
+    for (size_t i=0; i<timer.count; ++i)
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%s%s %.2f ms", i ? ", " : "", timer.names[i], timer.ticks[i] * toMs);
+        phases += buf;
+    }
+
+    log_info("startup: %s", phases.c_str());
+    log_info("startup: first frame presented after %.2f ms", (timer.last - timer.begin) * toMs);
+}
+
+// Leaves 'format' alone and returns false for unknown names.
+static bool parse_video_format(const char *name, NyanVideoFormat &format)
+{
+    if (std::strcmp(name, "y4m") == 0)
+        format = NyanVideoFormat::Y4M;
+    else if (std::strcmp(name, "rgba") == 0)
+        format = NyanVideoFormat::RGBA;
+    else if (std::strcmp(name, "png") == 0)
+        format = NyanVideoFormat::PNG;
+    else
+        return false;
+
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
-    (void) argc;
-    (void) argv;
+    // SDL_GetPerformanceCounter() works before SDL_Init().
+    NyanStartupTimer startup;
+    startup_begin(startup);
+
+    size_t swarmCount = 0;
+    bool software = false;
+    bool varied = false;
+    unsigned threadCount = 0;
+    size_t trailLength = 0;
+    const char *musicFile = nullptr;
+    bool meows = false;
+    NyanExportOptions exportOpts;
+    const char *recordFile = nullptr;
+    const char *replayFile = nullptr;
+    bool firstFrameOnly = false;
+    float budgetMs = 0.0f;
+    bool mipmaps = false;
+    bool scaleNx = false;
+    bool openGL = false;
+
+    for (int i=1; i<argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--swarm") == 0 && i+1 < argc && nyan_parse_arg(argv[i+1], swarmCount))
+            ++i;
+        else if (std::strcmp(argv[i], "--software") == 0)
+            software = true;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i+1 < argc && nyan_parse_arg(argv[i+1], threadCount))
+            ++i;
+        else if (std::strcmp(argv[i], "--varied") == 0)
+            varied = true;
+        else if (std::strcmp(argv[i], "--trails") == 0 && i+1 < argc && nyan_parse_arg(argv[i+1], trailLength))
+            ++i;
+        else if (std::strcmp(argv[i], "--music") == 0)
+            musicFile = NYAN_MUSIC_FILE;
+        else if (std::strcmp(argv[i], "--music-file") == 0 && i+1 < argc)
+            musicFile = argv[++i];
+        else if (std::strcmp(argv[i], "--meows") == 0)
+            meows = true;
+        else if (std::strcmp(argv[i], "--export") == 0 && i+1 < argc)
+            exportOpts.filename = argv[++i];
+        else if (std::strcmp(argv[i], "--record") == 0 && i+1 < argc)
+            recordFile = argv[++i];
+        else if (std::strcmp(argv[i], "--replay") == 0 && i+1 < argc)
+            replayFile = argv[++i];
+        else if (std::strcmp(argv[i], "--budget") == 0 && i+1 < argc && nyan_parse_arg(argv[i+1], budgetMs))
+            ++i;
+        else if (std::strcmp(argv[i], "--mipmaps") == 0)
+            mipmaps = true;
+        else if (std::strcmp(argv[i], "--scalenx") == 0)
+            scaleNx = true;
+        else if (std::strcmp(argv[i], "--gl") == 0)
+            openGL = true;
+        else if (std::strcmp(argv[i], "--first-frame") == 0)
+            firstFrameOnly = true;
+        else if (std::strcmp(argv[i], "--shm") == 0 && i+1 < argc)
+            exportOpts.shmName = argv[++i];
+        else if (std::strcmp(argv[i], "--export-format") == 0 && i+1 < argc
+                 && parse_video_format(argv[i+1], exportOpts.format))
+            ++i;
+        else if (std::strcmp(argv[i], "--export-frames") == 0 && i+1 < argc
+                 && nyan_parse_arg(argv[i+1], exportOpts.frames))
+            ++i;
+        else if (std::strcmp(argv[i], "--export-fps") == 0 && i+1 < argc
+                 && nyan_parse_arg(argv[i+1], exportOpts.fps, 1))
+            ++i;
+        else if (std::strcmp(argv[i], "--export-size") == 0 && i+1 < argc
+                 && std::sscanf(argv[i+1], "%dx%d", &exportOpts.width, &exportOpts.height) == 2)
+            ++i;
+        else
+        {
+            log_error("Usage: %s [--swarm <nyanCount>] [--software] [--gl] [--threads <count>] [--varied]"
+                      " [--trails <length>] [--music] [--music-file <ogg>] [--meows] [--export <file|->]"
+                      " [--export-format y4m|rgba|png] [--export-frames <count>] [--export-fps <fps>]"
+                      " [--export-size <w>x<h>] [--shm <name>] [--record <file>] [--replay <file>]"
+                      " [--first-frame] [--budget <ms>] [--mipmaps] [--scalenx]", argv[0]);
+            return 1;
+        }
+    }
 
 #ifndef NDEBUG
     log_set_level(LOG_TRACE);
@@ -76,75 +708,363 @@ int main(int argc, char *argv[])
     log_set_level(LOG_DEBUG);
 #endif
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER))
+    // Headless: no window, no audio. Renders the swarm, 1000 cats by default.
+    if (exportOpts.filename || exportOpts.shmName)
+    {
+        if (SDL_Init(SDL_INIT_TIMER))
+            nyan_sdl_fatal("SDL_Init");
+
+        const size_t nyanCount = swarmCount ? swarmCount : 1000;
+        const int result = exportOpts.shmName ? share_swarm(exportOpts, nyanCount, threadCount, varied)
+            : export_swarm(exportOpts, nyanCount, threadCount, varied);
+        SDL_Quit();
+        return result;
+    }
+
+    // A replay brings its own settings and window size. It runs without vsync, as fast as possible.
+    NyanReplayHeader replayHeader = { 1280, 960 };
+    NyanReplay *replay = nullptr;
+
+    if (replayFile)
+    {
+        if (!(replay = nyan_replay_open(replayFile, replayHeader)))
+            return 1;
+
+        swarmCount = replayHeader.swarmCount;
+        trailLength = replayHeader.trailLength;
+        software = replayHeader.software;
+        varied = replayHeader.varied;
+        budgetMs = replayHeader.budgetMs;
+        recordFile = nullptr;
+    }
+
+    // The OpenGL backend draws nothing but the cats of the swarm.
+    if (openGL && !swarmCount)
+    {
+        log_error("--gl needs --swarm");
+        nyan_replay_close(replay);
+        return 1;
+    }
+    if (openGL && (software || mipmaps || trailLength))
+    {
+        log_warn("--gl: ignoring --software, --mipmaps and --trails");
+        software = mipmaps = false;
+        trailLength = 0;
+    }
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | (musicFile || meows ? SDL_INIT_AUDIO : 0)))
         nyan_sdl_fatal("SDL_Init");
 
+    startup_phase(startup, "SDL_Init");
+
 #ifdef SDL_HINT_IME_SHOW_UI
     SDL_SetHint(SDL_HINT_IME_SHOW_UI, "1");
 #endif
 
+    if (openGL)
+    {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    }
+
     const auto windowFlags = SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_OPENGL;
-    auto window = SDL_CreateWindow("sdl_nyan", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1280, 960, windowFlags);
+    auto window = SDL_CreateWindow("sdl_nyan", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                   replayHeader.windowWidth, replayHeader.windowHeight, windowFlags);
     if (!window)
         nyan_sdl_fatal("SDL_CreateWindow");
 
-    auto renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
+    startup_phase(startup, "window");
+
+    // With --gl there is a GL context instead of an SDL_Renderer, and no
+    // sheet texture.
+    SDL_Renderer *renderer = nullptr;
+    SDL_GLContext glContext = nullptr;
+
+    if (openGL)
+    {
+        if (!(glContext = SDL_GL_CreateContext(window)))
+            nyan_sdl_fatal("SDL_GL_CreateContext");
 
-    if (!renderer)
+        SDL_GL_SetSwapInterval(replay ? 0 : 1);
+    }
+    else if (!(renderer = SDL_CreateRenderer(window, -1,
+                                             (replay ? 0 : SDL_RENDERER_PRESENTVSYNC) | SDL_RENDERER_ACCELERATED)))
         nyan_sdl_fatal("SDL_CreateRenderer");
 
+    startup_phase(startup, "renderer");
+
     //auto nyanSheet = make_nyan_sprite_sheet_from_files(renderer);
-    auto nyanSheet = make_nyan_sprite_sheet_from_mem(renderer);
+    auto sheet = renderer ? nyan_sheet_acquire(renderer) : nullptr;
+
+    if (renderer && !sheet)
+        nyan_sdl_fatal("nyan_sheet_acquire");
+
+    auto nyanSheet = nyan_sheet_texture(sheet);
+
+    // The enlarged sprites of the default scene are upscaled once here and
+    // drawn 1:1.
+    NyanSheet *bigSheet = nullptr;
+
+    if (!swarmCount)
+    {
+        NyanSheetVariant bigVariant;
+        bigVariant.scale = 3;
+        bigVariant.upscale = scaleNx ? NyanUpscaleFilter::ScaleNx : NyanUpscaleFilter::Nearest;
+
+        if (!(bigSheet = nyan_sheet_acquire(renderer, bigVariant)))
+            nyan_sdl_fatal("nyan_sheet_acquire");
+    }
+
+    startup_phase(startup, "sprite sheet");
+
+    const auto decodeStats = nyan_decode_stats();
+    log_debug("sprite decoding: peak %zu bytes per sprite, %zu arenas holding %zu bytes, %llu heap allocations",
+              decodeStats.peakBytes, decodeStats.arenaCount, decodeStats.arenaBytes,
+              static_cast<unsigned long long>(decodeStats.heapAllocations));
 
     NyanSpinnyCircle nsc;
     nsc.nyanSheet = nyanSheet;
     nsc.centerPos = { 420/2, 420/2 };
 
+    NyanSwarmScene swarmScene;
+    swarmScene.window = window;
+    swarmScene.nyanSheet = nyanSheet;
+    swarmScene.geometryBatch = nyan_geometry_batch_create();
+
+    if (swarmCount)
+    {
+        int outputWidth = 0, outputHeight = 0;
+        if (openGL)
+            SDL_GL_GetDrawableSize(window, &outputWidth, &outputHeight);
+        else
+            SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight);
+        init_swarm_scene(swarmScene, swarmCount, outputWidth, outputHeight);
+
+        if (varied)
+            nyan_swarm_vary_looks(swarmScene.swarm);
+
+        if (trailLength)
+        {
+            nyan_trails_reset(swarmScene.trails, swarmCount, trailLength);
+            swarmScene.drawTrails = true;
+        }
+        if (budgetMs > 0.0f)
+        {
+            swarmScene.governed = true;
+            swarmScene.governor.config.budgetMs = budgetMs;
+            swarmScene.replay = replay;
+        }
+
+        swarmScene.jobs = nyan_jobs_create(threadCount);
+        log_info("swarm: using %u threads", nyan_jobs_thread_count(swarmScene.jobs));
+
+        if (openGL)
+        {
+            if (!(swarmScene.gl = nyan_gl_renderer_create(nyan_decode_sprite_sheet(swarmScene.jobs))))
+                nyan_sdl_fatal("nyan_gl_renderer_create");
+        }
+        else if (software)
+        {
+            swarmScene.sheetPixels = nyan_decode_sprite_sheet(swarmScene.jobs);
+            swarmScene.rasterizer = nyan_tile_rasterizer_create(swarmScene.jobs);
+        }
+        else if (mipmaps)
+        {
+            swarmScene.mips = nyan_build_mip_chain(nyan_decode_sprite_sheet(swarmScene.jobs), NyanBuiltinSprites::Set,
+                                                   0, swarmScene.jobs);
+            swarmScene.mipTexture = nyan_make_sheet_texture(renderer, swarmScene.mips.atlas);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+            // All frames are padded, level 0 too, filtering does not bleed into neighbors.
+            if (swarmScene.mipTexture)
+                SDL_SetTextureScaleMode(swarmScene.mipTexture, SDL_ScaleModeLinear);
+#endif
+            log_info("swarm: %zu mip levels in a %dx%d atlas", swarmScene.mips.levels.size(),
+                     swarmScene.mips.atlas.width, swarmScene.mips.atlas.height);
+        }
+    }
+
+    // Music and meows go through one mixer, it runs at the rate of the music.
+    NyanMusic *music = musicFile ? nyan_music_open(musicFile) : nullptr;
+    u64 musicUnderruns = 0;
+
+    if (music || meows)
+    {
+        swarmScene.mixer = nyan_mixer_create(music ? nyan_music_sample_rate(music) : 48000, 256);
+        swarmScene.meow = nyan_sound_meow(nyan_mixer_sample_rate(swarmScene.mixer));
+        nyan_mixer_set_music(swarmScene.mixer, music);
+
+        if (!nyan_mixer_open_device(swarmScene.mixer))
+            nyan_sdl_error("nyan_mixer_open_device");
+    }
+
+    NyanRecorder *recorder = nullptr;
+
+    if (recordFile)
+    {
+        NyanReplayHeader header = { 0, 0, static_cast<u32>(swarmCount), static_cast<u32>(trailLength), software,
+                                    varied, budgetMs };
+        SDL_GetWindowSize(window, &header.windowWidth, &header.windowHeight);
+
+        if (!(recorder = nyan_recorder_open(recordFile, header)))
+            return 1;
+
+        swarmScene.recorder = recorder;
+    }
+
+    startup_phase(startup, "scene setup");
     bool quit = false;
 
+    // Reports the startup times with the first frame, and quits there if
+    // only the cold start is of interest.
+    auto swap = [&]
+    {
+        if (renderer)
+            SDL_RenderPresent(renderer);
+        else
+            SDL_GL_SwapWindow(window);
+    };
+
+    auto present = [&]
+    {
+        if (startup.done)
+        {
+            swap();
+            return;
+        }
+
+        startup_phase(startup, "first frame");
+        swap();
+        startup_phase(startup, "present");
+        startup.done = true;
+        log_startup_times(startup);
+        quit = quit || firstFrameOnly;
+    };
+
+    auto handle_event = [&] (const SDL_Event &event)
+    {
+        if (event.type == SDL_QUIT)
+            quit = true;
+
+        if (event.type == SDL_KEYDOWN && event.key.keysym.mod & KMOD_CTRL && event.key.keysym.sym == SDLK_q)
+            quit = true;
+
+        if (swarmCount)
+            handle_swarm_event(swarmScene, event);
+    };
+
+    // Everything animated follows 'ticks': real time since startup, or the
+    // recorded time of the frame when replaying.
+    const u32 startTicks = SDL_GetTicks();
+    u32 ticks = 0;
+    std::vector<u64> replayFrameTicks;
+    u64 replayFrameStart = 0;
+
     while (!quit)
     {
+        if (replay)
+        {
+            const auto now = SDL_GetPerformanceCounter();
+            if (replayFrameStart)
+                replayFrameTicks.push_back(now - replayFrameStart);
+            replayFrameStart = now;
+
+            if (!nyan_replay_next_frame(replay, ticks))
+                break;
+        }
+        else
+            ticks = SDL_GetTicks() - startTicks;
+
+        if (recorder)
+            nyan_recorder_frame(recorder, ticks);
+
         SDL_Event event;
         while (SDL_PollEvent(&event))
         {
-            if (event.type == SDL_QUIT)
-                quit = true;
+            // Live input is ignored while replaying, except for closing the window.
+            if (replay)
+            {
+                quit = quit || event.type == SDL_QUIT;
+                continue;
+            }
+
+            if (recorder)
+                nyan_recorder_event(recorder, event);
+
+            handle_event(event);
+        }
+
+        while (replay && nyan_replay_poll_event(replay, event))
+        {
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                SDL_SetWindowSize(window, event.window.data1, event.window.data2);
+
+            handle_event(event);
+        }
+
+        if (music && nyan_music_underruns(music) != musicUnderruns)
+        {
+            musicUnderruns = nyan_music_underruns(music);
+            log_warn("music: %llu underruns", static_cast<unsigned long long>(musicUnderruns));
+        }
+
+        // The OpenGL backend clears in nyan_gl_begin_frame().
+        if (renderer)
+        {
+            SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+            SDL_RenderClear(renderer);
+        }
 
-            if (event.type == SDL_KEYDOWN && event.key.keysym.mod & KMOD_CTRL && event.key.keysym.sym == SDLK_q)
-                quit = true;
+        if (swarmCount)
+        {
+            do_swarm_step(renderer, swarmScene, ticks);
+            present();
+            continue;
         }
 
-        SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
-        SDL_RenderClear(renderer);
+        auto bigTexture = nyan_sheet_texture(bigSheet);
         auto sheetDestRect = nyan_sheet_rect();
         sheetDestRect.w *= 3;
         sheetDestRect.h *= 3;
-        SDL_RenderCopy(renderer, nyanSheet, nullptr, &sheetDestRect);
+        SDL_RenderCopy(renderer, bigTexture, nullptr, &sheetDestRect);
 
-        auto ticks = SDL_GetTicks();
         size_t nyanSpriteIndex = (ticks / 48) % NYAN_SPRITE_COUNT;
 
-        auto sourceRect = nyan_sprite_rect(nyanSpriteIndex);
-        auto destRect = nyan_sprite_rect(0);
-        destRect.w *= 3;
-        destRect.h *= 3;
+        auto sourceRect = nyan_sheet_sprite_rect(bigSheet, nyanSpriteIndex);
+        auto destRect = nyan_sheet_sprite_rect(bigSheet, 0);
         destRect.y += sheetDestRect.h;
-        SDL_RenderCopy(renderer, nyanSheet, &sourceRect, &destRect);
+        SDL_RenderCopy(renderer, bigTexture, &sourceRect, &destRect);
 
         destRect.x = 420/2;
         destRect.y = 420/2;
 
         SDL_Point centerPoint = {NYAN_SPRITE_WIDTH, NYAN_SPRITE_HEIGHT};
         double angle = (ticks / 4) % 360;
-        SDL_RenderCopyEx(renderer, nyanSheet, &sourceRect, &destRect, angle, &centerPoint, SDL_FLIP_NONE);
+        SDL_RenderCopyEx(renderer, bigTexture, &sourceRect, &destRect, angle, &centerPoint, SDL_FLIP_NONE);
 
-        do_circle_nyan_step(renderer, nsc);
+        do_circle_nyan_step(renderer, nsc, ticks);
 
-        SDL_RenderPresent(renderer);
+        present();
     }
 
-    SDL_DestroyTexture(nyanSheet);
-    SDL_DestroyRenderer(renderer);
+    if (replay)
+        log_replay_timing(replayFrameTicks);
+
+    nyan_replay_close(replay);
+    nyan_recorder_close(recorder);
+    nyan_mixer_destroy(swarmScene.mixer);
+    nyan_music_close(music);
+    nyan_tile_rasterizer_destroy(swarmScene.rasterizer);
+    nyan_geometry_batch_destroy(swarmScene.geometryBatch);
+    nyan_jobs_destroy(swarmScene.jobs);
+    SDL_DestroyTexture(swarmScene.frameTexture);
+    SDL_DestroyTexture(swarmScene.mipTexture);
+    nyan_sheet_release(bigSheet);
+    nyan_sheet_release(sheet);
+    nyan_gl_renderer_destroy(swarmScene.gl);
+    if (glContext)
+        SDL_GL_DeleteContext(glContext);
+    nyan_destroy_renderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
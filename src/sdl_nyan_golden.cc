@@ -0,0 +1,578 @@
+#include "log.h"
+#include "nyan_args.h"
+#include "nyan_gl.h"
+#include "nyan_jobs.h"
+#include "nyan_png.h"
+#include "nyan_soft.h"
+#include "nyan_swarm.h"
+#include "nyan_types.h"
+#include "stb_image.h"
+#include <sdl_nyan.h>
+#include <SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Golden image regression check. Renders a fixed set of scenes headlessly,
+// with the tile rasterizer and SDL's software renderer, and compares each
+// against a stored PNG. The output of SDL's renderer changes between SDL
+// versions, so only the tile rasterizer scenes have images in the repository;
+// the SDL scene is skipped unless an image exists, e.g. from a local --update.
+// The OpenGL scene is compared with the tile rasterizer instead, and skipped
+// without an OpenGL 3.3 context. Render times are checked against the ones
+// stored next to the images, so one run catches both kinds of regressions.
+//
+//   sdl_nyan_golden --update     (re)writes golden/*.png and golden/timings.txt
+//   sdl_nyan_golden              compares, exits with 1 on any failure
+//
+// Failing scenes leave <scene>.png and <scene>.diff.png in the output
+// directory. Differing pixels are red in the diff, the rest is the dimmed
+// golden image.
+
+static const float Pi = 3.14159265358979323846f;
+
+static void nyan_sdl_fatal(const char *const msg)
+{
+    log_fatal("%s: %s", msg, SDL_GetError());
+    abort();
+}
+
+struct GoldenOptions
+{
+    std::string goldenDir = "golden";
+    std::string outDir = ".";
+    std::string scene;             // only run scenes containing this
+    bool update = false;
+    int tolerance = 2;             // per channel
+    double maxBadFraction = 0.001; // of all pixels
+    int repeat = 5;
+    double maxSlowdown = 1.5;
+    bool failSlow = false;
+    unsigned threadCount = 0;
+};
+
+// One scene run: the last rendered image and the time of each repetition.
+// The image stays empty if the renderer is not available.
+struct GoldenRun
+{
+    const GoldenOptions *opts = nullptr;
+    NyanJobSystem *jobs = nullptr;
+    NyanImage image;
+    std::vector<double> seconds;
+};
+
+struct GoldenScene
+{
+    const char *name;
+    int width;
+    int height;
+    void (*render)(GoldenRun &run, const GoldenScene &scene);
+    size_t nyanCount;
+    float zoom;
+    u32 timeMs;
+    bool sdlRenderer;  // skipped instead of failing without a golden image
+
+    // Renders the expected image instead of loading a golden one, with a
+    // per channel tolerance of at least 'tolerance'.
+    void (*reference)(GoldenRun &run, const GoldenScene &scene) = nullptr;
+    int tolerance = 0;
+};
+
+static double seconds_since(u64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// SDL's software renderer drawing into an ARGB8888 surface.
+struct SoftTarget
+{
+    SDL_Surface *surface = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *nyanSheet = nullptr;
+
+    SoftTarget(int width, int height)
+    {
+        surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface)
+            nyan_sdl_fatal("SoftTarget/SDL_CreateRGBSurfaceWithFormat");
+
+        renderer = SDL_CreateSoftwareRenderer(surface);
+        if (!renderer)
+            nyan_sdl_fatal("SoftTarget/SDL_CreateSoftwareRenderer");
+
+        nyanSheet = make_nyan_sprite_sheet_from_mem(renderer);
+        if (!nyanSheet)
+            nyan_sdl_fatal("SoftTarget/make_nyan_sprite_sheet_from_mem");
+    }
+
+    ~SoftTarget()
+    {
+        SDL_DestroyTexture(nyanSheet);
+        SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+    }
+
+    void clear()
+    {
+        SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+        SDL_RenderClear(renderer);
+    }
+
+    void read(NyanImage &image) const
+    {
+        image.width = surface->w;
+        image.height = surface->h;
+        image.pixels.resize(static_cast<size_t>(surface->w) * surface->h);
+
+        for (int y=0; y<surface->h; ++y)
+        {
+            auto row = reinterpret_cast<const u32 *>(static_cast<const u8 *>(surface->pixels) + y * surface->pitch);
+            std::copy(row, row + surface->w, image.pixels.begin() + static_cast<size_t>(y) * surface->w);
+        }
+    }
+};
+
+// Draws 'cmds' with the tile rasterizer on the gray background of the demo.
+static void render_tiles(GoldenRun &run, const GoldenScene &scene, const std::vector<NyanDrawCmd> &cmds)
+{
+    auto rast = nyan_tile_rasterizer_create(run.jobs);
+    const auto sheet = nyan_decode_sprite_sheet(run.jobs);
+
+    run.image.width = scene.width;
+    run.image.height = scene.height;
+    run.image.pixels.resize(static_cast<size_t>(scene.width) * scene.height);
+    const auto fb = nyan_framebuffer(run.image);
+
+    for (int i=0; i<run.opts->repeat; ++i)
+    {
+        const auto start = SDL_GetPerformanceCounter();
+        nyan_tile_rasterize(rast, fb, sheet, cmds.data(), cmds.size(), 0xff808080u);
+        run.seconds.push_back(seconds_since(start));
+    }
+
+    nyan_tile_rasterizer_destroy(rast);
+}
+
+// The sprite sheet preview of the demo: the sheet and one sprite at 3x, and
+// the sprite rotated.
+static void render_sheet(GoldenRun &run, const GoldenScene &scene)
+{
+    std::vector<NyanDrawCmd> cmds(3);
+
+    const auto sheetRect = nyan_sheet_rect();
+    cmds[0].src = sheetRect;
+    cmds[0].dst = { 0.0f, 0.0f, sheetRect.w * 3.0f, sheetRect.h * 3.0f };
+
+    const auto src = nyan_sprite_rect(5);
+    cmds[1].src = src;
+    cmds[1].dst = { 0.0f, cmds[0].dst.h, src.w * 3.0f, src.h * 3.0f };
+
+    cmds[2] = cmds[1];
+    cmds[2].dst.x = 200.0f;
+    cmds[2].center = { cmds[2].dst.w / 2, cmds[2].dst.h / 2 };
+    cmds[2].angle = 30.0f;
+
+    render_tiles(run, scene, cmds);
+}
+
+// The spinning circle of the demo at 'scene.timeMs', assuming 60 frames per second.
+static void render_spinner(GoldenRun &run, const GoldenScene &scene)
+{
+    const u32 t = scene.timeMs;
+    const float frames = t * 60.0f / 1000.0f;
+    const float angle = std::fmod(0.015f * frames, 2.0f * Pi);
+    const float phase = std::fmod(frames * 0.4f + 42.0f, 168.0f);
+    const float bounce = (phase < 84.0f ? phase : 168.0f - phase) - 42.0f;
+    const auto src = nyan_sprite_rect((t / 48) % NYAN_SPRITE_COUNT);
+    const int count = 13;
+    std::vector<NyanDrawCmd> cmds(count);
+
+    for (int n=0; n<count; ++n)
+    {
+        const float a = angle + 2.0f * Pi * n / count;
+        auto &cmd = cmds[n];
+        cmd.src = src;
+        cmd.dst = { std::floor(scene.width / 2 + std::cos(a) * (100.0f + bounce)),
+                    std::floor(scene.height / 2 + std::sin(a) * (100.0f + bounce)),
+                    static_cast<float>(src.w), static_cast<float>(src.h) };
+        cmd.center = { static_cast<float>(NYAN_SPRITE_WIDTH), static_cast<float>(NYAN_SPRITE_HEIGHT) };
+        cmd.angle = a * 180.0f / Pi + 90.0f;
+    }
+
+    render_tiles(run, scene, cmds);
+}
+
+// A varied swarm after 30 steps, the whole world in view at 'scene.zoom'.
+static void build_swarm_cmds(const GoldenScene &scene, std::vector<NyanDrawCmd> &cmds)
+{
+    NyanSwarm swarm;
+    NyanGrid grid;
+    NyanCamera camera;
+    std::vector<u32> visible;
+
+    const float w = scene.width / scene.zoom, h = scene.height / scene.zoom;
+    nyan_swarm_populate(swarm, scene.nyanCount, { 0.0f, 0.0f, w, h });
+    nyan_swarm_vary_looks(swarm);
+    camera.center = { w * 0.5f, h * 0.5f };
+    camera.zoom = scene.zoom;
+    camera.viewWidth = scene.width;
+    camera.viewHeight = scene.height;
+
+    for (int i=0; i<30; ++i)
+        nyan_swarm_step(swarm, 1.0f / 60.0f);
+
+    nyan_grid_build(grid, swarm.world, 64.0f, swarm.cats.data(), swarm.cats.size());
+    nyan_swarm_cull(swarm, grid, camera, visible);
+    nyan_swarm_draw_cmds(swarm, camera, visible, 30.0f, cmds);
+}
+
+static void render_swarm_sdl(GoldenRun &run, const GoldenScene &scene)
+{
+    std::vector<NyanDrawCmd> cmds;
+    build_swarm_cmds(scene, cmds);
+
+    SoftTarget target(scene.width, scene.height);
+    auto batch = nyan_geometry_batch_create();
+
+    for (int i=0; i<run.opts->repeat; ++i)
+    {
+        const auto start = SDL_GetPerformanceCounter();
+        target.clear();
+
+        if (nyan_render_geometry(target.renderer, target.nyanSheet, batch, cmds.data(), cmds.size()))
+            nyan_sdl_fatal("render_swarm_sdl/nyan_render_geometry");
+
+        SDL_RenderFlush(target.renderer);
+        run.seconds.push_back(seconds_since(start));
+    }
+
+    target.read(run.image);
+    nyan_geometry_batch_destroy(batch);
+}
+
+static void render_swarm_tiles(GoldenRun &run, const GoldenScene &scene)
+{
+    std::vector<NyanDrawCmd> cmds;
+    build_swarm_cmds(scene, cmds);
+    render_tiles(run, scene, cmds);
+}
+
+// The swarm through nyan_gl.h into a hidden window. Texel centers and
+// blending round a little differently than in the tile rasterizer.
+static void render_swarm_gl(GoldenRun &run, const GoldenScene &scene)
+{
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO))
+    {
+        log_warn("render_swarm_gl: no video: %s", SDL_GetError());
+        return;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    auto window = SDL_CreateWindow("sdl_nyan_golden", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                   scene.width, scene.height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    auto context = window ? SDL_GL_CreateContext(window) : nullptr;
+    auto gl = context ? nyan_gl_renderer_create(nyan_decode_sprite_sheet(run.jobs)) : nullptr;
+
+    if (gl)
+    {
+        std::vector<NyanDrawCmd> cmds;
+        build_swarm_cmds(scene, cmds);
+
+        for (int i=0; i<run.opts->repeat; ++i)
+        {
+            const auto start = SDL_GetPerformanceCounter();
+            nyan_gl_begin_frame(gl, scene.width, scene.height, { 128, 128, 128, 255 });
+
+            if (nyan_gl_render(gl, cmds.data(), cmds.size()))
+                nyan_sdl_fatal("render_swarm_gl/nyan_gl_render");
+
+            nyan_gl_finish(gl);
+            run.seconds.push_back(seconds_since(start));
+        }
+
+        run.image = nyan_gl_read_pixels(gl);
+        nyan_gl_renderer_destroy(gl);
+    }
+    else
+        log_warn("render_swarm_gl: no OpenGL 3.3 context: %s", SDL_GetError());
+
+    if (context)
+        SDL_GL_DeleteContext(context);
+    if (window)
+        SDL_DestroyWindow(window);
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+static const GoldenScene Scenes[] =
+{
+    { "sheet",            1296, 160,  render_sheet,       0,      1.0f,  0,    false },
+    { "spinner_0ms",      420,  420,  render_spinner,     0,      1.0f,  0,    false },
+    { "spinner_1234ms",   420,  420,  render_spinner,     0,      1.0f,  1234, false },
+    { "spinner_7000ms",   420,  420,  render_spinner,     0,      1.0f,  7000, false },
+    { "swarm_100_sdl",    320,  180,  render_swarm_sdl,   100,    1.0f,  0,    true },
+    { "swarm_100_tiles",  320,  180,  render_swarm_tiles, 100,    1.0f,  0,    false },
+    { "swarm_400_tiles",  320,  180,  render_swarm_tiles, 400,    0.25f, 0,    false },
+    { "swarm_100_gl",     320,  180,  render_swarm_gl,    100,    1.0f,  0,    false, render_swarm_tiles, 4 },
+};
+
+static bool load_golden(const std::string &filename, NyanImage &image)
+{
+    int w = 0, h = 0, channels = 0;
+    u8 *data = stbi_load(filename.c_str(), &w, &h, &channels, 4);
+
+    if (!data)
+        return false;
+
+    image.width = w;
+    image.height = h;
+    image.pixels.resize(static_cast<size_t>(w) * h);
+
+    for (size_t i=0; i<image.pixels.size(); ++i)
+    {
+        const u8 *p = data + i * 4;
+        image.pixels[i] = (static_cast<u32>(p[3]) << 24) | (p[0] << 16) | (p[1] << 8) | p[2];
+    }
+
+    stbi_image_free(data);
+    return true;
+}
+
+struct GoldenDiff
+{
+    u64 badPixels = 0;
+    int maxDiff = 0;
+};
+
+// Compares all four channels. 'diff' gets the visualization.
+static GoldenDiff compare_images(const NyanImage &actual, const NyanImage &golden, int tolerance, NyanImage &diff)
+{
+    GoldenDiff result;
+    diff = golden;
+
+    for (size_t i=0; i<actual.pixels.size(); ++i)
+    {
+        const u32 a = actual.pixels[i], g = golden.pixels[i];
+        int pixelDiff = 0;
+
+        for (int shift=0; shift<32; shift+=8)
+            pixelDiff = std::max(pixelDiff, std::abs(static_cast<int>((a >> shift) & 0xff)
+                                                     - static_cast<int>((g >> shift) & 0xff)));
+
+        result.maxDiff = std::max(result.maxDiff, pixelDiff);
+
+        if (pixelDiff > tolerance)
+        {
+            ++result.badPixels;
+            diff.pixels[i] = 0xffff0000u;
+        }
+        else
+        {
+            const u32 luma = (((g >> 16) & 0xff) * 77 + ((g >> 8) & 0xff) * 151 + (g & 0xff) * 28) >> 10;
+            diff.pixels[i] = 0xff000000u | (luma << 16) | (luma << 8) | luma;
+        }
+    }
+
+    return result;
+}
+
+static std::map<std::string, double> load_timings(const std::string &filename)
+{
+    std::map<std::string, double> timings;
+    FILE *file = std::fopen(filename.c_str(), "r");
+
+    if (!file)
+        return timings;
+
+    char name[128];
+    double ms = 0.0;
+
+    while (std::fscanf(file, "%127s %lf", name, &ms) == 2)
+        timings[name] = ms;
+
+    std::fclose(file);
+    return timings;
+}
+
+static bool save_timings(const std::string &filename, const std::map<std::string, double> &timings)
+{
+    FILE *file = std::fopen(filename.c_str(), "w");
+
+    if (!file)
+    {
+        log_error("could not write '%s'", filename.c_str());
+        return false;
+    }
+
+    for (const auto &entry: timings)
+        std::fprintf(file, "%s %.4f\n", entry.first.c_str(), entry.second);
+
+    return std::fclose(file) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    log_set_level(LOG_INFO);
+
+    GoldenOptions opts;
+
+    for (int i=1; i<argc; ++i)
+    {
+        auto arg_is = [&] (const char *name) { return std::strcmp(argv[i], name) == 0 && i+1 < argc; };
+
+        if (arg_is("--golden-dir"))
+            opts.goldenDir = argv[++i];
+        else if (arg_is("--out-dir"))
+            opts.outDir = argv[++i];
+        else if (arg_is("--scene"))
+            opts.scene = argv[++i];
+        else if (std::strcmp(argv[i], "--update") == 0)
+            opts.update = true;
+        else if (arg_is("--tolerance") && nyan_parse_arg(argv[i+1], opts.tolerance))
+            ++i;
+        else if (arg_is("--max-bad") && nyan_parse_arg(argv[i+1], opts.maxBadFraction))
+            ++i;
+        else if (arg_is("--repeat") && nyan_parse_arg(argv[i+1], opts.repeat, 1))
+            ++i;
+        else if (arg_is("--max-slowdown") && nyan_parse_arg(argv[i+1], opts.maxSlowdown))
+            ++i;
+        else if (std::strcmp(argv[i], "--fail-slow") == 0)
+            opts.failSlow = true;
+        else if (arg_is("--threads") && nyan_parse_arg(argv[i+1], opts.threadCount))
+            ++i;
+        else
+        {
+            log_error("Usage: %s [--update] [--golden-dir <dir>] [--out-dir <dir>] [--scene <name>]"
+                      " [--tolerance <0-255>] [--max-bad <fraction>] [--repeat <count>] [--max-slowdown <ratio>]"
+                      " [--fail-slow] [--threads <count>]", argv[0]);
+            return 1;
+        }
+    }
+
+    if (SDL_Init(SDL_INIT_TIMER))
+        nyan_sdl_fatal("SDL_Init");
+
+    const std::string timingsFile = opts.goldenDir + "/timings.txt";
+    auto goldenTimings = load_timings(timingsFile);
+    auto jobs = nyan_jobs_create(opts.threadCount);
+    int failures = 0;
+
+    std::printf("%-18s %-8s %10s %8s %10s %10s %10s\n", "scene", "result", "bad px", "max diff", "min ms",
+                "median ms", "golden ms");
+
+    for (const auto &scene: Scenes)
+    {
+        if (!opts.scene.empty() && !std::strstr(scene.name, opts.scene.c_str()))
+            continue;
+
+        GoldenRun run;
+        run.opts = &opts;
+        run.jobs = jobs;
+
+        const std::string goldenFile = opts.goldenDir + "/" + scene.name + ".png";
+        NyanImage golden;
+        bool haveGolden = !opts.update && !scene.reference && load_golden(goldenFile, golden);
+
+        if (!opts.update && !haveGolden && scene.sdlRenderer)
+        {
+            std::printf("%-18s %-8s\n", scene.name, "skipped");
+            continue;
+        }
+
+        scene.render(run, scene);
+
+        if (run.image.pixels.empty())
+        {
+            std::printf("%-18s %-8s\n", scene.name, "skipped");
+            continue;
+        }
+
+        std::sort(run.seconds.begin(), run.seconds.end());
+        const double minMs = 1000.0 * run.seconds.front();
+        const double medianMs = 1000.0 * run.seconds[run.seconds.size() / 2];
+
+        // Nothing to update for a scene with a reference renderer but its time.
+        if (scene.reference)
+        {
+            GoldenOptions referenceOpts = opts;
+            referenceOpts.repeat = 1;
+
+            GoldenRun reference;
+            reference.opts = &referenceOpts;
+            reference.jobs = jobs;
+            scene.reference(reference, scene);
+            golden = std::move(reference.image);
+            haveGolden = true;
+
+            if (opts.update)
+                goldenTimings[scene.name] = medianMs;
+        }
+        else if (opts.update)
+        {
+            const bool ok = nyan_png_write(goldenFile.c_str(), run.image);
+            goldenTimings[scene.name] = medianMs;
+            failures += !ok;
+            std::printf("%-18s %-8s %10s %8s %10.3f %10.3f %10s\n", scene.name, ok ? "updated" : "FAILED", "", "",
+                        minMs, medianMs, "");
+            continue;
+        }
+
+        NyanImage diff;
+        GoldenDiff result;
+        const char *status = "ok";
+
+        if (!haveGolden)
+        {
+            status = "MISSING";
+            ++failures;
+        }
+        else if (golden.width != run.image.width || golden.height != run.image.height)
+        {
+            status = "SIZE";
+            ++failures;
+        }
+        else
+        {
+            result = compare_images(run.image, golden, std::max(opts.tolerance, scene.tolerance), diff);
+
+            if (result.badPixels > opts.maxBadFraction * golden.pixels.size())
+            {
+                status = "DIFF";
+                ++failures;
+
+                const std::string base = opts.outDir + "/" + scene.name;
+                nyan_png_write((base + ".png").c_str(), run.image);
+                nyan_png_write((base + ".diff.png").c_str(), diff);
+            }
+        }
+
+        // Timings depend on the machine, a slowdown only fails the run on request.
+        const auto it = goldenTimings.find(scene.name);
+        const double goldenMs = it != goldenTimings.end() ? it->second : 0.0;
+
+        if (goldenMs > 0.0 && medianMs > goldenMs * opts.maxSlowdown && !std::strcmp(status, "ok"))
+        {
+            status = "SLOW";
+            failures += opts.failSlow;
+        }
+
+        std::printf("%-18s %-8s %10llu %8d %10.3f %10.3f %10.3f\n", scene.name, status,
+                    static_cast<unsigned long long>(result.badPixels), result.maxDiff, minMs, medianMs, goldenMs);
+    }
+
+    if (opts.update && !save_timings(timingsFile, goldenTimings))
+        ++failures;
+
+    nyan_jobs_destroy(jobs);
+    SDL_Quit();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+#include "log.h"
+#include "nyan_args.h"
+#include "nyan_shm.h"
+#include "nyan_types.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reference consumer for the shared memory frame ring written by
+// 'sdl_nyan_demo --shm <name>'. Maps the ring read-only, reads each new frame
+// in place (a checksum over all pixels stands in for real work) and reports
+// how old frames are when they arrive: from render start and from publish.
+// Polling adds up to the poll interval, use --spin to busy-wait instead.
+
+struct ConsumerOptions
+{
+    std::string name = "/sdl_nyan";
+    u64 frames = 0;         // 0: until the producer closes the ring
+    int pollMicros = 100;
+    bool spin = false;
+};
+
+static void log_latencies(const char *what, std::vector<u64> &ns)
+{
+    if (ns.empty())
+        return;
+
+    std::sort(ns.begin(), ns.end());
+    double sum = 0.0;
+    for (auto v: ns)
+        sum += v;
+
+    auto pct = [&] (double p) { return ns[std::min(ns.size() - 1, static_cast<size_t>(p * ns.size()))] / 1e3; };
+
+    log_info("%s: min %.1f us, avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us", what, ns.front() / 1e3,
+             sum / ns.size() / 1e3, pct(0.5), pct(0.99), ns.back() / 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+    log_set_level(LOG_INFO);
+
+    ConsumerOptions opts;
+
+    for (int i=1; i<argc; ++i)
+    {
+        auto arg_is = [&] (const char *name) { return std::strcmp(argv[i], name) == 0 && i+1 < argc; };
+
+        if (arg_is("--name"))
+            opts.name = argv[++i];
+        else if (arg_is("--frames") && nyan_parse_arg(argv[i+1], opts.frames))
+            ++i;
+        else if (arg_is("--poll-us") && nyan_parse_arg(argv[i+1], opts.pollMicros, 0))
+            ++i;
+        else if (std::strcmp(argv[i], "--spin") == 0)
+            opts.spin = true;
+        else
+        {
+            log_error("Usage: %s [--name </shm-name>] [--frames <count>] [--poll-us <micros>] [--spin]", argv[0]);
+            return 1;
+        }
+    }
+
+    auto reader = nyan_shm_reader_open(opts.name.c_str());
+
+    if (!reader)
+        return 1;
+
+    std::vector<u64> sinceRender, sincePublish;
+    u64 received = 0, skipped = 0, torn = 0, checksum = 0;
+    u64 lastNumber = 0;
+    u64 lastReport = nyan_shm_now_ns(), reportReceived = 0;
+
+    while (!opts.frames || received < opts.frames)
+    {
+        NyanShmFrame frame;
+
+        if (!nyan_shm_reader_acquire(reader, frame))
+        {
+            if (nyan_shm_reader_closed(reader))
+                break;
+
+            if (!opts.spin)
+                std::this_thread::sleep_for(std::chrono::microseconds(opts.pollMicros));
+            continue;
+        }
+
+        const u64 now = nyan_shm_now_ns();
+        sinceRender.push_back(now - frame.renderStartNs);
+        sincePublish.push_back(now - frame.publishNs);
+
+        if (received && frame.number > lastNumber + 1)
+            skipped += frame.number - lastNumber - 1;
+
+        lastNumber = frame.number;
+        ++received;
+
+        // Zero copy: the pixels are read straight from the mapping.
+        u32 sum = 0;
+        for (int y=0; y<frame.height; ++y)
+        {
+            const u32 *row = frame.pixels + static_cast<size_t>(y) * frame.pitch;
+            for (int x=0; x<frame.width; ++x)
+                sum += row[x];
+        }
+
+        if (nyan_shm_reader_release(reader, frame))
+            checksum += sum;
+        else
+            ++torn;
+
+        if (now - lastReport >= 1000000000ull)
+        {
+            log_info("frame %llu: %llu fps, %.2f ms since render start, %.1f us since publish",
+                     static_cast<unsigned long long>(frame.number),
+                     static_cast<unsigned long long>(received - reportReceived),
+                     sinceRender.back() / 1e6, sincePublish.back() / 1e3);
+            lastReport = now;
+            reportReceived = received;
+        }
+    }
+
+    log_info("received %llu frames, %llu skipped, %llu torn, checksum %016llx",
+             static_cast<unsigned long long>(received), static_cast<unsigned long long>(skipped),
+             static_cast<unsigned long long>(torn), static_cast<unsigned long long>(checksum));
+    log_latencies("since publish", sincePublish);
+    log_latencies("since render start", sinceRender);
+
+    nyan_shm_reader_close(reader);
+
+    return 0;
+}